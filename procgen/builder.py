@@ -85,6 +85,15 @@ def _attempt_configure(build_type, package):
     ]
     if package:
         configure_cmd.append("-DPROCGEN_PACKAGE=ON")
+    # the native module is optional and skipped if this python has no development files
+    configure_cmd.append("-DPROCGEN_PYTHON_MODULE=ON")
+    configure_cmd.append(f"-DPython3_EXECUTABLE={sys.executable}")
+    # counts allocations per game and phase at some cost in speed, see get_alloc_stats() in env.py
+    alloc_tracking = os.environ.get("PROCGEN_ALLOC_TRACKING", "0") == "1"
+    configure_cmd.append(f"-DPROCGEN_ALLOC_TRACKING={'ON' if alloc_tracking else 'OFF'}")
+    # unchecked builds leave out the invariant checks in inner loops, see fassert_hot() in cpp-utils.h
+    check_level = os.environ.get("PROCGEN_CHECK_LEVEL", "checked")
+    configure_cmd.append(f"-DPROCGEN_CHECK_LEVEL={check_level}")
     if platform.system() != "Windows":
         # this is not used on windows, the option needs to be passed to cmake --build instead
         configure_cmd.append(f"-DCMAKE_BUILD_TYPE={build_type}")
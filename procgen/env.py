@@ -10,6 +10,10 @@ from .builder import build
 SCRIPT_DIR = os.path.dirname(os.path.abspath(__file__))
 
 MAX_STATE_SIZE = 2 ** 20
+# the phases that allocations are attributed to by get_alloc_stats(), in the order of AllocPhase in src/alloc-tracking.h
+ALLOC_PHASES = ["step", "reset", "render", "serialize"]
+
+LIB_NAMES = ["libenv.so", "libenv.dylib", "env.dll"]
 
 ENV_NAMES = [
     "bigfish",
@@ -63,66 +67,204 @@ def create_random_seed():
     return rand_seed
 
 
-class BaseProcgenEnv(CEnv):
+def get_lib_dir(debug=False):
+    lib_dir = os.path.join(SCRIPT_DIR, "data", "prebuilt")
+    if os.path.exists(lib_dir):
+        assert any([os.path.exists(os.path.join(lib_dir, name)) for name in LIB_NAMES]), "package is installed, but the prebuilt environment library is missing"
+        assert not debug, "debug has no effect for pre-compiled library"
+    else:
+        # only compile if we don't find a pre-built binary
+        lib_dir = build(debug=debug)
+    return lib_dir
+
+
+def get_lib_path(debug=False):
+    lib_dir = get_lib_dir(debug=debug)
+    for name in LIB_NAMES:
+        lib_path = os.path.join(lib_dir, name)
+        if os.path.exists(lib_path):
+            return lib_path
+    raise Exception(f"environment library not found in {lib_dir}")
+
+
+def get_combos():
     """
-    Base procedurally generated environment
+    The keys pressed for each action, in action order
     """
+    return [
+        ("LEFT", "DOWN"),
+        ("LEFT",),
+        ("LEFT", "UP"),
+        ("DOWN",),
+        (),
+        ("UP",),
+        ("RIGHT", "DOWN"),
+        ("RIGHT",),
+        ("RIGHT", "UP"),
+        ("D",),
+        ("A",),
+        ("W",),
+        ("S",),
+        ("Q",),
+        ("E",),
+    ]
+
+
+def make_options(
+    env_name,
+    center_agent=True,
+    use_backgrounds=True,
+    use_monochrome_assets=False,
+    restrict_themes=False,
+    use_generated_assets=False,
+    paint_vel_info=False,
+    distribution_mode="hard",
+    world_scale=1,
+    augment_translate=0,
+    augment_brightness=0.0,
+    augment_contrast=0.0,
+    augment_saturation=0.0,
+    augment_grayscale_prob=0.0,
+    augment_cutout=0,
+    augment_every_step=False,
+    rand_seed=None,
+    num_levels=None,
+    start_level=None,
+    use_sequential_levels=False,
+    eval_level_seeds=None,
+    debug_mode=0,
+    resource_root=None,
+    num_threads=4,
+    caller_runs=False,
+    render_batch_size=1,
+    game_arena=False,
+    game_arena_hugepages=False,
+    game_arena_block_size=2 * 1024 * 1024,
+    render_mode=None,
+    record_dir=None,
+    record_envs=None,
+    record_hires=False,
+    dataset_dir=None,
+    dataset_keyframe_interval=32,
+    oracle_info=False,
+    goal_distance_info=False,
+    agent_pos_info=False,
+    terminal_obs=False,
+    segmentation_obs=False,
+):
+    """
+    Validate the keyword arguments of ProcgenGym3Env and ProcgenNativeEnv and convert them to the options of the
+    environment library
+    """
+    assert (
+        distribution_mode in DISTRIBUTION_MODE_DICT
+    ), f'"{distribution_mode}" is not a valid distribution mode.'
 
-    def __init__(
-        self,
-        num,
-        env_name,
-        options,
-        debug=False,
-        rand_seed=None,
-        num_levels=0,
-        start_level=0,
-        use_sequential_levels=False,
-        debug_mode=0,
-        resource_root=None,
-        num_threads=4,
-        render_mode=None,
-    ):
-        if resource_root is None:
-            resource_root = os.path.join(SCRIPT_DIR, "data", "assets") + os.sep
-            assert os.path.exists(resource_root)
-
-        lib_dir = os.path.join(SCRIPT_DIR, "data", "prebuilt")
-        if os.path.exists(lib_dir):
-            assert any([os.path.exists(os.path.join(lib_dir, name)) for name in ["libenv.so", "libenv.dylib", "env.dll"]]), "package is installed, but the prebuilt environment library is missing"
-            assert not debug, "debug has no effect for pre-compiled library"
-        else:
-            # only compile if we don't find a pre-built binary
-            lib_dir = build(debug=debug)
-        
-        self.combos = self.get_combos()
+    if distribution_mode == "exploration":
+        assert (
+            env_name in EXPLORATION_LEVEL_SEEDS
+        ), f"{env_name} does not support exploration mode"
+
+        distribution_mode = "hard"
+        assert num_levels is None, "exploration mode overrides num_levels"
+        num_levels = 1
+        assert start_level is None, "exploration mode overrides start_level"
+        start_level = EXPLORATION_LEVEL_SEEDS[env_name]
+
+    if num_levels is None:
+        num_levels = 0
+    if start_level is None:
+        start_level = 0
+
+    if resource_root is None:
+        resource_root = os.path.join(SCRIPT_DIR, "data", "assets") + os.sep
+        assert os.path.exists(resource_root)
+
+    if render_mode is None:
+        render_human = False
+    elif render_mode == "rgb_array":
+        render_human = True
+    else:
+        raise Exception(f"invalid render mode {render_mode}")
+
+    if rand_seed is None:
+        rand_seed = create_random_seed()
+
+    if record_dir is None:
+        record_dir = ""
+    else:
+        os.makedirs(record_dir, exist_ok=True)
+
+    if dataset_dir is None:
+        dataset_dir = ""
+    else:
+        os.makedirs(dataset_dir, exist_ok=True)
+
+    if eval_level_seeds is None:
+        eval_level_seeds = ""
+    else:
+        eval_level_seeds = ",".join(str(int(seed)) for seed in eval_level_seeds)
+
+    if record_envs is None:
+        record_envs = ""
+    else:
+        record_envs = ",".join(str(env_idx) for env_idx in record_envs)
+
+    return {
+        "env_name": env_name,
+        "center_agent": bool(center_agent),
+        "use_generated_assets": bool(use_generated_assets),
+        "use_monochrome_assets": bool(use_monochrome_assets),
+        "restrict_themes": bool(restrict_themes),
+        "use_backgrounds": bool(use_backgrounds),
+        "paint_vel_info": bool(paint_vel_info),
+        "distribution_mode": DISTRIBUTION_MODE_DICT[distribution_mode],
+        "world_scale": int(world_scale),
+        "augment_translate": int(augment_translate),
+        "augment_brightness": float(augment_brightness),
+        "augment_contrast": float(augment_contrast),
+        "augment_saturation": float(augment_saturation),
+        "augment_grayscale_prob": float(augment_grayscale_prob),
+        "augment_cutout": int(augment_cutout),
+        "augment_every_step": bool(augment_every_step),
+        "num_levels": num_levels,
+        "start_level": start_level,
+        "num_actions": len(get_combos()),
+        "use_sequential_levels": bool(use_sequential_levels),
+        "eval_level_seeds": eval_level_seeds,
+        "debug_mode": debug_mode,
+        "rand_seed": rand_seed,
+        "num_threads": num_threads,
+        "caller_runs": bool(caller_runs),
+        "render_batch_size": render_batch_size,
+        "game_arena": bool(game_arena),
+        "game_arena_hugepages": bool(game_arena_hugepages),
+        "game_arena_block_size": int(game_arena_block_size),
+        "render_human": render_human,
+        "record_dir": record_dir,
+        "record_envs": record_envs,
+        "record_hires": bool(record_hires),
+        "dataset_dir": dataset_dir,
+        "dataset_keyframe_interval": dataset_keyframe_interval,
+        "oracle_info": bool(oracle_info),
+        "goal_distance_info": bool(goal_distance_info),
+        "agent_pos_info": bool(agent_pos_info),
+        "terminal_obs": bool(terminal_obs),
+        "segmentation_obs": bool(segmentation_obs),
+        # these will only be used the first time an environment is created in a process
+        "resource_root": resource_root,
+    }
 
-        if render_mode is None:
-            render_human = False
-        elif render_mode == "rgb_array":
-            render_human = True
-        else:
-            raise Exception(f"invalid render mode {render_mode}")
-
-        if rand_seed is None:
-            rand_seed = create_random_seed()
-
-        options.update(
-            {
-                "env_name": env_name,
-                "num_levels": num_levels,
-                "start_level": start_level,
-                "num_actions": len(self.combos),
-                "use_sequential_levels": bool(use_sequential_levels),
-                "debug_mode": debug_mode,
-                "rand_seed": rand_seed,
-                "num_threads": num_threads,
-                "render_human": render_human,
-                # these will only be used the first time an environment is created in a process
-                "resource_root": resource_root,
-            }
-        )
 
+class BaseProcgenEnv(CEnv):
+    """
+    Base procedurally generated environment, `options` are the library options returned by `make_options()`
+    """
+
+    def __init__(self, num, options, debug=False):
+        lib_dir = get_lib_dir(debug=debug)
+
+        self.combos = self.get_combos()
         self.options = options
 
         super().__init__(
@@ -132,6 +274,18 @@ class BaseProcgenEnv(CEnv):
             c_func_defs=[
                 "int get_state(libenv_env *, int, char *, int);",
                 "void set_state(libenv_env *, int, char *, int);",
+                "void get_oracle_actions(libenv_env *, int32_t *);",
+                "void procgen_set_policy(libenv_env *, int32_t (*)(void *, int, const uint8_t *, void *const *, float, uint8_t), void *, int, int32_t *, float *, uint8_t *, uint8_t *);",
+                "void procgen_set_oracle_policy(libenv_env *, int, int32_t *, float *, uint8_t *, uint8_t *);",
+                "void procgen_checkpoint(libenv_env *, const char *);",
+                "int procgen_wait_for_checkpoints(libenv_env *, char *, int);",
+                "int procgen_wait_for_recordings(libenv_env *, char *, int);",
+                "int procgen_wait_for_dataset(libenv_env *, char *, int);",
+                "int procgen_restore_checkpoint(libenv_env *, const char *, int, char *, int);",
+                "int procgen_get_alloc_stats(libenv_env *, int64_t *, int64_t *, int64_t *);",
+                "int64_t procgen_get_spin_pickups(libenv_env *);",
+                "void procgen_prepare_fork(libenv_env *);",
+                "void procgen_finish_fork(libenv_env *, int);",
             ],
         )
         # don't use the dict space for actions
@@ -139,7 +293,10 @@ class BaseProcgenEnv(CEnv):
 
     def get_state(self):
         length = MAX_STATE_SIZE
-        buf = self._ffi.new(f"char[{length}]")
+        # reuse the buffer across calls, allocating it is more expensive than serializing most games
+        if getattr(self, "_state_buf", None) is None:
+            self._state_buf = self._ffi.new(f"char[{length}]")
+        buf = self._state_buf
         result = []
         for env_idx in range(self.num):
             n = self.call_c_func("get_state", env_idx, buf, length)
@@ -152,24 +309,97 @@ class BaseProcgenEnv(CEnv):
             state = states[env_idx]
             self.call_c_func("set_state", env_idx, state, len(state))
 
+    def checkpoint(self, path):
+        """
+        Save every environment to `path` in the background, the states are taken at the end of the next `act()`
+        """
+        self.call_c_func("procgen_checkpoint", os.fsencode(path))
+
+    def wait_for_checkpoints(self):
+        """
+        Block until every requested checkpoint is on disk, raising an `IOError` if one of them could not be written
+        """
+        error = self._ffi.new("char[1024]")
+        if self.call_c_func("procgen_wait_for_checkpoints", error, 1024):
+            raise IOError(self._ffi.string(error).decode("utf8", "replace"))
+
+    def wait_for_recordings(self):
+        """
+        Block until every observation so far has been written to `record_dir`, raising an `IOError` if a write
+        failed, after which nothing more is recorded
+        """
+        error = self._ffi.new("char[1024]")
+        if self.call_c_func("procgen_wait_for_recordings", error, 1024):
+            raise IOError(self._ffi.string(error).decode("utf8", "replace"))
+
+    def wait_for_dataset(self):
+        """
+        Block until every step so far has been written to `dataset_dir`, raising an `IOError` if a write failed,
+        after which the dataset holds only the steps before the failure
+        """
+        error = self._ffi.new("char[1024]")
+        if self.call_c_func("procgen_wait_for_dataset", error, 1024):
+            raise IOError(self._ffi.string(error).decode("utf8", "replace"))
+
+    def restore_checkpoint(self, path, num_threads=None):
+        """
+        Restore every environment from a file written by `checkpoint()`, raising an `IOError` without changing
+        any of them if the file is missing, truncated or holds different games
+        """
+        if num_threads is None:
+            num_threads = os.cpu_count() or 1
+        error = self._ffi.new("char[1024]")
+        if self.call_c_func("procgen_restore_checkpoint", os.fsencode(path), num_threads, error, 1024):
+            raise IOError(self._ffi.string(error).decode("utf8", "replace"))
+
+    def fork(self):
+        """
+        Fork the process with `os.fork()`, stopping this environment's threads around it, and return the pid like `os.fork()`
+
+        Both processes can keep using the environment.  The child stops writing any recordings or datasets,
+        which stay with the parent.  Other environments in the process must not be stepped by the child.
+        """
+        self.call_c_func("procgen_prepare_fork")
+        try:
+            pid = os.fork()
+        except BaseException:
+            # no child was created, so the threads have to be started again in this process
+            self.call_c_func("procgen_finish_fork", 0)
+            raise
+        self.call_c_func("procgen_finish_fork", int(pid == 0))
+        return pid
+
+    def get_alloc_stats(self):
+        """
+        Allocations made by each environment so far, as a dict of `calls`, `allocs` and `bytes` arrays of shape
+        `(num, len(ALLOC_PHASES))`, or None if the library was built without `PROCGEN_ALLOC_TRACKING=1`
+        """
+        stats = {
+            key: np.zeros((self.num, len(ALLOC_PHASES)), dtype=np.int64)
+            for key in ["calls", "allocs", "bytes"]
+        }
+        ptrs = [self._ffi.cast("int64_t *", stats[key].ctypes.data) for key in ["calls", "allocs", "bytes"]]
+        if not self.call_c_func("procgen_get_alloc_stats", *ptrs):
+            return None
+        return stats
+
+    def get_spin_pickups(self):
+        """
+        Number of times a stepping thread found games to step while spinning in `caller_runs` mode, rather than
+        going to sleep and waiting to be woken up
+        """
+        return int(self.call_c_func("procgen_get_spin_pickups"))
+
+    def get_oracle_actions(self):
+        """
+        The action an expert would take in each environment, -1 for games without an oracle
+        """
+        actions = np.zeros(self.num, dtype=np.int32)
+        self.call_c_func("get_oracle_actions", self._ffi.cast("int32_t *", actions.ctypes.data))
+        return actions
+
     def get_combos(self):
-        return [
-            ("LEFT", "DOWN"),
-            ("LEFT",),
-            ("LEFT", "UP"),
-            ("DOWN",),
-            (),
-            ("UP",),
-            ("RIGHT", "DOWN"),
-            ("RIGHT",),
-            ("RIGHT", "UP"),
-            ("D",),
-            ("A",),
-            ("W",),
-            ("S",),
-            ("Q",),
-            ("E",),
-        ]
+        return get_combos()
 
     def keys_to_act(self, keys_list: Sequence[Sequence[str]]) -> List[Optional[np.ndarray]]:
         """
@@ -202,50 +432,12 @@ class BaseProcgenEnv(CEnv):
 
 class ProcgenGym3Env(BaseProcgenEnv):
     """
-    gym3 interface for Procgen
+    gym3 interface for Procgen, the keyword arguments are those of `make_options()`
     """
-    def __init__(
-        self,
-        num,
-        env_name,
-        center_agent=True,
-        use_backgrounds=True,
-        use_monochrome_assets=False,
-        restrict_themes=False,
-        use_generated_assets=False,
-        paint_vel_info=False,
-        distribution_mode="hard",
-        **kwargs,
-    ):
-        assert (
-            distribution_mode in DISTRIBUTION_MODE_DICT
-        ), f'"{distribution_mode}" is not a valid distribution mode.'
-
-        if distribution_mode == "exploration":
-            assert (
-                env_name in EXPLORATION_LEVEL_SEEDS
-            ), f"{env_name} does not support exploration mode"
-
-            distribution_mode = DISTRIBUTION_MODE_DICT["hard"]
-            assert "num_levels" not in kwargs, "exploration mode overrides num_levels"
-            kwargs["num_levels"] = 1
-            assert "start_level" not in kwargs, "exploration mode overrides start_level"
-            kwargs["start_level"] = EXPLORATION_LEVEL_SEEDS[env_name]
-        else:
-            distribution_mode = DISTRIBUTION_MODE_DICT[distribution_mode]
-
-        options = {
-                "center_agent": bool(center_agent),
-                "use_generated_assets": bool(use_generated_assets),
-                "use_monochrome_assets": bool(use_monochrome_assets),
-                "restrict_themes": bool(restrict_themes),
-                "use_backgrounds": bool(use_backgrounds),
-                "paint_vel_info": bool(paint_vel_info),
-                "distribution_mode": distribution_mode,
-            }
-        super().__init__(num, env_name, options, **kwargs)
-        
-        
+    def __init__(self, num, env_name, debug=False, **kwargs):
+        super().__init__(num, make_options(env_name, **kwargs), debug=debug)
+
+
 class ToBaselinesVecEnv(gym3.ToBaselinesVecEnv):
     metadata = {
         'render.modes': ['human', 'rgb_array'],
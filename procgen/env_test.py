@@ -1,6 +1,6 @@
 import numpy as np
 import pytest
-from .env import ENV_NAMES
+from .env import ENV_NAMES, ALLOC_PHASES, MAX_STATE_SIZE
 from procgen import ProcgenGym3Env
 
 
@@ -66,4 +66,768 @@ def test_multi_speed(env_name, num_envs, benchmark):
             env.observe()
             step_count += 1
 
-    benchmark(lambda: rollout(1000))
\ No newline at end of file
+    benchmark(lambda: rollout(1000))
+
+
+@pytest.mark.parametrize("num_envs", [1, 4, 16])
+@pytest.mark.parametrize("caller_runs", [False, True])
+def test_small_batch_latency(num_envs, caller_runs, benchmark):
+    env = ProcgenGym3Env(num=num_envs, env_name="coinrun", caller_runs=caller_runs)
+
+    actions = np.zeros([env.num])
+
+    def step():
+        env.act(actions)
+        env.observe()
+
+    benchmark(step)
+
+
+def test_caller_runs_helpers_pick_up_work_while_spinning():
+    # the batch is large enough that it is never stepped inline, so the stepping threads spin between steps
+    env = ProcgenGym3Env(num=64, env_name="coinrun", num_threads=2, caller_runs=True)
+    actions = np.zeros([env.num])
+    for _ in range(200):
+        env.act(actions)
+        env.observe()
+    assert env.get_spin_pickups() > 0
+
+
+@pytest.mark.parametrize("num_envs", [1, 4, 16])
+def test_caller_runs_matches_default(num_envs):
+    # small batches switch to stepping on the calling thread once the step time is known, which must not change anything
+    kwargs = dict(num=num_envs, env_name="coinrun", num_levels=0, start_level=0, rand_seed=11)
+    env = ProcgenGym3Env(**kwargs)
+    caller_env = ProcgenGym3Env(caller_runs=True, **kwargs)
+    rng = np.random.RandomState(0)
+    for _ in range(300):
+        rew, obs, first = env.observe()
+        caller_rew, caller_obs, caller_first = caller_env.observe()
+        assert np.array_equal(rew, caller_rew)
+        assert np.array_equal(first, caller_first)
+        assert np.array_equal(obs["rgb"], caller_obs["rgb"])
+        act = rng.randint(low=0, high=env.ac_space.eltype.n, size=(env.num,), dtype=np.int32)
+        env.act(act)
+        caller_env.act(act)
+
+
+@pytest.mark.parametrize("env_name", ["coinrun", "heist", "leaper", "starpilot"])
+def test_num_threads_keeps_initial_states(env_name):
+    # games are constructed and initialized on the stepping threads, which must not change the levels they start in
+    kwargs = dict(num=7, env_name=env_name, num_levels=0, start_level=0, rand_seed=11)
+    env = ProcgenGym3Env(num_threads=1, **kwargs)
+    _, obs, _ = env.observe()
+    states = env.get_state()
+    for num_threads in [0, 3, 4]:
+        other = ProcgenGym3Env(num_threads=num_threads, **kwargs)
+        _, other_obs, _ = other.observe()
+        assert other.get_state() == states
+        assert np.array_equal(other_obs["rgb"], obs["rgb"])
+
+
+def test_step_policy_callback():
+    num_envs = 3
+    steps_per_act = 4
+    kwargs = dict(num=num_envs, env_name="starpilot", num_levels=0, start_level=0, rand_seed=4)
+    env = ProcgenGym3Env(**kwargs)
+    ffi = env._ffi
+    # every call the policy gets, per environment, as (action, reward, first)
+    calls = [[] for _ in range(num_envs)]
+
+    @ffi.callback("int32_t(void *, int, const uint8_t *, void *const *, float, uint8_t)")
+    def policy(user_data, env_idx, obs, info, reward, first):
+        action = (env_idx + 7 * len(calls[env_idx])) % 15
+        calls[env_idx].append((action, reward, first))
+        return action
+
+    log_actions = np.zeros(num_envs * steps_per_act, dtype=np.int32)
+    log_rewards = np.zeros(num_envs * steps_per_act, dtype=np.float32)
+    log_firsts = np.zeros(num_envs * steps_per_act, dtype=np.uint8)
+
+    def ptr(arr, ctype):
+        return ffi.cast(ctype, arr.ctypes.data)
+
+    env.call_c_func("procgen_set_policy", policy, ffi.NULL, steps_per_act, ptr(log_actions, "int32_t *"), ptr(log_rewards, "float *"), ptr(log_firsts, "uint8_t *"), ffi.NULL)
+    # the current observation gets its action right away
+    assert [len(c) for c in calls] == [1] * num_envs
+
+    # the same actions passed through the action buffer one step at a time
+    reference = ProcgenGym3Env(**kwargs)
+    for act_idx in range(50):
+        env.act(np.zeros(num_envs, dtype=np.int32))
+        env.observe()
+        for step in range(steps_per_act):
+            k = act_idx * steps_per_act + step
+            actions = np.array([calls[i][k][0] for i in range(num_envs)], dtype=np.int32)
+            reference.act(actions)
+            rew, _, first = reference.observe()
+            for i in range(num_envs):
+                idx = i * steps_per_act + step
+                assert log_actions[idx] == actions[i]
+                # the reward and first flag of a step are logged and also passed to the policy for the next action
+                assert log_rewards[idx] == rew[i] == calls[i][k + 1][1]
+                assert log_firsts[idx] == first[i] == calls[i][k + 1][2]
+    # the rollout covered rewards and episode ends
+    assert any(c[1] != 0 for env_calls in calls for c in env_calls)
+    assert any(c[2] for env_calls in calls for c in env_calls[1:])
+
+    env.call_c_func("procgen_set_policy", ffi.NULL, ffi.NULL, 1, ffi.NULL, ffi.NULL, ffi.NULL, ffi.NULL)
+
+
+@pytest.mark.parametrize("env_name", ["maze", "heist"])
+def test_oracle_solves_levels(env_name):
+    env = ProcgenGym3Env(num=4, env_name=env_name, distribution_mode="easy", oracle_info=True)
+    info = env.get_info()
+    completed = 0
+    for _ in range(500):
+        actions = np.array([i["oracle_action"] for i in info], dtype=np.int32)
+        assert np.array_equal(actions, env.get_oracle_actions())
+        env.act(actions)
+        info = env.get_info()
+        completed += sum(i["prev_level_complete"] for i in info)
+    assert completed >= env.num
+
+
+@pytest.mark.parametrize("env_name", ["chaser", "caveflyer", "jumper"])
+def test_oracle_beats_random(env_name):
+    def total_reward(use_oracle):
+        env = ProcgenGym3Env(num=4, env_name=env_name, distribution_mode="hard", num_levels=0, start_level=0, rand_seed=3, oracle_info=True)
+        rng = np.random.RandomState(0)
+        num_actions = env.ac_space.eltype.n
+        info = env.get_info()
+        total = 0.0
+        for _ in range(1000):
+            oracle_actions = np.array([i["oracle_action"] for i in info], dtype=np.int32)
+            assert np.all((oracle_actions >= 0) & (oracle_actions < num_actions))
+            if use_oracle:
+                actions = oracle_actions
+            else:
+                actions = rng.randint(low=0, high=num_actions, size=(env.num,), dtype=np.int32)
+            env.act(actions)
+            rew, _, _ = env.observe()
+            info = env.get_info()
+            total += rew.sum()
+        return total
+
+    assert total_reward(use_oracle=True) > 2 * total_reward(use_oracle=False)
+
+
+
+def test_maze_layouts_unchanged():
+    import hashlib
+
+    # digest of the segmentation of the first frame of levels 0 to 99, which depends only on the layout
+    # the generator reproduced the frames of the original Kruskal implementation for these levels when it was recorded
+    digest = hashlib.md5()
+    for level in range(100):
+        env = ProcgenGym3Env(
+            num=1, env_name="maze", num_levels=1, start_level=level, center_agent=False, segmentation_obs=True
+        )
+        _, obs, _ = env.observe()
+        digest.update(obs["seg"][0].tobytes())
+    assert digest.hexdigest() == "beb4f44d62997a5623687611d6073e52"
+
+
+@pytest.mark.parametrize("env_name", ["bossfight", "leaper", "plunder", "starpilot"])
+def test_rebuilt_trajectories_match(env_name):
+    # the live env keeps the per-step bookkeeping of these games (traffic lanes, collision indices) from step to
+    # step, the rebuilt env reloads its plain entity lists from its serialized state before every step
+    kwargs = dict(num=4, env_name=env_name, num_levels=0, start_level=0, rand_seed=7)
+    live = ProcgenGym3Env(**kwargs)
+    rebuilt = ProcgenGym3Env(**kwargs)
+    rng = np.random.RandomState(0)
+    episodes = 0
+    for _ in range(300):
+        rebuilt.set_state(rebuilt.get_state())
+        act = rng.randint(low=0, high=live.ac_space.eltype.n, size=(live.num,), dtype=np.int32)
+        live.act(act)
+        rebuilt.act(act)
+        rew, _, first = live.observe()
+        rebuilt_rew, _, rebuilt_first = rebuilt.observe()
+        assert np.array_equal(rew, rebuilt_rew)
+        assert np.array_equal(first, rebuilt_first)
+        assert live.get_state() == rebuilt.get_state()
+        episodes += first.sum()
+    assert episodes > 0
+
+
+@pytest.mark.parametrize("env_name", ["leaper", "starpilot"])
+def test_state_round_trip(env_name):
+    kwargs = dict(num=4, env_name=env_name, num_levels=0, start_level=0, distribution_mode="hard")
+    env = ProcgenGym3Env(rand_seed=3, **kwargs)
+    rng = np.random.RandomState(0)
+    for _ in range(50):
+        env.act(rng.randint(low=0, high=env.ac_space.eltype.n, size=(env.num,), dtype=np.int32))
+
+    states = env.get_state()
+    restored = ProcgenGym3Env(rand_seed=4, **kwargs)
+    restored.set_state(states)
+    assert restored.get_state() == states
+    for _ in range(200):
+        rew, obs, first = env.observe()
+        restored_rew, restored_obs, restored_first = restored.observe()
+        assert np.array_equal(rew, restored_rew)
+        assert np.array_equal(first, restored_first)
+        assert np.array_equal(obs["rgb"], restored_obs["rgb"])
+        act = rng.randint(low=0, high=env.ac_space.eltype.n, size=(env.num,), dtype=np.int32)
+        env.act(act)
+        restored.act(act)
+
+@pytest.mark.parametrize("env_name", ["coinrun", "maze"])
+def test_large_world_state_round_trip(env_name):
+    kwargs = dict(num=2, env_name=env_name, world_scale=16, num_levels=0, start_level=0, distribution_mode="hard")
+    env = ProcgenGym3Env(rand_seed=2, **kwargs)
+    states = env.get_state()
+    assert all(len(state) < MAX_STATE_SIZE for state in states)
+    if env_name == "coinrun":
+        # most of a large coinrun world is uniform sky or ground, which takes one value per chunk
+        assert all(len(state) < 100_000 for state in states)
+    restored = ProcgenGym3Env(rand_seed=3, **kwargs)
+    restored.set_state(states)
+    assert restored.get_state() == states
+    _, obs, _ = env.observe()
+    _, restored_obs, _ = restored.observe()
+    assert np.array_equal(obs["rgb"], restored_obs["rgb"])
+
+
+def test_augment_keeps_levels():
+    def collect(**kwargs):
+        rng = np.random.RandomState(0)
+        env = ProcgenGym3Env(num=2, env_name="coinrun", rand_seed=5, **kwargs)
+        rews, seeds = [], []
+        for _ in range(200):
+            env.act(rng.randint(low=0, high=env.ac_space.eltype.n, size=(env.num,), dtype=np.int32))
+            rew, obs, _ = env.observe()
+            info = env.get_info()
+            rews.append(rew)
+            seeds.append([i["level_seed"] for i in info])
+        return np.array(rews), np.array(seeds), obs["rgb"], info
+
+    rews1, seeds1, obs1, _ = collect()
+    rews2, seeds2, obs2, info = collect(augment_translate=4, augment_brightness=0.3, augment_cutout=8)
+    assert np.array_equal(rews1, rews2)
+    assert np.array_equal(seeds1, seeds2)
+    assert not np.array_equal(obs1, obs2)
+    assert info[0]["augment"].shape == (7,)
+
+
+
+def test_segmentation_labels():
+    # maze shows the whole 25x25 world in hard mode and draws the agent with the shared PLAYER image type
+    world_dim = 25
+    unit = 64 / world_dim
+    player_label = 1
+    kwargs = dict(num=4, env_name="maze", num_levels=0, start_level=0, rand_seed=2, segmentation_obs=True, agent_pos_info=True)
+    env = ProcgenGym3Env(**kwargs)
+    augmented = ProcgenGym3Env(augment_translate=4, augment_cutout=8, augment_every_step=True, **kwargs)
+    rng = np.random.RandomState(0)
+    for _ in range(100):
+        _, obs, _ = env.observe()
+        _, augmented_obs, _ = augmented.observe()
+        info = env.get_info()
+        for i in range(env.num):
+            # every pixel with the agent's label is under the agent's rect
+            ys, xs = np.nonzero(obs["seg"][i] == player_label)
+            assert len(xs) > 0
+            ax, ay = info[i]["agent_x"], world_dim - info[i]["agent_y"]
+            assert np.all(np.abs(xs + 0.5 - ax * unit) <= unit / 2 + 1)
+            assert np.all(np.abs(ys + 0.5 - ay * unit) <= unit / 2 + 1)
+
+            # the labels are shifted and cut out exactly like the frame
+            dx, dy, _, _, _, cutout_x, cutout_y = augmented.get_info()[i]["augment"].astype(int)
+            src_y = np.clip(np.arange(64) - dy, 0, 63)
+            src_x = np.clip(np.arange(64) - dx, 0, 63)
+            expected_rgb = obs["rgb"][i][src_y][:, src_x]
+            expected_seg = obs["seg"][i][src_y][:, src_x]
+            if cutout_x >= 0:
+                expected_rgb[cutout_y : cutout_y + 8, cutout_x : cutout_x + 8] = 0
+                expected_seg[cutout_y : cutout_y + 8, cutout_x : cutout_x + 8] = 0
+            assert np.array_equal(augmented_obs["rgb"][i], expected_rgb)
+            assert np.array_equal(augmented_obs["seg"][i], expected_seg)
+        act = rng.randint(low=0, high=env.ac_space.eltype.n, size=(env.num,), dtype=np.int32)
+        env.act(act)
+        augmented.act(act)
+
+def test_game_info_fields():
+    def rollout(env_name, use_oracle=False, **kwargs):
+        env = ProcgenGym3Env(num=4, env_name=env_name, num_levels=0, start_level=0, rand_seed=1, oracle_info=use_oracle, **kwargs)
+        rng = np.random.RandomState(0)
+        rews, firsts, infos = [], [], []
+        for _ in range(300):
+            rew, _, first = env.observe()
+            info = env.get_info()
+            rews.append(rew)
+            firsts.append(first)
+            infos.append(info)
+            if use_oracle:
+                act = np.array([i["oracle_action"] for i in info], dtype=np.int32)
+            else:
+                act = rng.randint(low=0, high=env.ac_space.eltype.n, size=(env.num,), dtype=np.int32)
+            env.act(act)
+        return np.array(rews), np.array(firsts), infos
+
+    def values(infos, key):
+        return np.array([[info[key] for info in step] for step in infos])
+
+    # the agent position is only reported when asked for, and follows the agent
+    _, _, infos = rollout("coinrun")
+    assert "agent_x" not in infos[0][0]
+    _, _, infos = rollout("coinrun", agent_pos_info=True)
+    for key in ["agent_x", "agent_y"]:
+        pos = values(infos, key)
+        assert pos.dtype == np.float32
+        assert len(np.unique(pos)) > 1
+
+    # keys are only picked up during an episode
+    _, first, infos = rollout("heist", use_oracle=True)
+    keys_held = values(infos, "keys_held")
+    assert keys_held.dtype == np.int32
+    assert np.all(keys_held[first.astype(bool)] == 0)
+    assert np.all((keys_held[1:] >= keys_held[:-1]) | first[1:].astype(bool))
+    assert keys_held.max() > 0
+
+    # juice starts full and runs out over time
+    _, first, infos = rollout("plunder")
+    juice_left = values(infos, "juice_left")
+    assert juice_left.dtype == np.float32
+    assert np.all(juice_left[first.astype(bool)] == 1)
+    assert juice_left.min() < 1
+
+    # every fish eaten gives a reward of 1
+    rew, first, infos = rollout("bigfish")
+    fish_eaten = values(infos, "fish_eaten")
+    assert fish_eaten.dtype == np.int32
+    assert np.all(fish_eaten[first.astype(bool)] == 0)
+    during_episode = ~first[1:].astype(bool)
+    assert np.array_equal((fish_eaten[1:] - fish_eaten[:-1])[during_episode], rew[1:][during_episode])
+    assert fish_eaten.max() > 0
+
+
+def test_goal_distance():
+    env = ProcgenGym3Env(num=4, env_name="maze", distribution_mode="easy", num_levels=0, start_level=0, oracle_info=True, goal_distance_info=True)
+    info = env.get_info()
+    completed = 0
+    for _ in range(300):
+        prev_dists = [i["goal_distance"] for i in info]
+        assert all(d > 0 for d in prev_dists)
+        env.act(np.array([i["oracle_action"] for i in info], dtype=np.int32))
+        _, _, first = env.observe()
+        info = env.get_info()
+        for env_idx in range(env.num):
+            if first[env_idx]:
+                # the step onto the goal, at distance 0, completes the level, so it is never observed
+                assert info[env_idx]["prev_level_complete"] and prev_dists[env_idx] == 1
+                completed += 1
+            else:
+                # each oracle step follows a shortest path
+                assert info[env_idx]["goal_distance"] == prev_dists[env_idx] - 1
+    assert completed >= env.num
+
+    # games without a goal report -1
+    env = ProcgenGym3Env(num=2, env_name="bigfish", goal_distance_info=True)
+    env.act(np.zeros(env.num, dtype=np.int32))
+    assert all(i["goal_distance"] == -1 for i in env.get_info())
+
+
+def test_terminal_obs():
+    # maze only changes when the agent moves, so a no-op last step leaves the last observation unchanged
+    env = ProcgenGym3Env(num=3, env_name="maze", distribution_mode="easy", terminal_obs=True, oracle_info=True, num_levels=0, start_level=0)
+    noop = 4
+    ended = [False] * env.num
+    _, obs, _ = env.observe()
+    for step in range(500):
+        info = env.get_info()
+        # env 0 runs into the time limit, env 1 is forced to reset and env 2 reaches the goal
+        act = np.array([noop, -1 if step == 10 else noop, info[2]["oracle_action"]], dtype=np.int32)
+        last_rgb = obs["rgb"].copy()
+        env.act(act)
+        _, obs, first = env.observe()
+        info = env.get_info()
+        for i in range(env.num):
+            if not first[i] or ended[i]:
+                continue
+            ended[i] = True
+            if i == 2:
+                assert info[i]["truncated"] == 0
+                assert not np.array_equal(info[i]["terminal_rgb"], obs["rgb"][i])
+            else:
+                assert info[i]["truncated"] == 1
+                assert np.array_equal(info[i]["terminal_rgb"], last_rgb[i])
+        if step == 10:
+            assert first[1]
+    assert all(ended)
+    assert first[0]
+
+
+@pytest.mark.parametrize("env_name", ["maze", "starpilot", "leaper"])
+def test_game_arena_matches_heap(env_name):
+    kwargs = dict(num=4, env_name=env_name, num_levels=0, start_level=0, rand_seed=5)
+    env = ProcgenGym3Env(**kwargs)
+    # the smallest block size makes the arena go through many blocks
+    arena_env = ProcgenGym3Env(game_arena=True, game_arena_block_size=64 * 1024, **kwargs)
+    rng = np.random.RandomState(0)
+    for step in range(300):
+        rew, obs, first = env.observe()
+        arena_rew, arena_obs, arena_first = arena_env.observe()
+        assert np.array_equal(rew, arena_rew)
+        assert np.array_equal(first, arena_first)
+        assert np.array_equal(obs["rgb"], arena_obs["rgb"])
+        if step % 50 == 0:
+            assert env.get_state() == arena_env.get_state()
+        act = rng.randint(low=0, high=env.ac_space.eltype.n, size=(env.num,), dtype=np.int32)
+        env.act(act)
+        arena_env.act(act)
+
+    # states move between environments with and without an arena
+    arena_env.set_state(env.get_state())
+    assert arena_env.get_state() == env.get_state()
+
+
+def test_native_matches_gym3():
+    from .native import ProcgenNativeEnv, load_native_module
+
+    try:
+        load_native_module()
+    except Exception:
+        pytest.skip("native module was not built")
+
+    # both envs take the same keyword arguments, including the ones converted before reaching the library
+    kwargs = dict(num=2, env_name="coinrun", rand_seed=3, num_levels=0, start_level=0, distribution_mode="easy", use_backgrounds=False)
+    env = ProcgenGym3Env(**kwargs)
+    native = ProcgenNativeEnv(**kwargs)
+    rng = np.random.RandomState(0)
+    for _ in range(100):
+        rew, obs, first = env.observe()
+        native_rew, native_obs, native_first = native.observe()
+        assert np.array_equal(obs["rgb"], native_obs["rgb"])
+        assert np.array_equal(rew, native_rew)
+        assert np.array_equal(first, native_first)
+        ac = rng.randint(low=0, high=env.ac_space.eltype.n, size=(env.num,), dtype=np.int32)
+        env.act(ac)
+        native.act(ac)
+    native.close()
+
+
+def test_checkpoint_restore(tmp_path):
+    path = str(tmp_path / "envs.ckpt")
+    kwargs = dict(num=4, env_name="coinrun", num_levels=0, start_level=0)
+    env = ProcgenGym3Env(rand_seed=1, **kwargs)
+    rng = np.random.RandomState(0)
+    for step in range(20):
+        if step == 10:
+            env.checkpoint(path)
+        env.act(rng.randint(low=0, high=env.ac_space.eltype.n, size=(env.num,), dtype=np.int32))
+        if step == 10:
+            expected_states = env.get_state()
+    env.wait_for_checkpoints()
+
+    restored = ProcgenGym3Env(rand_seed=2, **kwargs)
+    restored.restore_checkpoint(path)
+    assert restored.get_state() == expected_states
+
+    # a failed write is reported once by the next wait instead of ending the process
+    env.checkpoint(str(tmp_path / "missing" / "envs.ckpt"))
+    env.act(np.zeros(env.num, dtype=np.int32))
+    with pytest.raises(IOError):
+        env.wait_for_checkpoints()
+    env.wait_for_checkpoints()
+
+
+def test_checkpoint_restore_errors(tmp_path):
+    path = str(tmp_path / "envs.ckpt")
+    kwargs = dict(num_levels=0, start_level=0, rand_seed=1)
+    env = ProcgenGym3Env(num=4, env_name="coinrun", **kwargs)
+    env.checkpoint(path)
+    env.wait_for_checkpoints()
+    with open(path, "rb") as f:
+        data = f.read()
+    with open(str(tmp_path / "truncated.ckpt"), "wb") as f:
+        f.write(data[: len(data) // 2])
+
+    # failures are raised without touching the environments
+    for other_env, other_path in [
+        (ProcgenGym3Env(num=4, env_name="coinrun", **kwargs), str(tmp_path / "missing.ckpt")),
+        (ProcgenGym3Env(num=4, env_name="coinrun", **kwargs), str(tmp_path / "truncated.ckpt")),
+        (ProcgenGym3Env(num=3, env_name="coinrun", **kwargs), path),
+        (ProcgenGym3Env(num=4, env_name="maze", **kwargs), path),
+    ]:
+        states = other_env.get_state()
+        with pytest.raises(IOError):
+            other_env.restore_checkpoint(other_path)
+        assert other_env.get_state() == states
+
+
+
+@pytest.mark.parametrize("keep_index", [True, False])
+def test_dataset_round_trip(tmp_path, keep_index):
+    import os
+    from .trajectory import TrajectoryReader
+
+    dataset_dir = str(tmp_path)
+    env = ProcgenGym3Env(num=3, env_name="maze", num_levels=0, start_level=0, center_agent=False, dataset_dir=dataset_dir)
+    rng = np.random.RandomState(0)
+    obses, rews, firsts, actions = [], [], [], []
+    last_act = np.full(env.num, -1, dtype=np.int32)
+    for _ in range(300):
+        rew, obs, first = env.observe()
+        obses.append(obs["rgb"])
+        rews.append(rew)
+        firsts.append(first)
+        actions.append(last_act)
+        last_act = rng.randint(low=0, high=env.ac_space.eltype.n, size=(env.num,), dtype=np.int32)
+        env.act(last_act)
+    env.close()
+    if not keep_index:
+        os.remove(os.path.join(dataset_dir, "index.bin"))
+
+    reader = TrajectoryReader(dataset_dir)
+    assert reader.num_envs == env.num and (reader.height, reader.width) == obses[0].shape[1:3]
+    num_steps = len(obses)
+    result = reader.read(list(range(env.num)), [0] * env.num, num_steps)
+    # the writer also records the observation after the last act()
+    assert all(reader.num_steps(e) == num_steps + 1 for e in range(env.num))
+    assert np.array_equal(result["rgb"], np.stack(obses, axis=1))
+    assert np.array_equal(result["reward"][:, 1:], np.stack(rews, axis=1)[:, 1:])
+    assert np.array_equal(result["first"][:, 1:], np.stack(firsts, axis=1)[:, 1:])
+    assert np.array_equal(result["action"], np.stack(actions, axis=1))
+    reader.close()
+
+    # a maze frame changes in only a few places from step to step
+    dataset_bytes = sum(os.path.getsize(os.path.join(dataset_dir, name)) for name in os.listdir(dataset_dir))
+    assert dataset_bytes * 4 < np.stack(obses).nbytes
+
+
+def test_dataset_write_error(tmp_path):
+    import os
+
+    # a directory in the way of the first chunk makes opening it fail
+    dataset_dir = str(tmp_path)
+    os.mkdir(os.path.join(dataset_dir, "chunk_0.bin"))
+    env = ProcgenGym3Env(num=2, env_name="maze", num_levels=0, start_level=0, dataset_dir=dataset_dir)
+    for _ in range(10):
+        env.act(np.zeros(env.num, dtype=np.int32))
+    with pytest.raises(IOError):
+        env.wait_for_dataset()
+    # the error is only reported once, and the writer stops without writing an index
+    env.act(np.zeros(env.num, dtype=np.int32))
+    env.wait_for_dataset()
+    env.close()
+    assert not os.path.exists(os.path.join(dataset_dir, "index.bin"))
+
+
+def test_record_y4m(tmp_path):
+    import os
+
+    record_dir = str(tmp_path)
+    env = ProcgenGym3Env(num=2, env_name="maze", distribution_mode="easy", num_levels=0, start_level=0, record_dir=record_dir, record_envs=[1])
+    rng = np.random.RandomState(0)
+    # frames recorded for each episode of env 1, the 500 step time limit ends at least one episode
+    episode_lengths = []
+    for step in range(601):
+        _, _, first = env.observe()
+        if step == 0 or first[1]:
+            episode_lengths.append(0)
+        episode_lengths[-1] += 1
+        if step < 600:
+            env.act(rng.randint(low=0, high=env.ac_space.eltype.n, size=(env.num,), dtype=np.int32))
+    env.close()
+
+    assert len(episode_lengths) > 1
+    assert sorted(os.listdir(record_dir)) == sorted(f"env1_ep{i}.y4m" for i in range(len(episode_lengths)))
+    h, w = env.ob_space["rgb"].shape[:2]
+    frame_size = len(b"FRAME\n") + w * h * 3
+    for episode, length in enumerate(episode_lengths):
+        with open(os.path.join(record_dir, f"env1_ep{episode}.y4m"), "rb") as f:
+            header, _, frames = f.read().partition(b"\n")
+        assert header == f"YUV4MPEG2 W{w} H{h} F15:1 Ip A1:1 C444".encode()
+        assert len(frames) == length * frame_size
+        assert all(frames[i * frame_size:i * frame_size + 6] == b"FRAME\n" for i in range(length))
+
+
+def test_record_write_error(tmp_path):
+    import os
+
+    # a directory in the way of the first recording makes opening it fail
+    record_dir = str(tmp_path)
+    os.mkdir(os.path.join(record_dir, "env0_ep0.y4m"))
+    env = ProcgenGym3Env(num=2, env_name="maze", num_levels=0, start_level=0, record_dir=record_dir)
+    for _ in range(10):
+        env.act(np.zeros(env.num, dtype=np.int32))
+    with pytest.raises(IOError):
+        env.wait_for_recordings()
+    # the error is only reported once, and nothing more is recorded
+    env.act(np.zeros(env.num, dtype=np.int32))
+    env.wait_for_recordings()
+    env.close()
+
+
+def test_mt19937_matches_reference():
+    from cffi import FFI
+    from .env import get_lib_path
+
+    ffi = FFI()
+    ffi.cdef("void procgen_mt19937_generate(uint32_t seed, int count, uint32_t *out);")
+    lib = ffi.dlopen(get_lib_path())
+
+    def generate(seed, count):
+        out = np.zeros(count, dtype=np.uint32)
+        lib.procgen_mt19937_generate(seed, count, ffi.cast("uint32_t *", out.ctypes.data))
+        return out
+
+    # the C++ standard requires the 10000th number of a default seeded std::mt19937 to be 4123659995
+    assert generate(5489, 10000)[-1] == 4123659995
+    # numpy's RandomState seeds MT19937 from an int the same way as std::mt19937, and a full range randint is one raw draw
+    for seed in [0, 1, 5489, 123456789, 2 ** 31 - 1, 2 ** 32 - 1]:
+        expected = np.random.RandomState(seed).randint(0, 2 ** 32, size=2000, dtype=np.uint32)
+        assert np.array_equal(generate(seed, 2000), expected)
+
+
+def test_eval_level_seeds():
+    seeds = [5, 6, 7, 8, 9]
+    env = ProcgenGym3Env(num=3, env_name="bigfish", eval_level_seeds=seeds)
+    rng = np.random.RandomState(0)
+    episodes = [0] * env.num
+    for _ in range(2000):
+        _, _, first = env.observe()
+        level_seeds = env.get_info()
+        for i in range(env.num):
+            if first[i]:
+                assert level_seeds[i]["level_seed"] == seeds[(i + episodes[i] * env.num) % len(seeds)]
+                episodes[i] += 1
+        env.act(rng.randint(low=0, high=env.ac_space.eltype.n, size=(env.num,), dtype=np.int32))
+    assert min(episodes) > len(seeds)
+
+    # the progress through the list is restored along with the rest of the state
+    restored = ProcgenGym3Env(num=3, env_name="bigfish", eval_level_seeds=seeds)
+    restored.set_state(env.get_state())
+    for _ in range(500):
+        act = rng.randint(low=0, high=env.ac_space.eltype.n, size=(env.num,), dtype=np.int32)
+        env.act(act)
+        restored.act(act)
+        assert [i["level_seed"] for i in env.get_info()] == [i["level_seed"] for i in restored.get_info()]
+
+    # a level copied from another environment looks the same as one generated for a single level
+    for i in range(env.num):
+        single = ProcgenGym3Env(num=1, env_name="bigfish", num_levels=1, start_level=seeds[i])
+        eval_env = ProcgenGym3Env(num=env.num, env_name="bigfish", eval_level_seeds=[seeds[i]] * env.num)
+        assert np.array_equal(eval_env.observe()[1]["rgb"][i], single.observe()[1]["rgb"][0])
+
+
+@pytest.mark.parametrize("env_name", ["maze", "starpilot"])
+def test_render_batch_size(env_name):
+    kwargs = dict(num=9, env_name=env_name, num_levels=1, start_level=0, segmentation_obs=True)
+    env = ProcgenGym3Env(**kwargs)
+    # how the games are split into batches depends on the threads and timing, but must not change the frames
+    batched_envs = [
+        ProcgenGym3Env(render_batch_size=3, **kwargs),
+        ProcgenGym3Env(render_batch_size=8, num_threads=0, **kwargs),
+        ProcgenGym3Env(render_batch_size=4, num_threads=3, caller_runs=True, **kwargs),
+    ]
+    rng = np.random.RandomState(0)
+    for _ in range(100):
+        rew, obs, first = env.observe()
+        batched_rew, batched_obs, batched_first = batched_envs[0].observe()
+        assert np.array_equal(rew, batched_rew)
+        assert np.array_equal(first, batched_first)
+        assert np.array_equal(obs["seg"], batched_obs["seg"])
+        for other in batched_envs[1:]:
+            other_rew, other_obs, other_first = other.observe()
+            assert np.array_equal(batched_rew, other_rew)
+            assert np.array_equal(batched_first, other_first)
+            assert np.array_equal(batched_obs["rgb"], other_obs["rgb"])
+        act = rng.randint(low=0, high=env.ac_space.eltype.n, size=(env.num,), dtype=np.int32)
+        env.act(act)
+        for batched_env in batched_envs:
+            batched_env.act(act)
+
+
+
+def test_fork_steps_in_both_processes():
+    import os
+
+    def rollout(env, actions):
+        rews = []
+        for act in actions:
+            env.act(act)
+            rew, obs, _ = env.observe()
+            rews.append(rew)
+        return np.array(rews), obs["rgb"]
+
+    kwargs = dict(num=4, env_name="coinrun", num_levels=0, start_level=0, rand_seed=7)
+    env = ProcgenGym3Env(**kwargs)
+    rng = np.random.RandomState(0)
+    warmup = rng.randint(low=0, high=env.ac_space.eltype.n, size=(20, env.num), dtype=np.int32)
+    actions = rng.randint(low=0, high=env.ac_space.eltype.n, size=(50, env.num), dtype=np.int32)
+    rollout(env, warmup)
+
+    read_fd, write_fd = os.pipe()
+    pid = env.fork()
+    if pid == 0:
+        exit_code = 1
+        try:
+            os.close(read_fd)
+            rews, obs = rollout(env, actions)
+            with os.fdopen(write_fd, "wb") as f:
+                f.write(rews.tobytes() + obs.tobytes())
+            exit_code = 0
+        finally:
+            os._exit(exit_code)
+
+    os.close(write_fd)
+    rews, obs = rollout(env, actions)
+    with os.fdopen(read_fd, "rb") as f:
+        data = f.read()
+    _, status = os.waitpid(pid, 0)
+    assert os.WIFEXITED(status) and os.WEXITSTATUS(status) == 0
+    child_rews = np.frombuffer(data[: rews.nbytes], dtype=rews.dtype).reshape(rews.shape)
+    child_obs = np.frombuffer(data[rews.nbytes :], dtype=obs.dtype).reshape(obs.shape)
+
+    expected_env = ProcgenGym3Env(**kwargs)
+    rollout(expected_env, warmup)
+    expected_rews, expected_obs = rollout(expected_env, actions)
+    for r, o in [(rews, obs), (child_rews, child_obs)]:
+        assert np.array_equal(r, expected_rews)
+        assert np.array_equal(o, expected_obs)
+
+
+def test_failed_fork_restarts_threads(monkeypatch):
+    import os
+
+    def failing_fork():
+        raise OSError("fork failed")
+
+    env = ProcgenGym3Env(num=4, env_name="coinrun", num_threads=2)
+    monkeypatch.setattr(os, "fork", failing_fork)
+    with pytest.raises(OSError):
+        env.fork()
+    # the environment still steps, which would hang if its threads were left stopped
+    for _ in range(10):
+        env.act(np.zeros(env.num, dtype=np.int32))
+        env.observe()
+
+
+# games whose steps don't allocate outside of resets and rendering
+ZERO_ALLOC_STEP_ENV_NAMES = ["climber", "coinrun", "heist", "maze", "miner"]
+
+
+@pytest.mark.parametrize("env_name", ZERO_ALLOC_STEP_ENV_NAMES)
+@pytest.mark.parametrize("oracle_info", [False, True])
+def test_steps_do_not_allocate(env_name, oracle_info):
+    env = ProcgenGym3Env(num=2, env_name=env_name, num_levels=0, start_level=0, num_threads=0, oracle_info=oracle_info)
+    if env.get_alloc_stats() is None:
+        pytest.skip("library was built without PROCGEN_ALLOC_TRACKING")
+
+    rng = np.random.RandomState(0)
+
+    def step(n):
+        for _ in range(n):
+            env.act(rng.randint(low=0, high=env.ac_space.eltype.n, size=(env.num,), dtype=np.int32))
+            env.observe()
+
+    step(100)
+    before = env.get_alloc_stats()
+    step(500)
+    after = env.get_alloc_stats()
+    step_phase = ALLOC_PHASES.index("step")
+    assert np.all(after["calls"][:, step_phase] > before["calls"][:, step_phase])
+    assert np.all(after["allocs"][:, step_phase] == before["allocs"][:, step_phase])
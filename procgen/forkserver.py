@@ -0,0 +1,51 @@
+import os
+import traceback
+
+from cffi import FFI
+
+from .env import SCRIPT_DIR, ProcgenGym3Env, create_random_seed, get_lib_path
+
+
+class ForkServer:
+    """
+    Loads the environment assets once in this process and forks worker processes that inherit
+    them copy-on-write, so that creating an environment in a worker does not have to load them again
+
+    `env_kwargs` are the template arguments for `ProcgenGym3Env` in every worker, they can be
+    overridden per worker in `spawn()`
+    """
+
+    def __init__(self, resource_root=None, debug=False, **env_kwargs):
+        if resource_root is None:
+            resource_root = os.path.join(SCRIPT_DIR, "data", "assets") + os.sep
+            assert os.path.exists(resource_root)
+
+        self._ffi = FFI()
+        self._ffi.cdef(
+            """
+            void procgen_prewarm(int rand_seed, const char *resource_root);
+            """
+        )
+        self._lib = self._ffi.dlopen(get_lib_path(debug=debug))
+        self._lib.procgen_prewarm(create_random_seed(), resource_root.encode("utf8"))
+        self.env_kwargs = dict(env_kwargs, resource_root=resource_root, debug=debug)
+
+    def spawn(self, target, **env_kwargs):
+        """
+        Fork a worker process that calls `target(env)` with a new environment and exits when it returns
+
+        Returns the pid of the worker
+        """
+        pid = os.fork()
+        if pid != 0:
+            return pid
+
+        exit_code = 0
+        try:
+            env = ProcgenGym3Env(**dict(self.env_kwargs, **env_kwargs))
+            target(env)
+        except BaseException:
+            traceback.print_exc()
+            exit_code = 1
+        finally:
+            os._exit(exit_code)
@@ -0,0 +1,69 @@
+import importlib.util
+import os
+
+import numpy as np
+
+from .env import get_lib_dir, make_options
+
+MODULE_NAMES = ["_procgen.so", "_procgen.pyd"]
+
+
+def load_native_module(debug=False):
+    lib_dir = get_lib_dir(debug=debug)
+    for name in MODULE_NAMES:
+        module_path = os.path.join(lib_dir, name)
+        if os.path.exists(module_path):
+            spec = importlib.util.spec_from_file_location("_procgen", module_path)
+            module = importlib.util.module_from_spec(spec)
+            spec.loader.exec_module(module)
+            return module
+    raise Exception(
+        f"native module not found in {lib_dir}, it is only built when python development files are available"
+    )
+
+
+class ProcgenNativeEnv:
+    """
+    Procgen environment driven through a CPython extension module instead of gym3's cffi `CEnv`
+
+    `ob`, `info`, `rew`, `first` and `ac` are numpy arrays that share memory with the environment library, so they
+    are updated in place by every `observe()` and no arrays are created per step.  The GIL is released while
+    the games are stepping.  The keyword arguments are those of `make_options()`, the same as for `ProcgenGym3Env`.
+    """
+
+    def __init__(self, num, env_name, debug=False, **kwargs):
+        options = make_options(env_name, **kwargs)
+        self._module = load_native_module(debug=debug)
+        self._env = self._module.VecEnv(num, options)
+        self.num = num
+        self.ob = {k: np.asarray(v) for k, v in self._env.ob.items()}
+        self.info = {k: np.asarray(v) for k, v in self._env.info.items()}
+        self.rew = np.asarray(self._env.rew)
+        self.first = np.asarray(self._env.first)
+        self.ac = np.asarray(self._env.ac)
+
+    def act(self, ac=None):
+        """
+        Start stepping every environment, if `ac` is None the actions are taken from `self.ac`
+        """
+        if ac is not None:
+            ac = np.ascontiguousarray(ac, dtype=np.int32)
+        self._env.act(ac)
+
+    def observe(self):
+        """
+        Wait for the current step and return `(rew, ob, first)`, these are the same arrays on every call
+        """
+        self._env.observe()
+        return self.rew, self.ob, self.first
+
+    def get_state(self):
+        return [self._env.get_state(env_idx) for env_idx in range(self.num)]
+
+    def set_state(self, states):
+        assert len(states) == self.num
+        for env_idx, state in enumerate(states):
+            self._env.set_state(env_idx, state)
+
+    def close(self):
+        self._env.close()
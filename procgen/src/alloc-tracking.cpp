@@ -0,0 +1,79 @@
+#include "alloc-tracking.h"
+
+#ifdef PROCGEN_ALLOC_TRACKING
+
+#include <cstdlib>
+#include <new>
+
+// plain pointers so that reading them from operator new never allocates
+static thread_local AllocStats *current_stats = nullptr;
+static thread_local AllocPhase current_phase = ALLOC_PHASE_STEP;
+
+AllocPhaseScope::AllocPhaseScope(AllocStats *stats, AllocPhase phase) {
+    prev_stats = current_stats;
+    prev_phase = current_phase;
+    current_stats = stats;
+    current_phase = phase;
+    stats->calls[phase]++;
+}
+
+AllocPhaseScope::~AllocPhaseScope() {
+    current_stats = prev_stats;
+    current_phase = prev_phase;
+}
+
+static void *tracked_malloc(size_t size) {
+    if (current_stats != nullptr) {
+        current_stats->allocs[current_phase]++;
+        current_stats->bytes[current_phase] += size;
+    }
+    return malloc(size == 0 ? 1 : size);
+}
+
+// everything is allocated with malloc() so that memory can be freed by code that uses the default operator delete
+
+void *operator new(size_t size) {
+    void *p = tracked_malloc(size);
+    if (p == nullptr) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void *operator new[](size_t size) {
+    return operator new(size);
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept {
+    return tracked_malloc(size);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept {
+    return tracked_malloc(size);
+}
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
+void operator delete[](void *p) noexcept {
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+    free(p);
+}
+
+void operator delete[](void *p, size_t) noexcept {
+    free(p);
+}
+
+void operator delete(void *p, const std::nothrow_t &) noexcept {
+    free(p);
+}
+
+void operator delete[](void *p, const std::nothrow_t &) noexcept {
+    free(p);
+}
+
+#endif
@@ -0,0 +1,53 @@
+#pragma once
+
+/*
+
+Allocation tracking for finding allocations in the step loop
+
+When the library is built with PROCGEN_ALLOC_TRACKING, operator new is replaced with a version that
+counts allocations made on a thread while an AllocPhaseScope is active, and attributes them to the
+innermost scope's game and phase.  Only allocations made through operator new by this library are
+counted, the ones made inside Qt or with malloc() are not.
+
+In normal builds AllocPhaseScope does nothing.
+
+*/
+
+#include <cstdint>
+
+enum AllocPhase {
+    ALLOC_PHASE_STEP = 0,
+    ALLOC_PHASE_RESET = 1,
+    ALLOC_PHASE_RENDER = 2,
+    ALLOC_PHASE_SERIALIZE = 3,
+    ALLOC_NUM_PHASES = 4,
+};
+
+struct AllocStats {
+    // how many times each phase was entered, and the allocations made in it outside of nested phases
+    int64_t calls[ALLOC_NUM_PHASES] = {};
+    int64_t allocs[ALLOC_NUM_PHASES] = {};
+    int64_t bytes[ALLOC_NUM_PHASES] = {};
+};
+
+#ifdef PROCGEN_ALLOC_TRACKING
+
+class AllocPhaseScope {
+  public:
+    AllocPhaseScope(AllocStats *stats, AllocPhase phase);
+    ~AllocPhaseScope();
+
+  private:
+    AllocStats *prev_stats;
+    AllocPhase prev_phase;
+};
+
+#else
+
+class AllocPhaseScope {
+  public:
+    AllocPhaseScope(AllocStats *stats, AllocPhase phase) {
+    }
+};
+
+#endif
@@ -0,0 +1,97 @@
+#include "arena.h"
+#include "cpp-utils.h"
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+static int size_class(size_t size) {
+    int c = 0;
+    size_t class_size = ARENA_MIN_ALLOC_SIZE;
+    while (class_size < size) {
+        class_size <<= 1;
+        c++;
+    }
+    return c;
+}
+
+Arena::Arena(bool use_hugepages, size_t block_size) : use_hugepages(use_hugepages), block_size(block_size) {
+    fassert((ARENA_MIN_ALLOC_SIZE << (ARENA_NUM_SIZE_CLASSES - 1)) == ARENA_MAX_ALLOC_SIZE);
+    fassert(block_size >= ARENA_MAX_ALLOC_SIZE);
+}
+
+Arena::~Arena() {
+    for (const auto &block : blocks) {
+#ifdef __linux__
+        if (block.mapped) {
+            munmap(block.data, block_size);
+            continue;
+        }
+#endif
+        ::operator delete(block.data);
+    }
+}
+
+void Arena::add_block() {
+    Block block;
+    block.data = nullptr;
+    block.mapped = false;
+
+#ifdef __linux__
+    if (use_hugepages) {
+        void *p = MAP_FAILED;
+        if (block_size % ARENA_HUGEPAGE_SIZE == 0) {
+            p = mmap(nullptr, block_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        }
+        if (p == MAP_FAILED) {
+            // no hugepages are reserved, fall back to normal pages and ask for transparent hugepages
+            p = mmap(nullptr, block_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            fassert(p != MAP_FAILED);
+            madvise(p, block_size, MADV_HUGEPAGE);
+        }
+        block.data = (char *)(p);
+        block.mapped = true;
+    }
+#endif
+
+    if (block.data == nullptr) {
+        block.data = (char *)(::operator new(block_size));
+    }
+
+    blocks.push_back(block);
+    block_pos = block.data;
+    block_remaining = block_size;
+}
+
+void *Arena::allocate(size_t size) {
+    if (size > ARENA_MAX_ALLOC_SIZE) {
+        return ::operator new(size);
+    }
+
+    int c = size_class(size);
+    void *p = free_lists[c];
+    if (p != nullptr) {
+        free_lists[c] = *(void **)(p);
+        return p;
+    }
+
+    // whatever is left of the current block is too small for this allocation and is abandoned
+    size_t class_size = ARENA_MIN_ALLOC_SIZE << c;
+    if (block_remaining < class_size) {
+        add_block();
+    }
+    p = block_pos;
+    block_pos += class_size;
+    block_remaining -= class_size;
+    return p;
+}
+
+void Arena::deallocate(void *p, size_t size) {
+    if (size > ARENA_MAX_ALLOC_SIZE) {
+        ::operator delete(p);
+        return;
+    }
+
+    int c = size_class(size);
+    *(void **)(p) = free_lists[c];
+    free_lists[c] = p;
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+/*
+
+Per-environment memory arena
+
+A game and the entities it creates can be allocated from an arena of their own instead of the shared
+heap, which keeps each environment's objects together in memory and away from the allocations of
+environments stepped on other threads.  Memory comes from large blocks that can be backed by hugepages
+to reduce TLB misses.  Entities are created and destroyed throughout an episode, so freed allocations
+go on per-size free lists and are reused rather than the arena being reset.
+
+An arena is only used by the thread that currently owns its game, so it does no locking.
+
+*/
+
+#include <cstddef>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// allocations are rounded up to a power of two between these sizes, larger ones use the heap
+const size_t ARENA_MIN_ALLOC_SIZE = 16;
+const size_t ARENA_MAX_ALLOC_SIZE = 64 * 1024;
+const int ARENA_NUM_SIZE_CLASSES = 13;
+// the size of a hugepage on x86-64, blocks that are a multiple of it can be backed by reserved hugepages
+const size_t ARENA_HUGEPAGE_SIZE = 2 * 1024 * 1024;
+const size_t ARENA_DEFAULT_BLOCK_SIZE = ARENA_HUGEPAGE_SIZE;
+
+class Arena {
+  public:
+    // with use_hugepages, blocks use MAP_HUGETLB if hugepages are reserved on the system and the block size is a
+    // multiple of ARENA_HUGEPAGE_SIZE, and are otherwise marked for transparent hugepages, this has no effect outside
+    // of linux
+    // every arena holds at least one block, so block_size is the smallest amount of memory an environment commits
+    Arena(bool use_hugepages, size_t block_size = ARENA_DEFAULT_BLOCK_SIZE);
+    ~Arena();
+    Arena(const Arena &) = delete;
+    Arena &operator=(const Arena &) = delete;
+
+    void *allocate(size_t size);
+    void deallocate(void *p, size_t size);
+
+  private:
+    struct Block {
+        char *data;
+        bool mapped;
+    };
+
+    bool use_hugepages;
+    size_t block_size;
+    std::vector<Block> blocks;
+    char *block_pos = nullptr;
+    size_t block_remaining = 0;
+    void *free_lists[ARENA_NUM_SIZE_CLASSES] = {};
+
+    void add_block();
+};
+
+// allocator for std::allocate_shared and containers, each copy keeps the arena alive so that a game can live in its own arena
+// without an arena it allocates from the heap
+template <typename T>
+struct ArenaAllocator {
+    typedef T value_type;
+    // containers keep allocating from the arena of the container they are assigned from
+    typedef std::true_type propagate_on_container_copy_assignment;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+
+    std::shared_ptr<Arena> arena;
+
+    ArenaAllocator() {
+    }
+
+    ArenaAllocator(std::shared_ptr<Arena> arena) : arena(std::move(arena)) {
+    }
+
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U> &other) : arena(other.arena) {
+    }
+
+    T *allocate(size_t n) {
+        if (arena == nullptr) {
+            return std::allocator<T>().allocate(n);
+        }
+        return (T *)(arena->allocate(n * sizeof(T)));
+    }
+
+    void deallocate(T *p, size_t n) {
+        if (arena == nullptr) {
+            std::allocator<T>().deallocate(p, n);
+            return;
+        }
+        arena->deallocate(p, n * sizeof(T));
+    }
+};
+
+template <typename T, typename U>
+bool operator==(const ArenaAllocator<T> &a, const ArenaAllocator<U> &b) {
+    return a.arena == b.arena;
+}
+
+template <typename T, typename U>
+bool operator!=(const ArenaAllocator<T> &a, const ArenaAllocator<U> &b) {
+    return a.arena != b.arena;
+}
+
+// same as std::make_shared when arena is null
+template <typename T, typename... Args>
+std::shared_ptr<T> arena_make_shared(const std::shared_ptr<Arena> &arena, Args &&... args) {
+    if (arena == nullptr) {
+        return std::make_shared<T>(std::forward<Args>(args)...);
+    }
+    return std::allocate_shared<T>(ArenaAllocator<T>(arena), std::forward<Args>(args)...);
+}
@@ -0,0 +1,153 @@
+#include "augment.h"
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+bool AugmentOptions::enabled() const {
+    return translate > 0 || brightness > 0 || contrast > 0 || saturation > 0 || grayscale_prob > 0 || cutout > 0;
+}
+
+void AugmentOptions::serialize(WriteBuffer *b) const {
+    b->write_int(translate);
+    b->write_float(brightness);
+    b->write_float(contrast);
+    b->write_float(saturation);
+    b->write_float(grayscale_prob);
+    b->write_int(cutout);
+    b->write_bool(every_step);
+}
+
+void AugmentOptions::deserialize(ReadBuffer *b) {
+    translate = b->read_int();
+    brightness = b->read_float();
+    contrast = b->read_float();
+    saturation = b->read_float();
+    grayscale_prob = b->read_float();
+    cutout = b->read_int();
+    every_step = b->read_bool();
+}
+
+void AugmentParams::sample(RandGen &rand_gen, const AugmentOptions &opts, int w, int h) {
+    // every parameter is drawn even when its option is off, so that turning one option on
+    // doesn't change the values drawn for the others
+    dx = rand_gen.randint(-opts.translate, opts.translate + 1);
+    dy = rand_gen.randint(-opts.translate, opts.translate + 1);
+    brightness = 1 + opts.brightness * (2 * rand_gen.rand01() - 1);
+    contrast = 1 + opts.contrast * (2 * rand_gen.rand01() - 1);
+    saturation = std::max(0.0f, 1 + opts.saturation * (2 * rand_gen.rand01() - 1));
+    if (rand_gen.rand01() < opts.grayscale_prob) {
+        saturation = 0;
+    }
+
+    int cutout_size = std::min(opts.cutout, std::min(w, h));
+    cutout_x = rand_gen.randn(w - cutout_size + 1);
+    cutout_y = rand_gen.randn(h - cutout_size + 1);
+    if (cutout_size == 0) {
+        cutout_x = -1;
+        cutout_y = -1;
+    }
+}
+
+void AugmentParams::write_floats(float *dst) const {
+    dst[0] = (float)dx;
+    dst[1] = (float)dy;
+    dst[2] = brightness;
+    dst[3] = contrast;
+    dst[4] = saturation;
+    dst[5] = (float)cutout_x;
+    dst[6] = (float)cutout_y;
+}
+
+void AugmentParams::serialize(WriteBuffer *b) const {
+    b->write_int(dx);
+    b->write_int(dy);
+    b->write_float(brightness);
+    b->write_float(contrast);
+    b->write_float(saturation);
+    b->write_int(cutout_x);
+    b->write_int(cutout_y);
+}
+
+void AugmentParams::deserialize(ReadBuffer *b) {
+    dx = b->read_int();
+    dy = b->read_int();
+    brightness = b->read_float();
+    contrast = b->read_float();
+    saturation = b->read_float();
+    cutout_x = b->read_int();
+    cutout_y = b->read_int();
+}
+
+static uint8_t clamp_channel(int v) {
+    return (uint8_t)(v < 0 ? 0 : (v > 255 ? 255 : v));
+}
+
+void bgr32_to_rgb888_augmented(void *dst_rgb888, const void *src_bgr32, int w, int h, const AugmentParams &params, int cutout) {
+    const uint8_t *src = (const uint8_t *)src_bgr32;
+    uint8_t *dst = (uint8_t *)dst_rgb888;
+
+    // brightness and contrast only depend on the channel value, contrast pivots around mid gray
+    uint8_t tone[256];
+    for (int v = 0; v < 256; v++) {
+        tone[v] = clamp_channel((int)(128 + params.contrast * (params.brightness * v - 128) + .5f));
+    }
+
+    bool adjust_saturation = params.saturation != 1.0f;
+    int saturation_fixed = (int)(params.saturation * 256);
+
+    for (int y = 0; y < h; y++) {
+        int sy = std::min(std::max(y - params.dy, 0), h - 1);
+        const uint8_t *row = src + sy * w * 4;
+        uint8_t *d = dst + y * w * 3;
+
+        for (int x = 0; x < w; x++) {
+            int sx = std::min(std::max(x - params.dx, 0), w - 1);
+            const uint8_t *s = row + sx * 4;
+            int r = s[2];
+            int g = s[1];
+            int b = s[0];
+
+            if (adjust_saturation) {
+                int gray = (77 * r + 150 * g + 29 * b) >> 8;
+                r = clamp_channel(gray + ((saturation_fixed * (r - gray)) >> 8));
+                g = clamp_channel(gray + ((saturation_fixed * (g - gray)) >> 8));
+                b = clamp_channel(gray + ((saturation_fixed * (b - gray)) >> 8));
+            }
+
+            d[0] = tone[r];
+            d[1] = tone[g];
+            d[2] = tone[b];
+            d += 3;
+        }
+    }
+
+    if (params.cutout_x >= 0) {
+        int x1 = std::min(params.cutout_x + cutout, w);
+        int y1 = std::min(params.cutout_y + cutout, h);
+        for (int y = params.cutout_y; y < y1; y++) {
+            std::fill(dst + (y * w + params.cutout_x) * 3, dst + (y * w + x1) * 3, 0);
+        }
+    }
+}
+
+void augment_labels(uint8_t *labels, int w, int h, const AugmentParams &params, int cutout) {
+    if (params.dx != 0 || params.dy != 0) {
+        static thread_local std::vector<uint8_t> src;
+        src.assign(labels, labels + w * h);
+        for (int y = 0; y < h; y++) {
+            int sy = std::min(std::max(y - params.dy, 0), h - 1);
+            for (int x = 0; x < w; x++) {
+                int sx = std::min(std::max(x - params.dx, 0), w - 1);
+                labels[y * w + x] = src[sy * w + sx];
+            }
+        }
+    }
+
+    if (params.cutout_x >= 0) {
+        int x1 = std::min(params.cutout_x + cutout, w);
+        int y1 = std::min(params.cutout_y + cutout, h);
+        for (int y = params.cutout_y; y < y1; y++) {
+            memset(labels + y * w + params.cutout_x, 0, x1 - params.cutout_x);
+        }
+    }
+}
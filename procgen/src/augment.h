@@ -0,0 +1,57 @@
+#pragma once
+
+/*
+
+Observation augmentation that is applied while a rendered frame is converted into the
+observation buffer, so that it costs no extra pass over the frame
+
+Parameters are drawn from a random generator owned by each game, either once per episode
+or on every step, and reported through the "augment" info key
+
+*/
+
+#include "randgen.h"
+#include "buffer.h"
+
+// dx, dy, brightness, contrast, saturation, cutout_x, cutout_y
+const int AUGMENT_NUM_PARAMS = 7;
+
+struct AugmentOptions {
+    // maximum shift in pixels, the exposed border repeats the edge pixels
+    int translate = 0;
+    // maximum relative change of each color adjustment
+    float brightness = 0.0f;
+    float contrast = 0.0f;
+    float saturation = 0.0f;
+    // probability of removing all color, on top of the saturation change
+    float grayscale_prob = 0.0f;
+    // side of a black square placed at a random position
+    int cutout = 0;
+    // sample new parameters on every step instead of once per episode
+    bool every_step = false;
+
+    bool enabled() const;
+    void serialize(WriteBuffer *b) const;
+    void deserialize(ReadBuffer *b);
+};
+
+struct AugmentParams {
+    int dx = 0;
+    int dy = 0;
+    float brightness = 1.0f;
+    float contrast = 1.0f;
+    float saturation = 1.0f;
+    // top left corner of the cutout, -1 if there is none
+    int cutout_x = -1;
+    int cutout_y = -1;
+
+    void sample(RandGen &rand_gen, const AugmentOptions &opts, int w, int h);
+    void write_floats(float *dst) const;
+    void serialize(WriteBuffer *b) const;
+    void deserialize(ReadBuffer *b);
+};
+
+// same as bgr32_to_rgb888 with the augmentation applied, cutout is the side of the cutout square
+void bgr32_to_rgb888_augmented(void *dst_rgb888, const void *src_bgr32, int w, int h, const AugmentParams &params, int cutout);
+// applies the translation and cutout to a per-pixel label image in place, so that it lines up with the augmented frame
+void augment_labels(uint8_t *labels, int w, int h, const AugmentParams &params, int cutout);
@@ -2,6 +2,9 @@
 #include "resources.h"
 #include "assetgen.h"
 #include "qt-utils.h"
+#include "sprite-batch.h"
+#include <algorithm>
+#include <functional>
 
 const float MAXVTHETA = 15 * PI / 180;
 const float MIXRATEROT = 0.5f;
@@ -51,7 +54,18 @@ BasicAbstractGame::~BasicAbstractGame() {
     }
 }
 
+void BasicAbstractGame::observe() {
+    Game::observe();
+    // in grid units with y pointing up
+    if (info_slots.agent_x >= 0) {
+        *(float *)(info_bufs[info_slots.agent_x]) = agent->x;
+        *(float *)(info_bufs[info_slots.agent_y]) = agent->y;
+    }
+}
+
 void BasicAbstractGame::game_init() {
+    grid.set_arena(arena);
+
     if (!options.use_generated_assets) {
         load_background_images();
     }
@@ -77,7 +91,8 @@ void BasicAbstractGame::game_init() {
 }
 
 void BasicAbstractGame::initialize_asset_if_necessary(int img_idx) {
-    if (basic_assets.at(img_idx) != nullptr)
+    fassert_hot(0 <= img_idx && img_idx < (int)(basic_assets.size()));
+    if (basic_assets[img_idx] != nullptr)
         return;
 
     int type = img_idx % MAX_ASSETS;
@@ -214,6 +229,73 @@ std::vector<int> BasicAbstractGame::get_cells_with_type(int type) {
     return cells;
 }
 
+bool BasicAbstractGame::get_goal_cells(std::vector<int> &goal_cells) {
+    return false;
+}
+
+bool BasicAbstractGame::is_goal_path_cell(int idx) {
+    return get_obj(idx) != WALL_OBJ;
+}
+
+int BasicAbstractGame::goal_distance() {
+    // the grids of games with goals don't change during a level, so the distances are only computed once
+    if (!goal_dists_valid) {
+        std::vector<int> goal_cells;
+        goal_dists.clear();
+        if (get_goal_cells(goal_cells)) {
+            compute_grid_distances(
+                goal_cells, [&](int idx) { return is_goal_path_cell(idx); }, goal_dists);
+        }
+        goal_dists_valid = true;
+    }
+
+    int agent_idx = to_grid_idx(int(agent->x), int(agent->y));
+    if (goal_dists.empty() || agent_idx == INVALID_IDX) {
+        return -1;
+    }
+
+    return goal_dists[agent_idx];
+}
+
+int BasicAbstractGame::move_action_toward(float x, float y, float eps) {
+    int dx = 0;
+    int dy = 0;
+
+    if (x - agent->x > eps) {
+        dx = 1;
+    } else if (agent->x - x > eps) {
+        dx = -1;
+    }
+
+    if (y - agent->y > eps) {
+        dy = 1;
+    } else if (agent->y - y > eps) {
+        dy = -1;
+    }
+
+    return (dx + 1) * 3 + (dy + 1);
+}
+
+void BasicAbstractGame::mark_entity_cells(int type, float margin, std::vector<bool> &marked) {
+    marked.resize(grid_size, false);
+
+    for (const auto &ent : entities) {
+        if (ent->type != type) {
+            continue;
+        }
+
+        for (int x = int(ent->x - ent->rx - margin); x <= int(ent->x + ent->rx + margin); x++) {
+            for (int y = int(ent->y - ent->ry - margin); y <= int(ent->y + ent->ry + margin); y++) {
+                int idx = to_grid_idx(x, y);
+
+                if (idx != INVALID_IDX) {
+                    marked[idx] = true;
+                }
+            }
+        }
+    }
+}
+
 void BasicAbstractGame::set_obj(int idx, int elem) {
     grid.set_index(idx, elem);
 }
@@ -225,7 +307,7 @@ void BasicAbstractGame::set_obj(int x, int y, int elem) {
 std::shared_ptr<Entity> BasicAbstractGame::spawn_child(const std::shared_ptr<Entity> &src, int type, float obj_r, bool match_vel) {
     float vx = match_vel ? src->vx : 0;
     float vy = match_vel ? src->vy : 0;
-    auto child = std::make_shared<Entity>(src->x, src->y, vx, vy, obj_r, type);
+    auto child = arena_make_shared<Entity>(arena, src->x, src->y, vx, vy, obj_r, type);
     entities.push_back(child);
     return child;
 }
@@ -398,6 +480,50 @@ void BasicAbstractGame::handle_grid_collision(const std::shared_ptr<Entity> &obj
 void BasicAbstractGame::handle_collision(const std::shared_ptr<Entity> &src, const std::shared_ptr<Entity> &target) {
 }
 
+bool BasicAbstractGame::get_collision_target_types(int src_type, std::vector<int> &target_types) {
+    return false;
+}
+
+void BasicAbstractGame::clear_entity_index() {
+    for (auto &idxs : entity_idxs_by_type) {
+        idxs.clear();
+    }
+    num_indexed_entities = 0;
+}
+
+/*
+  Finds the indices of entities of the given types, in decreasing order to match the order of a full scan.
+  Entities added since the last call are indexed first. The type of an entity is only read when it is indexed,
+  so handle_collision must not change an entity into one of the target types.
+  Entities are indexed in order, so each per-type list stays sorted and the lists are merged instead of sorted.
+*/
+void BasicAbstractGame::find_collision_candidates(const std::vector<int> &target_types, std::vector<int> &candidates) {
+    for (int i = num_indexed_entities; i < (int)(entities.size()); i++) {
+        int type = entities[i]->type;
+        fassert_hot(type >= 0);
+        if (type >= (int)(entity_idxs_by_type.size())) {
+            entity_idxs_by_type.resize(type + 1);
+        }
+        entity_idxs_by_type[type].push_back(i);
+    }
+    num_indexed_entities = (int)(entities.size());
+
+    candidates.clear();
+    for (int type : target_types) {
+        if (type >= (int)(entity_idxs_by_type.size())) {
+            continue;
+        }
+        const auto &idxs = entity_idxs_by_type[type];
+        if (candidates.empty()) {
+            candidates.assign(idxs.rbegin(), idxs.rend());
+        } else {
+            collision_merge_buf.resize(candidates.size() + idxs.size());
+            std::merge(candidates.begin(), candidates.end(), idxs.rbegin(), idxs.rend(), collision_merge_buf.begin(), std::greater<int>());
+            candidates.swap(collision_merge_buf);
+        }
+    }
+}
+
 /*
   Determines whether assets of this type will be generated as blocks, covering the full canvas.
 */
@@ -461,7 +587,7 @@ QColor BasicAbstractGame::color_for_type(int type, int theme) {
         int k = 4;
         int kcubed = k * k * k;
         int chunk = 256 / k;
-        fassert(type < kcubed);
+        fassert_hot(type < kcubed);
 
         int p1 = 29;
         int p2 = 19;
@@ -509,7 +635,7 @@ float BasicAbstractGame::get_agent_acceleration_scale() {
 */
 
 std::shared_ptr<Entity> BasicAbstractGame::spawn_entity_rxy(float rx, float ry, int type, float x, float y, float w, float h, bool check_collisions) {
-    std::shared_ptr<Entity> ent(new Entity(0, 0, 0, 0, rx, ry, type));
+    auto ent = arena_make_shared<Entity>(arena, 0, 0, 0, 0, rx, ry, type);
 
     reposition(ent, x, y, w, h, check_collisions);
 
@@ -564,13 +690,13 @@ std::shared_ptr<Entity> BasicAbstractGame::spawn_entity(float r, int type, float
 }
 
 std::shared_ptr<Entity> BasicAbstractGame::add_entity(float x, float y, float vx, float vy, float r, int type) {
-    std::shared_ptr<Entity> ent(new Entity(x, y, vx, vy, r, r, type));
+    auto ent = arena_make_shared<Entity>(arena, x, y, vx, vy, r, r, type);
     entities.push_back(ent);
     return ent;
 }
 
 std::shared_ptr<Entity> BasicAbstractGame::add_entity_rxy(float x, float y, float vx, float vy, float rx, float ry, int type) {
-    std::shared_ptr<Entity> ent(new Entity(x, y, vx, vy, rx, ry, type));
+    auto ent = arena_make_shared<Entity>(arena, x, y, vx, vy, rx, ry, type);
     entities.push_back(ent);
     return ent;
 }
@@ -716,6 +842,8 @@ void BasicAbstractGame::game_step() {
 
     step_entities(entities);
 
+    clear_entity_index();
+
     for (int i = (int)(entities.size()) - 1; i >= 0; i--) {
         auto ent = entities[i];
 
@@ -724,13 +852,29 @@ void BasicAbstractGame::game_step() {
         }
 
         if (ent->collides_with_entities) {
-            for (int j = (int)(entities.size()) - 1; j >= 0; j--) {
-                if (i == j)
-                    continue;
-                auto ent2 = entities[j];
+            collision_target_types.clear();
+
+            if (get_collision_target_types(ent->type, collision_target_types)) {
+                find_collision_candidates(collision_target_types, collision_candidates);
 
-                if (has_collision(ent, ent2, ent->collision_margin) && !ent->will_erase && !ent2->will_erase) {
-                    handle_collision(ent, ent2);
+                for (int j : collision_candidates) {
+                    if (i == j)
+                        continue;
+                    auto ent2 = entities[j];
+
+                    if (has_collision(ent, ent2, ent->collision_margin) && !ent->will_erase && !ent2->will_erase) {
+                        handle_collision(ent, ent2);
+                    }
+                }
+            } else {
+                for (int j = (int)(entities.size()) - 1; j >= 0; j--) {
+                    if (i == j)
+                        continue;
+                    auto ent2 = entities[j];
+
+                    if (has_collision(ent, ent2, ent->collision_margin) && !ent->will_erase && !ent2->will_erase) {
+                        handle_collision(ent, ent2);
+                    }
                 }
             }
         }
@@ -756,6 +900,7 @@ void BasicAbstractGame::erase_if_needed() {
 }
 
 void BasicAbstractGame::game_reset() {
+    goal_dists_valid = false;
     choose_world_dim();
     fassert(main_width > 0 && main_height > 0);
 
@@ -785,7 +930,7 @@ void BasicAbstractGame::game_reset() {
         ay = a_r;
     }
 
-    auto _agent = std::make_shared<Entity>(ax, ay, 0, 0, a_r, PLAYER);
+    auto _agent = arena_make_shared<Entity>(arena, ax, ay, 0, 0, a_r, PLAYER);
     agent = _agent;
     agent->smart_step = true;
     agent->render_z = 1;
@@ -849,7 +994,7 @@ void BasicAbstractGame::tile_image(QPainter &p, QImage *image, const QRectF &rec
 
             for (int i = 0; i < num_tiles; i++) {
                 QRectF tile_rect = QRectF(rect.x(), rect.y() + tile_height * i, tile_width, tile_height);
-                p.drawImage(tile_rect, *image);
+                blit_image(p, tile_rect, image);
             }
         } else {
             int num_tiles = int(rect.width() / (rect.height() * tile_ratio));
@@ -860,18 +1005,34 @@ void BasicAbstractGame::tile_image(QPainter &p, QImage *image, const QRectF &rec
 
             for (int i = 0; i < num_tiles; i++) {
                 QRectF tile_rect = QRectF(rect.x() + tile_width * i, rect.y(), tile_width, tile_height);
-                p.drawImage(tile_rect, *image);
+                blit_image(p, tile_rect, image);
             }
         }
+    } else {
+        blit_image(p, rect, image);
+    }
+}
+
+void BasicAbstractGame::blit_image(QPainter &p, const QRectF &rect, const QImage *image) {
+    if (draw_batch != nullptr) {
+        draw_batch->add_image(image, rect);
     } else {
         p.drawImage(rect, *image);
     }
 }
 
+void BasicAbstractGame::fill_rect(QPainter &p, const QRectF &rect, const QColor &color) {
+    if (draw_batch != nullptr) {
+        draw_batch->add_fill(rect, color);
+    } else {
+        p.fillRect(rect, color);
+    }
+}
+
 QImage *BasicAbstractGame::lookup_asset(int img_idx, bool is_reflected) {
     initialize_asset_if_necessary(img_idx);
     auto assets = is_reflected ? &basic_reflections : &basic_assets;
-    return assets->at(img_idx).get();
+    return (*assets)[img_idx].get();
 }
 
 void BasicAbstractGame::draw_image(QPainter &p, QRectF &base_rect, float rotation, bool is_reflected, int base_type, int theme, float alpha, float tile_ratio) {
@@ -883,31 +1044,115 @@ void BasicAbstractGame::draw_image(QPainter &p, QRectF &base_rect, float rotatio
 
     if (options.use_monochrome_assets || img_type >= USE_ASSET_THRESHOLD) {
         draw_grid_obj(p, base_rect, img_type, theme);
+        if (label_buf != nullptr && img_type != SPACE && alpha >= 0.5f) {
+            label_image(base_rect, 0, img_type, nullptr, 0);
+        }
     } else {
         int img_idx = img_type + theme * MAX_ASSETS;
-        fassert(theme < MAX_IMAGE_THEMES);
+        fassert_hot(theme < MAX_IMAGE_THEMES);
 
         QRectF adjusted_rect = get_adjusted_image_rect(img_type, base_rect);
 
         auto asset_ptr = lookup_asset(img_idx, is_reflected);
 
-        if (alpha != 1) {
-            p.save();
-            p.setOpacity(alpha);
+        if (draw_batch != nullptr) {
+            draw_batch->set_opacity(alpha);
+            if (rotation == 0) {
+                tile_image(p, asset_ptr, adjusted_rect, tile_ratio);
+            } else {
+                draw_batch->add_image(asset_ptr, adjusted_rect, rotation);
+            }
+            draw_batch->set_opacity(1);
+        } else {
+            if (alpha != 1) {
+                p.save();
+                p.setOpacity(alpha);
+            }
+
+            if (rotation == 0) {
+                tile_image(p, asset_ptr, adjusted_rect, tile_ratio);
+            } else {
+                p.save();
+                p.translate(adjusted_rect.x() + adjusted_rect.width() / 2, adjusted_rect.y() + adjusted_rect.height() / 2);
+                p.rotate(rotation * 180 / PI);
+                p.drawImage(QRectF(-adjusted_rect.width() / 2, -adjusted_rect.height() / 2, adjusted_rect.width(), adjusted_rect.height()), *asset_ptr);
+                p.restore();
+            }
+
+            if (alpha != 1) {
+                p.restore();
+            }
         }
 
-        if (rotation == 0) {
-            tile_image(p, asset_ptr, adjusted_rect, tile_ratio);
-        } else {
-            p.save();
-            p.translate(adjusted_rect.x() + adjusted_rect.width() / 2, adjusted_rect.y() + adjusted_rect.height() / 2);
-            p.rotate(rotation * 180 / PI);
-            p.drawImage(QRectF(-adjusted_rect.width() / 2, -adjusted_rect.height() / 2, adjusted_rect.width(), adjusted_rect.height()), *asset_ptr);
-            p.restore();
+        if (label_buf != nullptr && alpha >= 0.5f) {
+            label_image(adjusted_rect, rotation, img_type, asset_ptr, tile_ratio);
         }
+    }
+}
 
-        if (alpha != 1) {
-            p.restore();
+void BasicAbstractGame::label_image(const QRectF &rect, float rotation, int img_type, const QImage *mask, float tile_ratio) {
+    if (rect.width() <= 0 || rect.height() <= 0) {
+        return;
+    }
+
+    // 0 is left for the background
+    uint8_t label = (uint8_t)(std::min(img_type, 254) + 1);
+
+    float hw = rect.width() / 2;
+    float hh = rect.height() / 2;
+    float cx = rect.x() + hw;
+    float cy = rect.y() + hh;
+    float extent_x = hw;
+    float extent_y = hh;
+    float rot_cos = 1;
+    float rot_sin = 0;
+    if (rotation != 0) {
+        rot_cos = cos(rotation);
+        rot_sin = sin(rotation);
+        extent_x = extent_y = sqrt(hw * hw + hh * hh);
+    }
+
+    // same tiling as tile_image
+    int num_tiles = 1;
+    if (tile_ratio > 0) {
+        num_tiles = std::max(1, int(rect.width() / (rect.height() * tile_ratio)));
+    } else if (tile_ratio < 0) {
+        num_tiles = std::max(1, int(rect.height() / (rect.width() * -tile_ratio)));
+    }
+
+    int x0 = std::max(0, (int)floor(cx - extent_x));
+    int x1 = std::min(RES_W, (int)ceil(cx + extent_x));
+    int y0 = std::max(0, (int)floor(cy - extent_y));
+    int y1 = std::min(RES_H, (int)ceil(cy + extent_y));
+
+    for (int y = y0; y < y1; y++) {
+        for (int x = x0; x < x1; x++) {
+            // a pixel is covered if its center falls inside the rect, after undoing the rotation
+            float dx = x + 0.5f - cx;
+            float dy = y + 0.5f - cy;
+            float lx = dx * rot_cos + dy * rot_sin;
+            float ly = dy * rot_cos - dx * rot_sin;
+            if (lx < -hw || lx >= hw || ly < -hh || ly >= hh) {
+                continue;
+            }
+
+            if (mask != nullptr) {
+                float u = (lx + hw) / rect.width();
+                float v = (ly + hh) / rect.height();
+                if (tile_ratio > 0) {
+                    u = u * num_tiles - floor(u * num_tiles);
+                } else if (tile_ratio < 0) {
+                    v = v * num_tiles - floor(v * num_tiles);
+                }
+                int ix = std::min((int)(u * mask->width()), mask->width() - 1);
+                int iy = std::min((int)(v * mask->height()), mask->height() - 1);
+                uint32_t pixel = ((const uint32_t *)mask->constScanLine(iy))[ix];
+                if ((pixel >> 24) < 128) {
+                    continue;
+                }
+            }
+
+            label_buf[y * RES_W + x] = label;
         }
     }
 }
@@ -915,13 +1160,14 @@ void BasicAbstractGame::draw_image(QPainter &p, QRectF &base_rect, float rotatio
 void BasicAbstractGame::draw_grid_obj(QPainter &p, const QRectF &rect, int type, int theme) {
     if (type == SPACE)
         return;
-    p.fillRect(rect, color_for_type(type, theme));
+    fill_rect(p, rect, color_for_type(type, theme));
 }
 
 void BasicAbstractGame::draw_foreground(QPainter &p, const QRect &rect) {
     prepare_for_drawing(rect.height());
 
     draw_entities(p, entities, -1);
+    draw_extra_entities(p, -1);
 
     int low_x, high_x, low_y, high_y;
 
@@ -932,6 +1178,8 @@ void BasicAbstractGame::draw_foreground(QPainter &p, const QRect &rect) {
         low_y = center_y - margin;
         high_y = center_y + margin;
     } else {
+        // the whole world is in view, which at large world_scale values means drawing every cell at a
+        // fraction of a pixel, large worlds are meant to be used with center_agent
         low_x = 0;
         high_x = main_width - 1;
         low_y = 0;
@@ -955,17 +1203,19 @@ void BasicAbstractGame::draw_foreground(QPainter &p, const QRect &rect) {
     }
 
     draw_entities(p, entities, 0);
+    draw_extra_entities(p, 0);
     draw_entities(p, entities, 1);
+    draw_extra_entities(p, 1);
 
     if (has_useful_vel_info && (options.paint_vel_info)) {
         float infodim = rect.height() * .2;
         QRectF dst2 = QRectF(0, 0, infodim, infodim);
         int s1 = to_shade(.5 * agent->vx / maxspeed + .5);
         int s2 = to_shade(.5 * agent->vy / max_jump + .5);
-        p.fillRect(dst2, QColor(s1, s1, s1));
+        fill_rect(p, dst2, QColor(s1, s1, s1));
 
         QRectF dst3 = QRectF(infodim, 0, infodim, infodim);
-        p.fillRect(dst3, QColor(s2, s2, s2));
+        fill_rect(p, dst3, QColor(s2, s2, s2));
     }
 }
 
@@ -977,7 +1227,7 @@ void BasicAbstractGame::set_pen_brush_color(QPainter &p, QColor color, int thick
 }
 
 void BasicAbstractGame::draw_background(QPainter &p, const QRect &rect) {
-    p.fillRect(rect, QColor(0, 0, 0));
+    fill_rect(p, rect, QColor(0, 0, 0));
 
     prepare_for_drawing(rect.height());
 
@@ -1002,7 +1252,7 @@ void BasicAbstractGame::draw_background(QPainter &p, const QRect &rect) {
         float offset_x = bg_pct_x * extra_w;
 
         QRectF bg_rect = adjust_rect(main_rect, QRectF(-offset_x, 0, bg_ar / world_ar, 1));
-        p.drawImage(bg_rect, *background_image);
+        blit_image(p, bg_rect, background_image.get());
     }
 }
 
@@ -1036,8 +1286,18 @@ void BasicAbstractGame::fit_aspect_ratio(const std::shared_ptr<Entity> &ent) {
 }
 
 void BasicAbstractGame::choose_random_theme(const std::shared_ptr<Entity> &ent) {
-    initialize_asset_if_necessary(ent->image_type);
-    ent->image_theme = rand_gen.randn(asset_num_themes[ent->image_type]);
+    ent->image_theme = choose_random_theme_for_type(ent->image_type);
+}
+
+int BasicAbstractGame::choose_random_theme_for_type(int image_type) {
+    initialize_asset_if_necessary(image_type);
+    return rand_gen.randn(asset_num_themes[image_type]);
+}
+
+float BasicAbstractGame::get_asset_aspect_ratio(int image_type, int theme) {
+    int img_idx = image_type + theme * MAX_ASSETS;
+    initialize_asset_if_necessary(img_idx);
+    return asset_aspect_ratios[img_idx];
 }
 
 void BasicAbstractGame::choose_step_random_theme(const std::shared_ptr<Entity> &ent) {
@@ -1049,6 +1309,13 @@ bool BasicAbstractGame::should_draw_entity(const std::shared_ptr<Entity> &entity
     return true;
 }
 
+void BasicAbstractGame::draw_extra_entities(QPainter &p, int render_z) {
+}
+
+bool BasicAbstractGame::supports_batched_render() {
+    return true;
+}
+
 void BasicAbstractGame::draw_entity(QPainter &p, const std::shared_ptr<Entity> &ent) {
     if (should_draw_entity(ent)) {
         QRectF r1 = get_object_rect(ent);
@@ -1160,7 +1427,7 @@ void BasicAbstractGame::write_entities(WriteBuffer *b, std::vector<std::shared_p
 void BasicAbstractGame::read_entities(ReadBuffer *b, std::vector<std::shared_ptr<Entity>> &ents) {
     ents.resize(b->read_int());
     for (size_t i = 0; i < ents.size(); i++) {
-        auto e = std::make_shared<Entity>();
+        auto e = arena_make_shared<Entity>(arena);
         e->deserialize(b);
         ents[i] = e;
     }
@@ -1182,6 +1449,9 @@ void BasicAbstractGame::serialize(WriteBuffer *b) {
     // std::vector<float> asset_aspect_ratios;
     // std::vector<int> asset_num_themes;
 
+    // the entity index used for collisions is rebuilt every step
+    // std::vector<std::vector<int>> entity_idxs_by_type;
+
     b->write_int(use_procgen_background);
     b->write_int(background_index);
     b->write_float(bg_tile_ratio);
@@ -1224,6 +1494,7 @@ void BasicAbstractGame::serialize(WriteBuffer *b) {
 
 void BasicAbstractGame::deserialize(ReadBuffer *b) {
     Game::deserialize(b);
+    goal_dists_valid = false;
 
     grid_size = b->read_int();
 
@@ -1285,4 +1556,33 @@ void BasicAbstractGame::deserialize(ReadBuffer *b) {
     min_visibility = b->read_float();
 
     grid.deserialize(b);
+
+    // grid lookups from entity positions skip their bounds checks in unchecked builds, so reject states that would
+    // send them outside the grid instead of trusting the buffer
+    fassert(grid.w == main_width && grid.h == main_height);
+    fassert(grid.contains(int(agent->x), int(agent->y)));
+    for (const auto &e : entities) {
+        fassert(std::isfinite(e->x) && std::isfinite(e->y));
+    }
+}
+
+void BasicAbstractGame::load_level(ReadBuffer *b) {
+    // game_reset() leaves the actions of the previous episode in place
+    int prev_last_move_action = last_move_action;
+    int prev_move_action = move_action;
+    int prev_special_action = special_action;
+    float prev_action_vx = action_vx;
+    float prev_action_vy = action_vy;
+    float prev_action_vrot = action_vrot;
+    int prev_step_rand_int = step_rand_int;
+
+    Game::load_level(b);
+
+    last_move_action = prev_last_move_action;
+    move_action = prev_move_action;
+    special_action = prev_special_action;
+    action_vx = prev_action_vx;
+    action_vy = prev_action_vy;
+    action_vrot = prev_action_vrot;
+    step_rand_int = prev_step_rand_int;
 }
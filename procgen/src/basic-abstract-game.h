@@ -8,6 +8,7 @@ Base game class used by all currently existing games
 
 #include <string>
 #include <set>
+#include <algorithm>
 #include <queue>
 #include "game.h"
 #include "grid.h"
@@ -25,8 +26,10 @@ class BasicAbstractGame : public Game {
     void game_reset() override;
     void game_draw(QPainter &p, const QRect &rect) override;
     void game_init() override;
+    void observe() override;
     void serialize(WriteBuffer *b) override;
     void deserialize(ReadBuffer *b) override;
+    void load_level(ReadBuffer *b) override;
 
     void write_entities(WriteBuffer *b, std::vector<std::shared_ptr<Entity>> &ents);
     void read_entities(ReadBuffer *b, std::vector<std::shared_ptr<Entity>> &ents);
@@ -37,6 +40,9 @@ class BasicAbstractGame : public Game {
     virtual void handle_agent_collision(const std::shared_ptr<Entity> &obj);
     virtual void handle_grid_collision(const std::shared_ptr<Entity> &obj, int type, int i, int j);
     virtual void handle_collision(const std::shared_ptr<Entity> &src, const std::shared_ptr<Entity> &target);
+    // lists the types that handle_collision can act on for a source of src_type, so that other entities are skipped
+    // return false to check the source against every entity
+    virtual bool get_collision_target_types(int src_type, std::vector<int> &target_types);
     virtual float get_agent_acceleration_scale();
     virtual bool use_block_asset(int type);
     virtual float get_tile_aspect_ratio(const std::shared_ptr<Entity> &type);
@@ -49,10 +55,18 @@ class BasicAbstractGame : public Game {
     virtual void draw_grid_obj(QPainter &p, const QRectF &rect, int type, int theme);
     virtual void choose_world_dim();
     virtual bool should_draw_entity(const std::shared_ptr<Entity> &entity);
+    // draws entities that a game keeps outside of entities, called after the entities at each render_z are drawn
+    virtual void draw_extra_entities(QPainter &p, int render_z);
     virtual void set_action_xy(int move_action);
     virtual void choose_center(float &cx, float &cy);
     virtual void update_agent_velocity();
     virtual QRectF get_adjusted_image_rect(int type, const QRectF &rect);
+    // cells that goal_distance measures to, return false if the game has no goal
+    virtual bool get_goal_cells(std::vector<int> &goal_cells);
+    // cells that paths to the goal may cross
+    virtual bool is_goal_path_cell(int idx);
+    int goal_distance() override;
+    bool supports_batched_render() override;
 
     void reserved_asset_for_type(int type, std::vector<std::string> &names);
     void choose_step_random_theme(const std::shared_ptr<Entity> &ent);
@@ -79,14 +93,32 @@ class BasicAbstractGame : public Game {
     int get_obj_from_floats(float i, float j);
     int get_agent_index();
     std::vector<int> get_cells_with_type(int type);
+    // breadth first search over 4-connected cells from src to the nearest cell accepted by is_goal, used by oracle planners
+    // path holds the cells from src to that cell, and is left empty if none can be reached
+    // the predicates are template parameters so that oracles, which run on every observation, don't allocate
+    template <typename IsGoal, typename IsPassable>
+    void find_grid_path(int src, const IsGoal &is_goal, const IsPassable &is_passable, std::vector<int> &path);
+    // number of 4-connected steps from the nearest source to every cell, -1 for cells that can't be reached
+    template <typename IsPassable>
+    void compute_grid_distances(const std::vector<int> &sources, const IsPassable &is_passable, std::vector<int> &dists);
+    // move action that pushes the agent toward (x, y) along each axis where it is more than eps away
+    int move_action_toward(float x, float y, float eps);
+    // marks every cell within margin of an entity of the given type
+    void mark_entity_cells(int type, float margin, std::vector<bool> &marked);
 
     void check_grid_collisions(const std::shared_ptr<Entity> &src);
     float get_distance(const std::shared_ptr<Entity> &p0, const std::shared_ptr<Entity> &p1);
     void match_aspect_ratio(const std::shared_ptr<Entity> &ent, bool match_width = true);
     void fit_aspect_ratio(const std::shared_ptr<Entity> &ent);
     void choose_random_theme(const std::shared_ptr<Entity> &ent);
+    // same as choose_random_theme and match_aspect_ratio, for games that describe entities before creating them
+    int choose_random_theme_for_type(int image_type);
+    float get_asset_aspect_ratio(int image_type, int theme);
     int mask_theme_if_necessary(int theme, int type);
     void tile_image(QPainter &p, QImage *image, const QRectF &rect, float tile_ratio);
+    // paint with p, or record into draw_batch while an observation is being batched
+    void blit_image(QPainter &p, const QRectF &rect, const QImage *image);
+    void fill_rect(QPainter &p, const QRectF &rect, const QColor &color);
 
     float rand_pos(float r, float max);
     float rand_pos(float r, float min, float max);
@@ -158,17 +190,129 @@ class BasicAbstractGame : public Game {
     float visibility = 0.0f;
     float min_visibility = 0.0f;
 
+    // path planned by the oracle of the game, kept between observations so that its memory is reused
+    std::vector<int> oracle_path;
+
+    void draw_entity(QPainter &p, const std::shared_ptr<Entity> &to_draw);
+    void draw_entities(QPainter &p, const std::vector<std::shared_ptr<Entity>> &to_draw, int render_z = 0);
+
   private:
+    // times some of the private methods directly, see microbench.cpp
+    friend struct MicroBench;
+
     Grid<int> grid;
 
+    // indices of entities by type, only valid during the collision checks in game_step
+    std::vector<std::vector<int>> entity_idxs_by_type;
+    int num_indexed_entities = 0;
+    std::vector<int> collision_target_types;
+    std::vector<int> collision_candidates;
+    std::vector<int> collision_merge_buf;
+
+    // scratch buffers of the grid searches, kept between calls so that their memory is reused
+    std::vector<int> search_parents;
+    // used as a queue whose head is an index, since std::queue frees and allocates blocks as it moves
+    std::vector<int> search_frontier;
+
+    // distance from every cell to the goal, built on the first goal_distance() call after a reset or deserialize
+    std::vector<int> goal_dists;
+    bool goal_dists_valid = false;
+
     QImage *lookup_asset(int img_idx, bool is_reflected = false);
     void initialize_asset_if_necessary(int img_idx);
     void prepare_for_drawing(float rect_height);
     void draw_background(QPainter &p, const QRect &rect);
-    void draw_entity(QPainter &p, const std::shared_ptr<Entity> &to_draw);
-    void draw_entities(QPainter &p, const std::vector<std::shared_ptr<Entity>> &to_draw, int render_z = 0);
     void draw_image(QPainter &p, QRectF &rect, float rotation, bool is_reflected, int img_idx, int theme, float alpha, float tile_ratio);
+    // writes the label for img_type into label_buf where draw_image would cover pixels, using the alpha of mask if it is set
+    void label_image(const QRectF &rect, float rotation, int img_type, const QImage *mask, float tile_ratio);
 
+    void clear_entity_index();
+    void find_collision_candidates(const std::vector<int> &target_types, std::vector<int> &candidates);
     bool sub_step(const std::shared_ptr<Entity> &obj, float _vx, float _vy, int depth);
     bool should_erase(const std::shared_ptr<Entity> &e1);
 };
+
+template <typename IsGoal, typename IsPassable>
+void BasicAbstractGame::find_grid_path(int src, const IsGoal &is_goal, const IsPassable &is_passable, std::vector<int> &path) {
+    path.clear();
+
+    if (!grid.contains_index(src)) {
+        return;
+    }
+
+    search_parents.assign(grid_size, INVALID_IDX);
+    search_frontier.clear();
+    search_frontier.reserve(grid_size);
+    search_parents[src] = src;
+    search_frontier.push_back(src);
+
+    int found = INVALID_IDX;
+
+    for (size_t head = 0; head < search_frontier.size(); head++) {
+        int curr_idx = search_frontier[head];
+
+        if (is_goal(curr_idx)) {
+            found = curr_idx;
+            break;
+        }
+
+        int x, y;
+        to_grid_xy(curr_idx, &x, &y);
+
+        const int dxs[4] = {-1, 1, 0, 0};
+        const int dys[4] = {0, 0, -1, 1};
+
+        for (int i = 0; i < 4; i++) {
+            int next_idx = to_grid_idx(x + dxs[i], y + dys[i]);
+
+            if (next_idx != INVALID_IDX && search_parents[next_idx] == INVALID_IDX && is_passable(next_idx)) {
+                search_parents[next_idx] = curr_idx;
+                search_frontier.push_back(next_idx);
+            }
+        }
+    }
+
+    if (found == INVALID_IDX) {
+        return;
+    }
+
+    path.reserve(grid_size);
+    for (int idx = found; idx != src; idx = search_parents[idx]) {
+        path.push_back(idx);
+    }
+    path.push_back(src);
+    std::reverse(path.begin(), path.end());
+}
+
+template <typename IsPassable>
+void BasicAbstractGame::compute_grid_distances(const std::vector<int> &sources, const IsPassable &is_passable, std::vector<int> &dists) {
+    dists.assign(grid_size, -1);
+    search_frontier.clear();
+    search_frontier.reserve(grid_size);
+
+    for (int src : sources) {
+        if (grid.contains_index(src) && dists[src] == -1) {
+            dists[src] = 0;
+            search_frontier.push_back(src);
+        }
+    }
+
+    for (size_t head = 0; head < search_frontier.size(); head++) {
+        int curr_idx = search_frontier[head];
+
+        int x, y;
+        to_grid_xy(curr_idx, &x, &y);
+
+        const int dxs[4] = {-1, 1, 0, 0};
+        const int dys[4] = {0, 0, -1, 1};
+
+        for (int i = 0; i < 4; i++) {
+            int next_idx = to_grid_idx(x + dxs[i], y + dys[i]);
+
+            if (next_idx != INVALID_IDX && dists[next_idx] == -1 && is_passable(next_idx)) {
+                dists[next_idx] = dists[curr_idx] + 1;
+                search_frontier.push_back(next_idx);
+            }
+        }
+    }
+}
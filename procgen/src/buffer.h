@@ -1,15 +1,17 @@
 #pragma once
 
 #include "cpp-utils.h"
+#include <algorithm>
 #include <vector>
 #include <string>
+#include <cstring>
 
 struct ReadBuffer {
-    char *data = nullptr;
+    const char *data = nullptr;
     size_t offset = 0;
     size_t length = 0;
 
-    ReadBuffer(char *data, size_t length) : data(data), length(length) {
+    ReadBuffer(const char *data, size_t length) : data(data), length(length) {
     };
 
     bool read_bool() {
@@ -27,7 +29,7 @@ struct ReadBuffer {
 
     int read_int() {
         fassert(offset + sizeof(int) <= length);
-        auto d = (int*)(&data[offset]);
+        auto d = (const int*)(&data[offset]);
         offset += sizeof(int);
         return *d;
     };
@@ -43,7 +45,7 @@ struct ReadBuffer {
 
     float read_float() {
         fassert(offset + sizeof(float) <= length);
-        auto d = (float*)(&data[offset]);
+        auto d = (const float*)(&data[offset]);
         offset += sizeof(float);
         return *d;
     };
@@ -57,6 +59,12 @@ struct ReadBuffer {
         return v;
     };
 
+    void read_data(void *dst, size_t size) {
+        fassert(offset + size <= length);
+        memcpy(dst, data + offset, size);
+        offset += size;
+    };
+
     std::string read_string() {
         int size = read_int();
         std::string s(size, '\x00');
@@ -75,10 +83,25 @@ struct WriteBuffer {
     char *data = nullptr;
     size_t offset = 0;
     size_t length = 0;
+    // a buffer made from a vector grows it when it runs out of space, the written bytes are the first offset bytes
+    std::vector<char> *vec = nullptr;
 
     WriteBuffer(char *data, size_t length) :  data(data), length(length) {
     };
 
+    WriteBuffer(std::vector<char> *vec) : data(vec->data()), length(vec->size()), vec(vec) {
+    };
+
+    void reserve(size_t size) {
+        if (offset + size <= length) {
+            return;
+        }
+        fassert(vec != nullptr);
+        vec->resize(std::max(vec->size() * 2, offset + size));
+        data = vec->data();
+        length = vec->size();
+    };
+
     void write_bool(bool b) {
         write_int(b ? 1 : 0);
     };
@@ -91,7 +114,7 @@ struct WriteBuffer {
     };
 
     void write_int(int i) {
-        fassert(offset + sizeof(int) <= length);
+        reserve(sizeof(int));
         auto d = (int*)(&data[offset]);
         *d = i;
         offset += sizeof(int);
@@ -106,7 +129,7 @@ struct WriteBuffer {
     };
 
     void write_float(float f) {
-        fassert(offset + sizeof(float) <= length);
+        reserve(sizeof(float));
         auto d = (float*)(&data[offset]);
         *d = f;
         offset += sizeof(float);
@@ -119,9 +142,15 @@ struct WriteBuffer {
         }
     };
 
+    void write_data(const void *src, size_t size) {
+        reserve(size);
+        memcpy(data + offset, src, size);
+        offset += size;
+    };
+
     void write_string(std::string s) {
-        fassert(offset + s.size() <= length);
         write_int(s.size());
+        reserve(s.size());
         auto c = data + offset;
         for (size_t i = 0; i < s.size(); i++) {
             *c = s[i];
@@ -0,0 +1,249 @@
+#include "checkpoint.h"
+#include "cpp-utils.h"
+#include "buffer.h"
+#include "game.h"
+#include <cstdio>
+#include <cstring>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+const int32_t CHECKPOINT_MAGIC = 0x50474350;
+const int CHECKPOINT_VERSION = 1;
+const int HEADER_SIZE = 4 * sizeof(int32_t);
+const int MANIFEST_ENTRY_SIZE = 2 * sizeof(int64_t);
+
+Checkpointer::Checkpointer(int num_envs) : num_envs(num_envs) {
+    for (auto &arena : arenas) {
+        arena.states.resize(num_envs);
+        arena.lengths.resize(num_envs, 0);
+    }
+    start_io_thread();
+}
+
+Checkpointer::~Checkpointer() {
+    if (io_thread.joinable()) {
+        stop_io_thread();
+    }
+    if (error != "") {
+        fprintf(stderr, "unreported checkpoint error: %s\n", error.c_str());
+    }
+}
+
+void Checkpointer::start_io_thread() {
+    time_to_die = false;
+    io_thread = std::thread(&Checkpointer::io_worker, this);
+}
+
+void Checkpointer::stop_io_thread() {
+    {
+        std::unique_lock<std::mutex> lock(queue_mutex);
+        time_to_die = true;
+    }
+    arena_added.notify_all();
+    io_thread.join();
+}
+
+int Checkpointer::begin(const std::string &path) {
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    while (1) {
+        for (int i = 0; i < 2; i++) {
+            auto &arena = arenas[i];
+            if (!arena.in_use) {
+                arena.in_use = true;
+                arena.path = path;
+                arena.num_remaining = num_envs;
+                return i;
+            }
+        }
+        arena_written.wait(lock);
+    }
+}
+
+void Checkpointer::add_game(Game *game, int arena_idx) {
+    auto &arena = arenas[arena_idx];
+    int env_idx = game->game_n;
+
+    auto b = WriteBuffer(&arena.states[env_idx]);
+    {
+        AllocPhaseScope alloc_scope(&game->alloc_stats, ALLOC_PHASE_SERIALIZE);
+        game->serialize(&b);
+    }
+    arena.lengths[env_idx] = b.offset;
+
+    if (--arena.num_remaining == 0) {
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            pending_arenas.push_back(arena_idx);
+            num_unwritten++;
+        }
+        arena_added.notify_one();
+    }
+}
+
+void Checkpointer::wait() {
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    while (num_unwritten > 0) {
+        arena_written.wait(lock);
+    }
+}
+
+std::string Checkpointer::take_error() {
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    std::string result = error;
+    error = "";
+    return result;
+}
+
+void Checkpointer::io_worker() {
+    while (1) {
+        int arena_idx;
+
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            while (1) {
+                if (!pending_arenas.empty()) {
+                    arena_idx = pending_arenas.front();
+                    pending_arenas.pop_front();
+                    break;
+                }
+                // finish the completed checkpoints before exiting so that none are lost
+                if (time_to_die) {
+                    return;
+                }
+
+                arena_added.wait(lock);
+            }
+        }
+
+        std::string arena_error = write_arena(arenas[arena_idx]);
+
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            if (error == "") {
+                error = arena_error;
+            }
+            arenas[arena_idx].in_use = false;
+            num_unwritten--;
+        }
+        arena_written.notify_all();
+    }
+}
+
+std::string Checkpointer::write_arena(const Arena &arena) {
+    std::vector<char> header(HEADER_SIZE + (size_t)num_envs * MANIFEST_ENTRY_SIZE);
+    auto b = WriteBuffer(header.data(), header.size());
+    b.write_int(CHECKPOINT_MAGIC);
+    b.write_int(CHECKPOINT_VERSION);
+    b.write_int(num_envs);
+    b.write_int(0);
+
+    int64_t offset = header.size();
+    for (int e = 0; e < num_envs; e++) {
+        b.write_data(&offset, sizeof(offset));
+        b.write_data(&arena.lengths[e], sizeof(arena.lengths[e]));
+        offset += arena.lengths[e];
+    }
+
+    std::string tmp_path = arena.path + ".tmp";
+    FILE *f = fopen(tmp_path.c_str(), "wb");
+    if (f == nullptr) {
+        return "failed to open checkpoint file " + tmp_path;
+    }
+
+    bool ok = fwrite(header.data(), 1, header.size(), f) == header.size();
+    for (int e = 0; e < num_envs; e++) {
+        size_t length = arena.lengths[e];
+        ok &= fwrite(arena.states[e].data(), 1, length, f) == length;
+    }
+    // the data has to be on disk before the rename is, or a crash could leave an empty file under the final name
+    ok &= fflush(f) == 0;
+#ifdef _WIN32
+    ok &= _commit(_fileno(f)) == 0;
+#else
+    ok &= fsync(fileno(f)) == 0;
+#endif
+    ok &= fclose(f) == 0;
+    if (!ok) {
+        remove(tmp_path.c_str());
+        return "failed to write checkpoint file " + tmp_path;
+    }
+
+#ifdef _WIN32
+    // rename() does not replace existing files on windows
+    remove(arena.path.c_str());
+#endif
+    if (rename(tmp_path.c_str(), arena.path.c_str()) != 0) {
+        remove(tmp_path.c_str());
+        return "failed to rename checkpoint file " + tmp_path;
+    }
+
+#ifndef _WIN32
+    // make the rename itself durable
+    auto slash = arena.path.rfind('/');
+    std::string dir = slash == std::string::npos ? "." : arena.path.substr(0, slash + 1);
+    int dir_fd = open(dir.c_str(), O_RDONLY);
+    if (dir_fd < 0) {
+        return "failed to open checkpoint directory " + dir;
+    }
+    ok = fsync(dir_fd) == 0;
+    close(dir_fd);
+    if (!ok) {
+        return "failed to sync checkpoint directory " + dir;
+    }
+#endif
+    return "";
+}
+
+std::string read_checkpoint(const std::string &path, std::vector<std::vector<char>> *states) {
+    FILE *f = fopen(path.c_str(), "rb");
+    if (f == nullptr) {
+        return "failed to open checkpoint file " + path;
+    }
+
+    std::vector<char> contents;
+    char chunk[65536];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0) {
+        contents.insert(contents.end(), chunk, chunk + n);
+    }
+    bool ok = ferror(f) == 0;
+    fclose(f);
+    if (!ok) {
+        return "failed to read checkpoint file " + path;
+    }
+
+    int64_t size = (int64_t)(contents.size());
+    if (size < HEADER_SIZE) {
+        return "checkpoint file " + path + " is truncated";
+    }
+    auto b = ReadBuffer(contents.data(), contents.size());
+    if (b.read_int() != CHECKPOINT_MAGIC) {
+        return "file " + path + " is not a checkpoint";
+    }
+    int version = b.read_int();
+    if (version != CHECKPOINT_VERSION) {
+        return "checkpoint file " + path + " has version " + std::to_string(version) + ", expected " + std::to_string(CHECKPOINT_VERSION);
+    }
+    int num_envs = b.read_int();
+    b.read_int();
+
+    if (num_envs < 0 || (size - HEADER_SIZE) / MANIFEST_ENTRY_SIZE < num_envs) {
+        return "checkpoint file " + path + " is truncated";
+    }
+    states->resize(num_envs);
+    for (int e = 0; e < num_envs; e++) {
+        int64_t offset;
+        int64_t length;
+        b.read_data(&offset, sizeof(offset));
+        b.read_data(&length, sizeof(length));
+        if (offset < 0 || length < 0 || offset > size || length > size - offset) {
+            return "checkpoint file " + path + " is truncated";
+        }
+        (*states)[e].assign(contents.begin() + offset, contents.begin() + offset + length);
+    }
+    return "";
+}
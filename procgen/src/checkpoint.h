@@ -0,0 +1,79 @@
+#pragma once
+
+/*
+
+Background checkpoints of every environment in a VecGame
+
+Each environment is serialized by the stepping thread that owns it at the end of its step, into
+one of two arenas, so the other environments keep stepping while it happens.  Once every environment
+has been added, an io thread writes the arena to disk while the next checkpoint fills the other arena.
+
+A checkpoint file starts with a manifest giving the offset and length of each environment's state,
+followed by the states themselves, so that they can be restored in parallel.  Files are written
+under a temporary name, synced and renamed once complete, so a checkpoint path never holds a partial file.
+Errors writing a file are kept until they are reported by take_error(), the io thread never exits the process.
+
+*/
+
+#include <string>
+#include <vector>
+#include <list>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+
+class Game;
+
+class Checkpointer {
+  public:
+    Checkpointer(int num_envs);
+    ~Checkpointer();
+
+    // reserves an arena for a checkpoint that will be written to path, and returns its index
+    // this blocks only while both arenas are still being written by earlier checkpoints
+    int begin(const std::string &path);
+    // called on the stepping thread that owns the game, the last game added hands the arena to the io thread
+    void add_game(Game *game, int arena_idx);
+    // blocks until every checkpoint whose environments have all been added is on disk
+    void wait();
+    // returns the first error since the last call and forgets it, or an empty string if every write succeeded
+    std::string take_error();
+
+    // used around fork(), stopping writes every complete checkpoint first
+    void stop_io_thread();
+    void start_io_thread();
+
+  private:
+    struct Arena {
+        std::string path;
+        // the first lengths[e] bytes of states[e] hold the state of environment e, the vectors keep their
+        // size between checkpoints so that they only grow while the states do
+        std::vector<std::vector<char>> states;
+        std::vector<int64_t> lengths;
+        std::atomic<int> num_remaining{0};
+        bool in_use = false;
+    };
+
+    int num_envs;
+    Arena arenas[2];
+
+    // this mutex synchronizes access to pending_arenas, the in_use flags, num_unwritten, error and time_to_die
+    std::mutex queue_mutex;
+    std::condition_variable arena_added;
+    std::condition_variable arena_written;
+    std::list<int> pending_arenas;
+    // arenas that are complete but not yet on disk, including the one the io thread is writing
+    int num_unwritten = 0;
+    std::thread io_thread;
+    bool time_to_die = false;
+    std::string error;
+
+    void io_worker();
+    // returns an error message, or an empty string if the checkpoint is on disk
+    std::string write_arena(const Arena &arena);
+};
+
+// reads a checkpoint written by Checkpointer into one serialized state per environment, returns an error
+// message if the file is missing, truncated or not a checkpoint, or an empty string
+std::string read_checkpoint(const std::string &path, std::vector<std::vector<char>> *states);
@@ -20,6 +20,17 @@ const float PI = 3.14159265358979323846264338327950288f;
         }                                                                        \
     } while (0)
 
+// fassert_hot() is for invariants checked in inner loops, builds configured with PROCGEN_CHECK_LEVEL=unchecked leave them out
+// checks of anything that comes from outside the library should use fassert() so that they are always kept
+#ifdef PROCGEN_UNCHECKED
+#define fassert_hot(cond)    \
+    do {                     \
+        (void)sizeof(cond);  \
+    } while (0)
+#else
+#define fassert_hot(cond) fassert(cond)
+#endif
+
 // https://stackoverflow.com/a/12891181
 #ifdef __GNUC__
 #define UNUSED(x) UNUSED_##x __attribute__((__unused__))
@@ -0,0 +1,96 @@
+#include "eval-levels.h"
+#include "cpp-utils.h"
+#include "buffer.h"
+#include "game.h"
+
+EvalLevels::EvalLevels(const std::vector<int> &seeds, const std::vector<std::string> &game_names)
+    : seeds(seeds), num_envs((int)(game_names.size())) {
+    fassert(seeds.size() > 0);
+    for (int e = 0; e < num_envs; e++) {
+        auto key = std::make_pair(game_names[e], level_seed(e, 0));
+        next_levels.push_back(key);
+        num_next[key]++;
+    }
+}
+
+int EvalLevels::level_seed(int env_idx, int64_t episode) const {
+    return seeds[(env_idx + episode * num_envs) % (int64_t)(seeds.size())];
+}
+
+void EvalLevels::reset_game(Game *game) {
+    auto key = std::make_pair(game->game_name, game->current_level_seed);
+    std::shared_ptr<const std::vector<char>> level;
+
+    {
+        std::unique_lock<std::mutex> lock(templates_mutex);
+        while (1) {
+            auto it = templates.find(key);
+            if (it == templates.end()) {
+                templates[key] = nullptr;
+                break;
+            }
+            if (it->second != nullptr) {
+                level = it->second;
+                break;
+            }
+            // another game is generating this level, which only takes as long as a normal reset
+            template_added.wait(lock);
+        }
+    }
+
+    if (level == nullptr) {
+        game->game_reset();
+
+        std::vector<char> state(EVAL_LEVEL_MAX_STATE_SIZE);
+        auto b = WriteBuffer(state.data(), state.size());
+        game->serialize(&b);
+        state.resize(b.offset);
+        state.shrink_to_fit();
+
+        {
+            std::unique_lock<std::mutex> lock(templates_mutex);
+            templates[key] = std::make_shared<const std::vector<char>>(std::move(state));
+            set_next_level(game);
+            drop_if_unused(key);
+        }
+        template_added.notify_all();
+        return;
+    }
+
+    auto b = ReadBuffer(level->data(), level->size());
+    game->load_level(&b);
+    fassert(b.offset == b.length);
+
+    std::unique_lock<std::mutex> lock(templates_mutex);
+    set_next_level(game);
+    drop_if_unused(key);
+}
+
+void EvalLevels::set_next_level(Game *game) {
+    // eval_episode already counts the episode that is starting
+    auto key = std::make_pair(game->game_name, level_seed(game->game_n, game->eval_episode));
+    auto &prev_key = next_levels[game->game_n];
+    if (key == prev_key) {
+        return;
+    }
+
+    num_next[key]++;
+    auto it = num_next.find(prev_key);
+    if (--it->second == 0) {
+        num_next.erase(it);
+    }
+    auto old_key = prev_key;
+    prev_key = key;
+    drop_if_unused(old_key);
+}
+
+void EvalLevels::drop_if_unused(const std::pair<std::string, int> &key) {
+    if (num_next.count(key) > 0) {
+        return;
+    }
+    // games copying the template hold their own reference, and a level still being generated is kept
+    auto it = templates.find(key);
+    if (it != templates.end() && it->second != nullptr) {
+        templates.erase(it);
+    }
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+/*
+
+Evaluation on a fixed list of level seeds, with each level generated only once
+
+Episode k of environment e plays seeds[(e + k * num_envs) % seeds.size()], so the first seeds.size()
+episodes, counted across environments in that order, cover every seed once, and which environment plays
+which level never depends on timing.
+
+The first game to reset to a level generates it and keeps its serialized state as a template.  Every
+later game that resets to the same level copies the template instead of generating it again, keeping
+only the state that carries over between its own episodes.
+
+A template is dropped once no environment plays its level in its next episode, which the seed list
+determines, so at most about one template per environment is kept.  With more seeds than environments
+each level is then generated again on the next pass over the list.  Restoring a game with set_state()
+can make its next level differ from the one counted here until its next reset, which only affects
+which templates are kept.
+
+*/
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <string>
+#include <utility>
+#include <vector>
+
+class Game;
+
+// largest serialized state of a level template, the same limit as get_state() in env.py
+const int EVAL_LEVEL_MAX_STATE_SIZE = 1 << 20;
+
+class EvalLevels {
+  public:
+    // game_names[e] is the game played by environment e
+    EvalLevels(const std::vector<int> &seeds, const std::vector<std::string> &game_names);
+
+    // the level seed for episode k of an environment
+    int level_seed(int env_idx, int64_t episode) const;
+    // resets the game to the level for current_level_seed, called on the stepping thread that owns the game
+    void reset_game(Game *game);
+
+  private:
+    std::vector<int> seeds;
+    int num_envs;
+
+    // this mutex synchronizes access to templates, next_levels and num_next, a null template is being
+    // generated by some game
+    std::mutex templates_mutex;
+    std::condition_variable template_added;
+    std::map<std::pair<std::string, int>, std::shared_ptr<const std::vector<char>>> templates;
+    // the level each environment plays in its next episode, and the number of environments playing each level next
+    std::vector<std::pair<std::string, int>> next_levels;
+    std::map<std::pair<std::string, int>, int> num_next;
+
+    // records the level the game plays next, dropping templates no environment plays next, called with the mutex held
+    void set_next_level(Game *game);
+    void drop_if_unused(const std::pair<std::string, int> &key);
+};
@@ -1,3 +1,3 @@
 #include "game-registry.h"
 
-std::map<std::string, std::function<std::shared_ptr<Game>()>> *globalGameRegistry = nullptr;
\ No newline at end of file
+std::map<std::string, GameFactory> *globalGameRegistry = nullptr;
\ No newline at end of file
@@ -6,6 +6,8 @@ This is a way to register game classes without having to update a central index
 
 Each game should include "game-registry.h" and call REGISTER_GAME("name", GameSubClass)
 
+Games are created with the arena they should allocate from, or null to use the heap
+
 */
 
 #include <vector>
@@ -14,22 +16,27 @@ Each game should include "game-registry.h" and call REGISTER_GAME("name", GameSu
 #include <functional>
 #include <memory>
 #include "cpp-utils.h"
+#include "arena.h"
 
 class Game;
 
-#define REGISTER_GAME(name, cls)                                         \
-    static auto UNUSED_FUNCTION(_registration) = registerGame(name, [] { \
-        return std::make_shared<cls>();                                  \
+typedef std::function<std::shared_ptr<Game>(const std::shared_ptr<Arena> &)> GameFactory;
+
+#define REGISTER_GAME(name, cls)                                                                              \
+    static auto UNUSED_FUNCTION(_registration) = registerGame(name, [](const std::shared_ptr<Arena> &arena) { \
+        auto game = arena_make_shared<cls>(arena);                                                            \
+        game->arena = arena;                                                                                  \
+        return game;                                                                                          \
     })
 
-extern std::map<std::string, std::function<std::shared_ptr<Game>()>> *globalGameRegistry;
+extern std::map<std::string, GameFactory> *globalGameRegistry;
 
 template <typename Func>
 int registerGame(std::string name, Func fn) {
     if (globalGameRegistry == nullptr) {
         // because global initialization order is undefined in C++, supposedly
         // we have to set this here
-        globalGameRegistry = new std::map<std::string, std::function<std::shared_ptr<Game>()>>();
+        globalGameRegistry = new std::map<std::string, GameFactory>();
     }
     (*globalGameRegistry)[name] = fn;
     return 0;
@@ -1,9 +1,15 @@
 
 #include "game.h"
 #include "vecoptions.h"
+#include "eval-levels.h"
+#include "sprite-batch.h"
+#include <cstring>
 
 // this should be updated whenever the state format or environments may have changed
-const int SERIALIZE_VERSION = 0;
+const int SERIALIZE_VERSION = 7;
+// the serialized state of a maze, whose cells are almost never uniform, is just under 1MB at this scale, which is the
+// size of the state buffers of env.py, pymodule.cpp and EVAL_LEVEL_MAX_STATE_SIZE
+const int MAX_WORLD_SCALE = 16;
 
 void bgr32_to_rgb888(void *dst_rgb888, void *src_bgr32, int w, int h) {
     uint8_t *src = (uint8_t *)src_bgr32;
@@ -22,6 +28,16 @@ void bgr32_to_rgb888(void *dst_rgb888, void *src_bgr32, int w, int h) {
     }
 }
 
+uint32_t *thread_render_buf(int w, int h) {
+    // rendering is transient, so rather than keeping a frame in every game, each
+    // stepping thread renders into its own buffer that stays hot in cache
+    static thread_local std::vector<uint32_t> render_buf;
+    if (render_buf.size() < (size_t)(w * h)) {
+        render_buf.resize(w * h);
+    }
+    return render_buf.data();
+}
+
 Game::Game(std::string name) : game_name(name) {
     timeout = 1000;
     episodes_remaining = 0;
@@ -39,20 +55,39 @@ Game::Game(std::string name) : game_name(name) {
 Game::~Game() {
 }
 
-void Game::parse_options(std::string name, VecOptions opts) {
-    opts.consume_bool("use_easy_jump", &options.use_easy_jump);
-    opts.consume_bool("paint_vel_info", &options.paint_vel_info);
-    opts.consume_bool("use_generated_assets", &options.use_generated_assets);
-    opts.consume_bool("use_monochrome_assets", &options.use_monochrome_assets);
-    opts.consume_bool("restrict_themes", &options.restrict_themes);
-    opts.consume_bool("use_backgrounds", &options.use_backgrounds);
-    opts.consume_bool("center_agent", &options.center_agent);
-    opts.consume_bool("use_sequential_levels", &options.use_sequential_levels);
+void parse_game_options(VecOptions &opts, GameOptions *options, int *game_type) {
+    opts.consume_bool("use_easy_jump", &options->use_easy_jump);
+    opts.consume_bool("paint_vel_info", &options->paint_vel_info);
+    opts.consume_bool("use_generated_assets", &options->use_generated_assets);
+    opts.consume_bool("use_monochrome_assets", &options->use_monochrome_assets);
+    opts.consume_bool("restrict_themes", &options->restrict_themes);
+    opts.consume_bool("use_backgrounds", &options->use_backgrounds);
+    opts.consume_bool("center_agent", &options->center_agent);
+    opts.consume_bool("use_sequential_levels", &options->use_sequential_levels);
 
     int dist_mode = EasyMode;
     opts.consume_int("distribution_mode", &dist_mode);
-    options.distribution_mode = static_cast<DistributionMode>(dist_mode);
+    options->distribution_mode = static_cast<DistributionMode>(dist_mode);
+    opts.consume_int("world_scale", &options->world_scale);
+
+    opts.consume_int("augment_translate", &options->augment.translate);
+    opts.consume_float("augment_brightness", &options->augment.brightness);
+    opts.consume_float("augment_contrast", &options->augment.contrast);
+    opts.consume_float("augment_saturation", &options->augment.saturation);
+    opts.consume_float("augment_grayscale_prob", &options->augment.grayscale_prob);
+    opts.consume_int("augment_cutout", &options->augment.cutout);
+    opts.consume_bool("augment_every_step", &options->augment.every_step);
 
+    // coinrun_old
+    opts.consume_int("plain_assets", &options->plain_assets);
+    opts.consume_int("physics_mode", &options->physics_mode);
+    opts.consume_int("debug_mode", &options->debug_mode);
+    opts.consume_int("game_type", game_type);
+
+    opts.ensure_empty();
+}
+
+void check_game_options(const std::string &name, const GameOptions &options) {
     if (options.distribution_mode == EasyMode) {
         fassert(name != "coinrun_old");
     } else if (options.distribution_mode == HardMode) {
@@ -65,19 +100,23 @@ void Game::parse_options(std::string name, VecOptions opts) {
         fatal("invalid distribution_mode %d\n", options.distribution_mode);
     }
 
-    // coinrun_old
-    opts.consume_int("plain_assets", &options.plain_assets);
-    opts.consume_int("physics_mode", &options.physics_mode);
-    opts.consume_int("debug_mode", &options.debug_mode);
-    opts.consume_int("game_type", &game_type);
+    if (options.world_scale < 1 || options.world_scale > MAX_WORLD_SCALE) {
+        fatal("invalid world_scale %d, it must be between 1 and %d\n", options.world_scale, MAX_WORLD_SCALE);
+    } else if (options.world_scale > 1) {
+        fassert(name == "climber" || name == "coinrun" || name == "maze" || name == "ninja");
+    }
 
-    opts.ensure_empty();
+    const AugmentOptions &augment = options.augment;
+    if (augment.translate < 0 || augment.cutout < 0 || augment.brightness < 0 || augment.contrast < 0 || augment.saturation < 0 || augment.grayscale_prob < 0 || augment.grayscale_prob > 1) {
+        fatal("invalid augmentation options\n");
+    }
 }
 
 void Game::render_to_buf(void *dst, int w, int h, bool antialias) {
     // Qt focuses on RGB32 performance:
     // https://doc.qt.io/qt-5/qpainter.html#performance
     // so render to an RGB32 buffer and then convert it rather than render to RGB888 directly
+    AllocPhaseScope alloc_scope(&alloc_stats, ALLOC_PHASE_RENDER);
     QImage img((uchar *)dst, w, h, w * 4, QImage::Format_RGB32);
     QPainter p(&img);
 
@@ -91,10 +130,14 @@ void Game::render_to_buf(void *dst, int w, int h, bool antialias) {
 }
 
 void Game::reset() {
+    AllocPhaseScope alloc_scope(&alloc_stats, ALLOC_PHASE_RESET);
     reset_count++;
 
     if (episodes_remaining == 0) {
-        if (options.use_sequential_levels && step_data.level_complete) {
+        if (eval_levels != nullptr) {
+            current_level_seed = eval_levels->level_seed(game_n, eval_episode);
+            eval_episode++;
+        } else if (options.use_sequential_levels && step_data.level_complete) {
             // prevent overflow in seed sequences
             current_level_seed = (int32_t)(current_level_seed + 997);
         } else {
@@ -109,15 +152,24 @@ void Game::reset() {
     }
 
     rand_gen.seed(current_level_seed);
-    game_reset();
+    if (eval_levels != nullptr) {
+        eval_levels->reset_game(this);
+    } else {
+        game_reset();
+    }
 
     cur_time = 0;
     total_reward = 0;
     episodes_remaining -= 1;
     action = default_action;
+
+    if (options.augment.enabled()) {
+        augment_params.sample(augment_rand_gen, options.augment, RES_W, RES_H);
+    }
 }
 
 void Game::step() {
+    AllocPhaseScope alloc_scope(&alloc_stats, ALLOC_PHASE_STEP);
     cur_time += 1;
     bool will_force_reset = false;
 
@@ -129,9 +181,11 @@ void Game::step() {
     step_data.reward = 0;
     step_data.done = false;
     step_data.level_complete = false;
+    step_data.truncated = false;
     game_step();
 
-    step_data.done = step_data.done || will_force_reset || (cur_time >= timeout);
+    step_data.truncated = !step_data.done && (will_force_reset || (cur_time >= timeout));
+    step_data.done = step_data.done || step_data.truncated;
     total_reward += step_data.reward;
 
     if (step_data.reward != 0) {
@@ -142,7 +196,17 @@ void Game::step() {
     prev_level_seed = current_level_seed;
 
     if (step_data.done) {
+        // the level is about to be replaced, so this is the only chance to draw its last frame
+        if (info_slots.terminal_rgb >= 0) {
+            // drawn right away, since the reset can redraw the images that a batched frame would be blitted from
+            SpriteBatch *batch = render_batch;
+            render_batch = nullptr;
+            render_obs(info_bufs[info_slots.terminal_rgb]);
+            render_batch = batch;
+        }
         reset();
+    } else if (options.augment.every_step && options.augment.enabled()) {
+        augment_params.sample(augment_rand_gen, options.augment, RES_W, RES_H);
     }
 
     if (options.use_sequential_levels && step_data.level_complete) {
@@ -154,19 +218,100 @@ void Game::step() {
     observe();
 }
 
-void Game::observe() {
+void Game::render_obs(void *dst_rgb888, uint8_t *dst_labels) {
+    if (dst_labels != nullptr) {
+        // anything that isn't labeled while drawing is background
+        memset(dst_labels, 0, RES_W * RES_H);
+        label_buf = dst_labels;
+    }
+
+    if (render_batch != nullptr && supports_batched_render()) {
+        // only the labels are finished here, the frame is drawn and converted when the batch is flushed
+        {
+            AllocPhaseScope alloc_scope(&alloc_stats, ALLOC_PHASE_RENDER);
+            render_batch->begin_frame(dst_rgb888, options.augment.enabled() ? &augment_params : nullptr, options.augment.cutout);
+            draw_batch = render_batch;
+            game_draw(render_batch->recording_painter(), QRect(0, 0, RES_W, RES_H));
+            draw_batch = nullptr;
+        }
+        label_buf = nullptr;
+
+        if (dst_labels != nullptr && options.augment.enabled()) {
+            augment_labels(dst_labels, RES_W, RES_H, augment_params, options.augment.cutout);
+        }
+        return;
+    }
+
+    uint32_t *render_buf = thread_render_buf(RES_W, RES_H);
     render_to_buf(render_buf, RES_W, RES_H, false);
-    bgr32_to_rgb888(obs_bufs[0], render_buf, RES_W, RES_H);
+    label_buf = nullptr;
+
+    if (options.augment.enabled()) {
+        bgr32_to_rgb888_augmented(dst_rgb888, render_buf, RES_W, RES_H, augment_params, options.augment.cutout);
+        if (dst_labels != nullptr) {
+            augment_labels(dst_labels, RES_W, RES_H, augment_params, options.augment.cutout);
+        }
+    } else {
+        bgr32_to_rgb888(dst_rgb888, render_buf, RES_W, RES_H);
+    }
+}
+
+void Game::observe() {
+    render_obs(obs_bufs[0], seg_obs_slot >= 0 ? (uint8_t *)(obs_bufs[seg_obs_slot]) : nullptr);
+    if (info_slots.augment >= 0) {
+        augment_params.write_floats((float *)(info_bufs[info_slots.augment]));
+    }
+    if (info_slots.truncated >= 0) {
+        *(uint8_t *)(info_bufs[info_slots.truncated]) = (uint8_t)(step_data.truncated);
+    }
     *reward_ptr = step_data.reward;
     *first_ptr = (uint8_t)step_data.done;
-    *(int32_t *)(info_bufs[info_name_to_offset.at("prev_level_seed")]) = (int32_t)(prev_level_seed);
-    *(uint8_t *)(info_bufs[info_name_to_offset.at("prev_level_complete")]) = (uint8_t)(step_data.level_complete);
-    *(int32_t *)(info_bufs[info_name_to_offset.at("level_seed")]) = (int32_t)(current_level_seed);
+    *(int32_t *)(info_bufs[info_slots.prev_level_seed]) = (int32_t)(prev_level_seed);
+    *(uint8_t *)(info_bufs[info_slots.prev_level_complete]) = (uint8_t)(step_data.level_complete);
+    *(int32_t *)(info_bufs[info_slots.level_seed]) = (int32_t)(current_level_seed);
+    if (info_slots.oracle_action >= 0) {
+        *(int32_t *)(info_bufs[info_slots.oracle_action]) = (int32_t)(oracle_action());
+    }
+    if (info_slots.goal_distance >= 0) {
+        *(int32_t *)(info_bufs[info_slots.goal_distance]) = (int32_t)(goal_distance());
+    }
+}
+
+int Game::add_info_field(const std::string &name, enum libenv_dtype dtype) {
+    fassert(dtype == LIBENV_DTYPE_INT32 || dtype == LIBENV_DTYPE_FLOAT32);
+    GameInfoField field;
+    field.name = name;
+    field.dtype = dtype;
+    info_fields.push_back(field);
+    info_field_slots.push_back(-1);
+    return (int)(info_fields.size()) - 1;
+}
+
+void Game::set_info(int handle, int32_t value) {
+    fassert(info_fields[handle].dtype == LIBENV_DTYPE_INT32);
+    *(int32_t *)(info_bufs[info_field_slots[handle]]) = value;
+}
+
+void Game::set_info(int handle, float value) {
+    fassert(info_fields[handle].dtype == LIBENV_DTYPE_FLOAT32);
+    *(float *)(info_bufs[info_field_slots[handle]]) = value;
 }
 
 void Game::game_init() {
 }
 
+int Game::oracle_action() {
+    return -1;
+}
+
+int Game::goal_distance() {
+    return -1;
+}
+
+bool Game::supports_batched_render() {
+    return false;
+}
+
 void Game::serialize(WriteBuffer *b) {
     b->write_int(SERIALIZE_VERSION);
     
@@ -181,6 +326,8 @@ void Game::serialize(WriteBuffer *b) {
     b->write_int(options.debug_mode);
     b->write_int(options.distribution_mode);
     b->write_int(options.use_sequential_levels);
+    b->write_int(options.world_scale);
+    options.augment.serialize(b);
 
     b->write_int(options.use_easy_jump);
     b->write_int(options.plain_assets);
@@ -194,10 +341,15 @@ void Game::serialize(WriteBuffer *b) {
 
     level_seed_rand_gen.serialize(b);
     rand_gen.serialize(b);
+    if (options.augment.enabled()) {
+        augment_rand_gen.serialize(b);
+        augment_params.serialize(b);
+    }
 
     b->write_float(step_data.reward);
     b->write_int(step_data.done);
     b->write_int(step_data.level_complete);
+    b->write_int(step_data.truncated);
 
     b->write_int(action);
     b->write_int(timeout);
@@ -206,6 +358,7 @@ void Game::serialize(WriteBuffer *b) {
     b->write_int(prev_level_seed);
     b->write_int(episodes_remaining);
     b->write_int(episode_done);
+    b->write_data(&eval_episode, sizeof(eval_episode));
 
     b->write_int(last_reward_timer);
     b->write_float(last_reward);
@@ -213,11 +366,10 @@ void Game::serialize(WriteBuffer *b) {
 
     b->write_int(fixed_asset_seed);
 
-    // don't save render buf as we will just re-write it on next observation
-    // uint32_t render_buf[RES_W * RES_H];
-
     b->write_int(cur_time);
-    b->write_int(is_waiting_for_step);
+    // is_waiting_for_step belongs to VecGame and is set while checkpoints are taken on the stepping threads,
+    // so it is always stored as false and never restored
+    b->write_int(false);
 
     // don't serialize these, since they are pointers, and will likely have incorrect values
     // if deserialized into another game object
@@ -226,6 +378,30 @@ void Game::serialize(WriteBuffer *b) {
     // std::vector<void *> info_bufs;
     // float *reward_ptr = nullptr;
     // uint8_t *first_ptr = nullptr;
+    // FrameRecorder *recorder = nullptr;
+    // TrajectoryWriter *trajectory_writer = nullptr;
+}
+
+std::string Game::check_serialized_header(const char *data, size_t length) {
+    int version;
+    int name_length;
+    if (length < sizeof(version) + sizeof(name_length)) {
+        return "the state is truncated";
+    }
+    memcpy(&version, data, sizeof(version));
+    if (version != SERIALIZE_VERSION) {
+        return "the state has version " + std::to_string(version) + ", expected " + std::to_string(SERIALIZE_VERSION);
+    }
+    memcpy(&name_length, data + sizeof(version), sizeof(name_length));
+    size_t name_offset = sizeof(version) + sizeof(name_length);
+    if (name_length < 0 || (size_t)name_length > length - name_offset) {
+        return "the state is truncated";
+    }
+    std::string name(data + name_offset, name_length);
+    if (name != game_name) {
+        return "the state is of " + name + ", expected " + game_name;
+    }
+    return "";
 }
 
 void Game::deserialize(ReadBuffer *b) {
@@ -241,6 +417,8 @@ void Game::deserialize(ReadBuffer *b) {
     options.debug_mode = b->read_int();
     options.distribution_mode = DistributionMode(b->read_int());
     options.use_sequential_levels = b->read_int();
+    options.world_scale = b->read_int();
+    options.augment.deserialize(b);
 
     options.use_easy_jump = b->read_int();
     options.plain_assets = b->read_int();
@@ -254,10 +432,15 @@ void Game::deserialize(ReadBuffer *b) {
 
     level_seed_rand_gen.deserialize(b);
     rand_gen.deserialize(b);
+    if (options.augment.enabled()) {
+        augment_rand_gen.deserialize(b);
+        augment_params.deserialize(b);
+    }
 
     step_data.reward = b->read_float();
     step_data.done = b->read_int();
     step_data.level_complete = b->read_int();
+    step_data.truncated = b->read_int();
 
     action = b->read_int();
     timeout = b->read_int();
@@ -266,6 +449,7 @@ void Game::deserialize(ReadBuffer *b) {
     prev_level_seed = b->read_int();
     episodes_remaining = b->read_int();
     episode_done = b->read_int();
+    b->read_data(&eval_episode, sizeof(eval_episode));
 
     last_reward_timer = b->read_int();
     last_reward = b->read_float();
@@ -274,5 +458,37 @@ void Game::deserialize(ReadBuffer *b) {
     fixed_asset_seed = b->read_int();
 
     cur_time = b->read_int();
-    is_waiting_for_step = b->read_int();
+    b->read_int();
+}
+
+void Game::load_level(ReadBuffer *b) {
+    int n = game_n;
+    RandGen level_seed_gen = level_seed_rand_gen;
+    RandGen augment_gen = augment_rand_gen;
+    AugmentParams augment = augment_params;
+    StepData data = step_data;
+    int prev_action = action;
+    int prev_seed = prev_level_seed;
+    int remaining = episodes_remaining;
+    bool done = episode_done;
+    int64_t episode = eval_episode;
+    int reward_timer = last_reward_timer;
+    float reward = last_reward;
+    int time = cur_time;
+
+    deserialize(b);
+
+    game_n = n;
+    level_seed_rand_gen = level_seed_gen;
+    augment_rand_gen = augment_gen;
+    augment_params = augment;
+    step_data = data;
+    action = prev_action;
+    prev_level_seed = prev_seed;
+    episodes_remaining = remaining;
+    episode_done = done;
+    eval_episode = episode;
+    last_reward_timer = reward_timer;
+    last_reward = reward;
+    cur_time = time;
 }
@@ -17,6 +17,9 @@ Base class used for all games, all games must inherit from this
 #include "object-ids.h"
 #include "game-registry.h"
 #include "buffer.h"
+#include "augment.h"
+#include "alloc-tracking.h"
+#include "libenv.h"
 
 // We want all games to have same observation space. So all these
 // constants here related to observation space are constants forever.
@@ -27,7 +30,16 @@ const int RENDER_RES = 512;
 
 void bgr32_to_rgb888(void *dst_rgb888, void *src_bgr32, int w, int h);
 
+// scratch BGR32 buffer owned by the calling thread, valid until the next call on the same thread
+uint32_t *thread_render_buf(int w, int h);
+
 class VecOptions;
+class FrameRecorder;
+class TrajectoryWriter;
+class Checkpointer;
+class EvalLevels;
+class SpriteBatch;
+struct StepPolicy;
 
 enum DistributionMode {
     EasyMode = 0,
@@ -40,6 +52,8 @@ struct StepData {
     float reward = 0.0f;
     bool done = false;
     bool level_complete = false;
+    // set if the episode was cut short by the time limit or a forced reset rather than ending on its own
+    bool truncated = false;
 };
 
 struct GameOptions {
@@ -52,6 +66,10 @@ struct GameOptions {
     int debug_mode = 0;
     DistributionMode distribution_mode = HardMode;
     bool use_sequential_levels = false;
+    // multiplies the size of the world in games that support it
+    int world_scale = 1;
+    // observation augmentation, applied to the whole batch
+    AugmentOptions augment;
 
     // coinrun_old
     bool use_easy_jump = false;
@@ -59,10 +77,39 @@ struct GameOptions {
     int physics_mode = 0;
 };
 
+// parses the options shared by every game in a VecGame, consuming them from opts
+void parse_game_options(VecOptions &opts, GameOptions *options, int *game_type);
+// fails if the named game does not support the given options
+void check_game_options(const std::string &name, const GameOptions &options);
+
+// indices into Game::info_bufs of the info values that every game can write, -1 if the value is not enabled
+struct InfoSlots {
+    int prev_level_seed = -1;
+    int prev_level_complete = -1;
+    int level_seed = -1;
+    int oracle_action = -1;
+    int goal_distance = -1;
+    int agent_x = -1;
+    int agent_y = -1;
+    int terminal_rgb = -1;
+    int truncated = -1;
+    int augment = -1;
+    int rgb = -1;
+};
+
+// a scalar info value that a game declares in its constructor
+struct GameInfoField {
+    std::string name;
+    enum libenv_dtype dtype;
+};
+
 class Game {
   public:
     const std::string game_name;
-    std::map<std::string, int> info_name_to_offset;
+    InfoSlots info_slots;
+    std::vector<GameInfoField> info_fields;
+    // index into info_bufs for each of info_fields, filled in by VecGame
+    std::vector<int> info_field_slots;
 
     GameOptions options;
 
@@ -75,6 +122,9 @@ class Game {
 
     RandGen level_seed_rand_gen;
     RandGen rand_gen;
+    // kept apart from rand_gen so that augmentation never changes the levels or their dynamics
+    RandGen augment_rand_gen;
+    AugmentParams augment_params;
 
     StepData step_data;
     int action = 0;
@@ -92,8 +142,6 @@ class Game {
 
     int fixed_asset_seed = 0;
 
-    uint32_t render_buf[RES_W * RES_H];
-
     int cur_time = 0;
 
     bool is_waiting_for_step = false;
@@ -102,14 +150,46 @@ class Game {
     int32_t *action_ptr;
     std::vector<void *> obs_bufs;
     std::vector<void *> info_bufs;
+    // index into obs_bufs of the segmentation labels, -1 if they are not enabled
+    int seg_obs_slot = -1;
+    // set while an observation with labels is being drawn, RES_W * RES_H labels that drawing code may fill in
+    uint8_t *label_buf = nullptr;
     float *reward_ptr = nullptr;
     uint8_t *first_ptr = nullptr;
 
+    // set if this environment's observations are being recorded
+    FrameRecorder *recorder = nullptr;
+    // set if this environment's trajectory is being written to a dataset
+    TrajectoryWriter *trajectory_writer = nullptr;
+    // set if this environment should be added to checkpoint_arena of the checkpointer at the end of its step
+    Checkpointer *checkpointer = nullptr;
+    int checkpoint_arena = -1;
+    // set if levels come from a fixed list of seeds, with each level generated once for all environments
+    EvalLevels *eval_levels = nullptr;
+    // number of episodes started from eval_levels
+    int64_t eval_episode = 0;
+    // set if actions are chosen by a policy running on the stepping threads
+    const StepPolicy *policy = nullptr;
+    // set while this game is stepped together with other games whose observations are drawn as one batch
+    SpriteBatch *render_batch = nullptr;
+    // set while game_draw records an observation into render_batch instead of painting it
+    SpriteBatch *draw_batch = nullptr;
+    // allocations made by this game, only counted in builds with PROCGEN_ALLOC_TRACKING
+    AllocStats alloc_stats;
+    // set if this game and its entities are allocated from an arena of their own instead of the heap
+    std::shared_ptr<Arena> arena;
+
     Game(std::string name);
     void step();
     void reset();
     void render_to_buf(void *buf, int w, int h, bool antialias);
-    void parse_options(std::string name, VecOptions opt_vec);
+    // renders the current state into an RGB888 observation, with augmentation if it is enabled
+    // if dst_labels is set, it receives the label of the object drawn at each pixel
+    void render_obs(void *dst_rgb888, uint8_t *dst_labels = nullptr);
+    // declares an info value for this game, returns the handle to pass to set_info
+    int add_info_field(const std::string &name, enum libenv_dtype dtype);
+    void set_info(int handle, int32_t value);
+    void set_info(int handle, float value);
 
     virtual ~Game() = 0;
     virtual void observe();
@@ -119,6 +199,18 @@ class Game {
     virtual void game_draw(QPainter &p, const QRect &rect) = 0;
     virtual void serialize(WriteBuffer *b);
     virtual void deserialize(ReadBuffer *b);
+    // returns an error message if data was not serialized by this version of the same game, or an empty string
+    std::string check_serialized_header(const char *data, size_t length);
+    // replaces the level with the serialized state of a game that was just reset to the same level,
+    // keeping the state that carries over between this game's own episodes
+    virtual void load_level(ReadBuffer *b);
+    // action an expert would take from the current state, -1 if this game has no oracle
+    // must not change the game state, so it can be called at any point between steps
+    virtual int oracle_action();
+    // number of grid steps between the agent and the goal, -1 if the game has no goal or it can't be reached
+    virtual int goal_distance();
+    // true if game_draw can record into draw_batch, which means it never paints with the QPainter directly
+    virtual bool supports_batched_render();
 
   private:
     int reset_count = 0;
@@ -84,6 +84,7 @@ class BigFish : public BasicAbstractGame {
   public:
     int fish_eaten = 0;
     float r_inc = 0.0;
+    int fish_eaten_info;
 
     BigFish()
         : BasicAbstractGame(NAME) {
@@ -91,6 +92,8 @@ class BigFish : public BasicAbstractGame {
 
         main_width = 20;
         main_height = 20;
+
+        fish_eaten_info = add_info_field("fish_eaten", LIBENV_DTYPE_INT32);
     }
 
     void load_background_images() override {
@@ -127,6 +130,11 @@ class BigFish : public BasicAbstractGame {
         }
     }
 
+    void observe() override {
+        BasicAbstractGame::observe();
+        set_info(fish_eaten_info, (int32_t)(fish_eaten));
+    }
+
     void game_reset() override {
         BasicAbstractGame::game_reset();
 
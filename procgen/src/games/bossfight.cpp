@@ -191,6 +191,16 @@ class BossfightGame : public BasicAbstractGame {
         return BasicAbstractGame::should_draw_entity(entity);
     }
 
+    bool get_collision_target_types(int src_type, std::vector<int> &target_types) override {
+        if (src_type == PLAYER_BULLET) {
+            target_types = {SHIELDS, BOSS};
+        } else if (src_type == BARRIER) {
+            // barriers are never damaged, so they only act on what they block
+            target_types = {ENEMY_BULLET, PLAYER_BULLET, LASER_TRAIL};
+        }
+        return true;
+    }
+
     void handle_collision(const std::shared_ptr<Entity> &src, const std::shared_ptr<Entity> &target) override {
         if (src->type == PLAYER_BULLET) {
             bool will_erase = false;
@@ -398,7 +408,7 @@ class BossfightGame : public BasicAbstractGame {
             float ent_y = rand_gen.rand01() * (BOTTOM_MARGIN - min_barrier_y - barrier_r) + min_barrier_y;
             float ent_x = rand_gen.rand01() * (main_width - 2 * barrier_r) + barrier_r;
 
-            auto ent = std::make_shared<Entity>(ent_x, ent_y, 0, 0, barrier_r, BARRIER);
+            auto ent = arena_make_shared<Entity>(arena, ent_x, ent_y, 0, 0, barrier_r, BARRIER);
             choose_random_theme(ent);
             match_aspect_ratio(ent);
             ent->health = 3;
@@ -88,6 +88,9 @@ a single step regardless of which action is taken.
 class CaveFlyerGame : public BasicAbstractGame {
   public:
     std::unique_ptr<RoomGenerator> room_manager;
+    // scratch cells of the oracle
+    std::vector<bool> is_goal;
+    std::vector<bool> is_dangerous;
 
     CaveFlyerGame()
         : BasicAbstractGame(NAME) {
@@ -157,6 +160,13 @@ class CaveFlyerGame : public BasicAbstractGame {
         return false;
     }
 
+    bool get_collision_target_types(int src_type, std::vector<int> &target_types) override {
+        if (src_type == TARGET || src_type == OBSTACLE || src_type == ENEMY || src_type == GOAL) {
+            target_types = {PLAYER_BULLET};
+        }
+        return true;
+    }
+
     void handle_collision(const std::shared_ptr<Entity> &src, const std::shared_ptr<Entity> &target) override {
         if (target->type == PLAYER_BULLET) {
             bool erase_bullet = false;
@@ -367,6 +377,88 @@ class CaveFlyerGame : public BasicAbstractGame {
         action_vrot = move_action / 3 - 1;
     }
 
+    bool get_goal_cells(std::vector<int> &goal_cells) override {
+        for (const auto &ent : entities) {
+            if (ent->type == GOAL) {
+                goal_cells.push_back(to_grid_idx(int(ent->x), int(ent->y)));
+            }
+        }
+        return true;
+    }
+
+    bool is_goal_path_cell(int idx) override {
+        return get_obj(idx) == SPACE;
+    }
+
+    // follow the shortest route to the goal that stays clear of obstacles, turning the ship toward
+    // the velocity it needs and only thrusting once it roughly faces that way
+    int oracle_action() override {
+        is_goal.assign(grid_size, false);
+        mark_entity_cells(GOAL, -.1f, is_goal);
+
+        is_dangerous.assign(grid_size, false);
+        mark_entity_cells(OBSTACLE, agent->rx, is_dangerous);
+        mark_entity_cells(TARGET, agent->rx, is_dangerous);
+        mark_entity_cells(ENEMY, agent->rx + .5f, is_dangerous);
+
+        int agent_idx = get_agent_index();
+        auto reached_goal = [&](int idx) { return is_goal[idx]; };
+
+        std::vector<int> &path = oracle_path;
+        find_grid_path(
+            agent_idx, reached_goal, [&](int idx) { return get_obj(idx) == SPACE && (!is_dangerous[idx] || is_goal[idx]); }, path);
+
+        if (path.empty()) {
+            find_grid_path(
+                agent_idx, reached_goal, [&](int idx) { return get_obj(idx) == SPACE; }, path);
+        }
+
+        if (path.empty()) {
+            return default_action;
+        }
+
+        int wx, wy;
+        to_grid_xy(path[std::min((int)(path.size()) - 1, 2)], &wx, &wy);
+
+        float dx = wx + .5f - agent->x;
+        float dy = wy + .5f - agent->y;
+        float dist = sqrt(dx * dx + dy * dy);
+        float target_speed = .25f;
+
+        float ex = -agent->vx;
+        float ey = -agent->vy;
+        if (dist > .01f) {
+            ex += dx / dist * target_speed;
+            ey += dy / dist * target_speed;
+        }
+
+        float theta = -1 * agent->rotation + PI / 2;
+        float diff = atan2(ey, ex) - theta;
+        while (diff > PI)
+            diff -= 2 * PI;
+        while (diff < -PI)
+            diff += 2 * PI;
+
+        // turning left raises theta, which means lowering the rotation
+        int turn = 1;
+        if (diff > .15f) {
+            turn = 0;
+        } else if (diff < -.15f) {
+            turn = 2;
+        }
+
+        int thrust = 1;
+        if (sqrt(ex * ex + ey * ey) > .05f) {
+            if (fabs(diff) < PI / 4) {
+                thrust = 2;
+            } else if (fabs(diff) > 3 * PI / 4) {
+                thrust = 0;
+            }
+        }
+
+        return turn * 3 + thrust;
+    }
+
     void game_step() override {
         BasicAbstractGame::game_step();
 
@@ -98,6 +98,12 @@ class ChaserGame : public BasicAbstractGame {
     int total_orbs = 0;
     int orbs_collected = 0;
     int maze_dim = 0;
+    // scratch buffers of the oracle
+    std::vector<int> enemy_cells;
+    std::vector<int> agent_cells;
+    std::vector<int> enemy_dists;
+    std::vector<int> agent_dists;
+    std::vector<bool> is_large_orb;
 
     ChaserGame()
         : BasicAbstractGame(NAME) {
@@ -174,7 +180,7 @@ class ChaserGame : public BasicAbstractGame {
 
     void draw_grid_obj(QPainter &p, const QRectF &rect, int type, int theme) override {
         if (type == ORB) {
-            p.fillRect(QRectF(rect.x() + rect.width() * (1 - ORB_DIM) / 2, rect.y() + rect.height() * (1 - ORB_DIM) / 2, rect.width() * ORB_DIM, rect.height() * ORB_DIM), QColor(0, 255, 0));
+            fill_rect(p, QRectF(rect.x() + rect.width() * (1 - ORB_DIM) / 2, rect.y() + rect.height() * (1 - ORB_DIM) / 2, rect.width() * ORB_DIM, rect.height() * ORB_DIM), QColor(0, 255, 0));
         } else {
             BasicAbstractGame::draw_grid_obj(p, rect, type, theme);
         }
@@ -334,9 +340,11 @@ class ChaserGame : public BasicAbstractGame {
         return abs((a % main_width) - (b % main_width)) + abs((a / main_width) - (b / main_width));
     }
 
-    void get_adjacent(int idx, std::vector<int> &neighbors) {
+    // writes the up to 4 cells next to idx into neighbors and returns how many there are
+    int get_adjacent(int idx, int *neighbors) {
         int x = idx % main_width;
         int y = idx / main_width;
+        int num_neighbors = 0;
 
         for (int i = -1; i <= 1; i++) {
             for (int j = -1; j <= 1; j++) {
@@ -348,10 +356,12 @@ class ChaserGame : public BasicAbstractGame {
                 int neighbor = to_grid_idx(x + i, y + j);
 
                 if (neighbor != INVALID_IDX) {
-                    neighbors.push_back(neighbor);
+                    neighbors[num_neighbors++] = neighbor;
                 }
             }
         }
+
+        return num_neighbors;
     }
 
     void game_step() override {
@@ -392,32 +402,35 @@ class ChaserGame : public BasicAbstractGame {
                 bool be_agressive = step_rand_int % 2 == 0;
 
                 if ((ent->vx == 0 && ent->vy == 0) || is_at_junction) {
-                    std::vector<int> adj_elems;
-                    std::vector<int> space_neighbors;
+                    // this runs for every enemy on most steps, so avoid allocating
+                    int adj_elems[4];
+                    int space_neighbors[4];
+                    int num_space_neighbors = 0;
                     int prev_idx = to_grid_idx(x - sign(ent->vx), y - sign(ent->vy));
-                    get_adjacent(enemy_idx, adj_elems);
+                    int num_adj = get_adjacent(enemy_idx, adj_elems);
 
                     int min_dist = 2 * main_width;
 
-                    for (int adj : adj_elems) {
+                    for (int i = 0; i < num_adj; i++) {
+                        int adj = adj_elems[i];
                         if (is_space_vec[adj] && adj != prev_idx) {
                             int md = manhattan_dist(adj, agent_idx) * dist_scale;
 
                             if (be_agressive) {
                                 if (md < min_dist) {
                                     min_dist = md;
-                                    space_neighbors.clear();
-                                    space_neighbors.push_back(adj);
+                                    num_space_neighbors = 0;
+                                    space_neighbors[num_space_neighbors++] = adj;
                                 } else if (md == min_dist) {
-                                    space_neighbors.push_back(adj);
+                                    space_neighbors[num_space_neighbors++] = adj;
                                 }
                             } else {
-                                space_neighbors.push_back(adj);
+                                space_neighbors[num_space_neighbors++] = adj;
                             }
                         }
                     }
 
-                    int neighbor_idx = step_rand_int % space_neighbors.size();
+                    int neighbor_idx = step_rand_int % num_space_neighbors;
                     int neighbor = space_neighbors[neighbor_idx];
 
                     int nx = neighbor % main_width;
@@ -449,6 +462,63 @@ class ChaserGame : public BasicAbstractGame {
         }
     }
 
+    // head for the nearest orb that can be reached before any enemy, or run from the enemies if there is none
+    int oracle_action() override {
+        auto is_open = [&](int idx) { return is_space_vec[idx]; };
+
+        enemy_cells.clear();
+        if (!can_eat_enemies()) {
+            for (const auto &ent : entities) {
+                // eggs that are about to hatch are as dangerous as enemies
+                if (ent->type == ENEMY || (ent->type == ENEMY_EGG && ent->health < 10)) {
+                    enemy_cells.push_back(to_grid_idx(int(ent->x), int(ent->y)));
+                    enemy_cells.push_back(to_grid_idx(int(ent->x + sign(ent->vx) * .5f), int(ent->y + sign(ent->vy) * .5f)));
+                }
+            }
+        }
+
+        int agent_idx = get_agent_index();
+        agent_cells.assign(1, agent_idx);
+        compute_grid_distances(enemy_cells, is_open, enemy_dists);
+        compute_grid_distances(agent_cells, is_open, agent_dists);
+
+        auto is_safe = [&](int idx) { return is_open(idx) && (enemy_dists[idx] == -1 || agent_dists[idx] + 1 < enemy_dists[idx]); };
+
+        is_large_orb.assign(grid_size, false);
+        mark_entity_cells(LARGE_ORB, -.1f, is_large_orb);
+
+        std::vector<int> &path = oracle_path;
+        find_grid_path(
+            agent_idx, [&](int idx) { return get_obj(idx) == ORB || is_large_orb[idx]; }, is_safe, path);
+
+        if (path.size() < 2) {
+            int best_dist = -1;
+            int ax, ay;
+            to_grid_xy(agent_idx, &ax, &ay);
+            int neighbors[4];
+            int num_neighbors = get_adjacent(agent_idx, neighbors);
+            path = {agent_idx};
+
+            for (int i = 0; i < num_neighbors; i++) {
+                int neighbor = neighbors[i];
+                if (is_open(neighbor) && enemy_dists[neighbor] > best_dist) {
+                    best_dist = enemy_dists[neighbor];
+                    path = {agent_idx, neighbor};
+                }
+            }
+        }
+
+        if (path.size() < 2) {
+            return default_action;
+        }
+
+        // the agent keeps moving until it hits a wall, so steer by the direction of the next cell
+        int x0, y0, x1, y1;
+        to_grid_xy(path[0], &x0, &y0);
+        to_grid_xy(path[1], &x1, &y1);
+        return (x1 - x0 + 1) * 3 + (y1 - y0 + 1);
+    }
+
     void serialize(WriteBuffer *b) override {
         BasicAbstractGame::serialize(b);
         b->write_vector_int(free_cells);
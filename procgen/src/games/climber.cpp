@@ -226,7 +226,7 @@ class Climber : public BasicAbstractGame {
         int difficulty = rand_gen.randn(3);
         int min_platforms = difficulty * difficulty + 1;
         int max_platforms = (difficulty + 1) * (difficulty + 1) + 1;
-        int num_platforms = rand_gen.randn(max_platforms - min_platforms + 1) + min_platforms;
+        int num_platforms = (rand_gen.randn(max_platforms - min_platforms + 1) + min_platforms) * options.world_scale;
 
         coin_quota = 0;
         coins_collected = 0;
@@ -283,7 +283,7 @@ class Climber : public BasicAbstractGame {
 
     void choose_world_dim() override {
         main_width = options.distribution_mode == EasyMode ? 16 : 20;
-        main_height = 64;
+        main_height = 64 * options.world_scale;
     }
 
     void game_reset() override {
@@ -236,6 +236,18 @@ class CoinRun : public BasicAbstractGame {
         return type == LAVA_MID || type == LAVA_TOP;
     }
 
+    // distance to the goal through open cells, ignoring gravity and crates, so it counts steps straight up
+    // through the air and is only a rough guide to how far the agent has to travel
+    bool get_goal_cells(std::vector<int> &goal_cells) override {
+        goal_cells = get_cells_with_type(GOAL);
+        return true;
+    }
+
+    bool is_goal_path_cell(int idx) override {
+        int type = get_obj(idx);
+        return !is_wall(type) && !is_lava(type);
+    }
+
     bool use_block_asset(int type) override {
         return BasicAbstractGame::use_block_asset(type) || is_wall(type);
     }
@@ -322,7 +334,7 @@ class CoinRun : public BasicAbstractGame {
         int max_difficulty = 3;
         int dif = rand_gen.randn(max_difficulty) + 1;
 
-        int num_sections = rand_gen.randn(dif) + dif;
+        int num_sections = (rand_gen.randn(dif) + dif) * options.world_scale;
         int curr_x = 5;
         int curr_y = 1;
 
@@ -469,6 +481,11 @@ class CoinRun : public BasicAbstractGame {
         fill_elem(curr_x + 1, 0, main_width - curr_x - 1, main_height, WALL_MID);
     }
 
+    void choose_world_dim() override {
+        main_width = 64 * options.world_scale;
+        main_height = 64;
+    }
+
     void game_reset() override {
         BasicAbstractGame::game_reset();
 
@@ -176,6 +176,15 @@ class DodgeballGame : public BasicAbstractGame {
         }
     }
 
+    bool get_collision_target_types(int src_type, std::vector<int> &target_types) override {
+        if (src_type == LAVA_WALL) {
+            target_types = {PLAYER_BALL, ENEMY_BALL};
+        } else if (src_type == ENEMY) {
+            target_types = {PLAYER_BALL};
+        }
+        return true;
+    }
+
     void handle_collision(const std::shared_ptr<Entity> &src, const std::shared_ptr<Entity> &target) override {
         if (target->type == PLAYER_BALL) {
             if (src->type == LAVA_WALL) {
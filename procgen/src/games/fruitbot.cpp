@@ -174,6 +174,13 @@ class FruitBotGame : public BasicAbstractGame {
         }
     }
 
+    bool get_collision_target_types(int src_type, std::vector<int> &target_types) override {
+        if (src_type == PLAYER_BULLET) {
+            target_types = {BARRIER, LOCK};
+        }
+        return true;
+    }
+
     void handle_collision(const std::shared_ptr<Entity> &src, const std::shared_ptr<Entity> &target) override {
         if (src->type == PLAYER_BULLET) {
             if (target->type == BARRIER) {
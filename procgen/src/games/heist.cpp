@@ -79,6 +79,10 @@ class HeistGame : public BasicAbstractGame {
     int world_dim = 0;
     int num_keys = 0;
     std::vector<bool> has_keys;
+    int keys_held_info;
+    // scratch cells of the oracle
+    std::vector<bool> is_locked;
+    std::vector<bool> is_target;
 
     HeistGame()
         : BasicAbstractGame(NAME) {
@@ -90,6 +94,8 @@ class HeistGame : public BasicAbstractGame {
 
         out_of_bounds_object = WALL_OBJ;
         visibility = 8.0;
+
+        keys_held_info = add_info_field("keys_held", LIBENV_DTYPE_INT32);
     }
 
     void load_background_images() override {
@@ -171,6 +177,15 @@ class HeistGame : public BasicAbstractGame {
         main_height = world_dim;
     }
 
+    void observe() override {
+        BasicAbstractGame::observe();
+        int32_t keys_held = 0;
+        for (bool has_key : has_keys) {
+            keys_held += has_key;
+        }
+        set_info(keys_held_info, keys_held);
+    }
+
     void game_reset() override {
         BasicAbstractGame::game_reset();
 
@@ -267,6 +282,51 @@ class HeistGame : public BasicAbstractGame {
         agent->face_direction(action_vx, action_vy);
     }
 
+    // distance to the exit, ignoring the locked doors on the way
+    bool get_goal_cells(std::vector<int> &goal_cells) override {
+        for (const auto &ent : entities) {
+            if (ent->type == EXIT) {
+                goal_cells.push_back(to_grid_idx(int(ent->x), int(ent->y)));
+            }
+        }
+        return true;
+    }
+
+    // head for the nearest key or exit that isn't behind a locked door, which collects the keys in order
+    int oracle_action() override {
+        is_locked.assign(grid_size, false);
+        is_target.assign(grid_size, false);
+
+        for (const auto &ent : entities) {
+            if (ent->will_erase) {
+                continue;
+            }
+
+            int idx = to_grid_idx(int(ent->x), int(ent->y));
+            if (idx == INVALID_IDX) {
+                continue;
+            }
+
+            if (ent->type == LOCKED_DOOR && !has_keys[ent->image_theme]) {
+                is_locked[idx] = true;
+            } else if (ent->type == KEY || ent->type == EXIT) {
+                is_target[idx] = true;
+            }
+        }
+
+        std::vector<int> &path = oracle_path;
+        find_grid_path(
+            get_agent_index(), [&](int idx) { return is_target[idx]; }, [&](int idx) { return get_obj(idx) != WALL_OBJ && !is_locked[idx]; }, path);
+
+        if (path.empty()) {
+            return default_action;
+        }
+
+        int x, y;
+        to_grid_xy(path[path.size() < 2 ? 0 : 1], &x, &y);
+        return move_action_toward(x + .5f, y + .5f, .1f);
+    }
+
     void serialize(WriteBuffer *b) override {
         BasicAbstractGame::serialize(b);
         b->write_int(num_keys);
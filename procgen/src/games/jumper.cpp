@@ -107,6 +107,8 @@ class Jumper : public BasicAbstractGame {
     int wall_theme = 0;
     float compass_dim = 0.0f;
     std::unique_ptr<RoomGenerator> room_manager;
+    // scratch cells of the oracle
+    std::vector<bool> is_spike;
 
     Jumper()
         : BasicAbstractGame(NAME) {
@@ -246,6 +248,11 @@ class Jumper : public BasicAbstractGame {
         }
     }
 
+    bool supports_batched_render() override {
+        // the compass is painted with shapes that a sprite batch can't hold
+        return options.distribution_mode == MemoryMode;
+    }
+
     bool will_reflect(int src, int target) override {
         return BasicAbstractGame::will_reflect(src, target);
     }
@@ -497,6 +504,66 @@ class Jumper : public BasicAbstractGame {
         action_vrot = 0;
     }
 
+    // distance to the goal through open cells, ignoring gravity like coinrun
+    bool get_goal_cells(std::vector<int> &goal_cells) override {
+        goal_cells.push_back(to_grid_idx(int(goal->x), int(goal->y)));
+        return true;
+    }
+
+    bool is_goal_path_cell(int idx) override {
+        return !is_wall(get_obj(idx));
+    }
+
+    // follow the shortest route to the goal around the spikes, jumping whenever the route climbs
+    // or a wall is in the way
+    int oracle_action() override {
+        is_spike.assign(grid_size, false);
+        mark_entity_cells(SPIKE, 0.0f, is_spike);
+
+        int goal_idx = to_grid_idx(int(goal->x), int(goal->y));
+        auto reached_goal = [&](int idx) { return idx == goal_idx; };
+
+        std::vector<int> &path = oracle_path;
+        find_grid_path(
+            get_agent_index(), reached_goal, [&](int idx) { return !is_wall(get_obj(idx)) && !is_spike[idx]; }, path);
+
+        if (path.empty()) {
+            find_grid_path(
+                get_agent_index(), reached_goal, [&](int idx) { return !is_wall(get_obj(idx)); }, path);
+        }
+
+        if (path.size() < 2) {
+            return default_action;
+        }
+
+        int ax, ay;
+        to_grid_xy(path[0], &ax, &ay);
+
+        bool should_jump = false;
+        int lookahead = std::min((int)(path.size()) - 1, 3);
+        for (int i = 1; i <= lookahead; i++) {
+            int x, y;
+            to_grid_xy(path[i], &x, &y);
+            should_jump = should_jump || y > ay;
+        }
+
+        int wx, wy;
+        to_grid_xy(path[1], &wx, &wy);
+
+        int dx = 0;
+        if (wx + .5f - agent->x > .2f) {
+            dx = 1;
+        } else if (agent->x - (wx + .5f) > .2f) {
+            dx = -1;
+        }
+
+        if (dx != 0 && is_wall(get_obj(int(agent->x + dx * (agent->rx + .1f)), int(agent->y)))) {
+            should_jump = true;
+        }
+
+        return (dx + 1) * 3 + (should_jump ? 2 : 1);
+    }
+
     void game_step() override {
         BasicAbstractGame::game_step();
 
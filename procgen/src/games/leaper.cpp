@@ -1,5 +1,6 @@
 #include "../basic-abstract-game.h"
 #include "../qt-utils.h"
+#include <algorithm>
 
 const std::string NAME = "leaper";
 
@@ -83,6 +84,22 @@ The episode ends if any one of the following conditions is met:
 
 */
 
+/*
+    Cars and logs are kept in their lanes instead of in entities. Everything in a lane moves at the
+    lane speed, so a lane stays sorted by spawn order and by position, and the agent only has to be
+    checked against the few entities of the lanes it overlaps.
+
+    Entities in different lanes can never overlap, so a lane only needs to be checked against
+    itself when spawning.
+*/
+struct TrafficLane {
+    float speed = 0.0f;
+    // ordered by spawn_ids, oldest first, which is also the order of decreasing distance traveled
+    std::vector<std::shared_ptr<Entity>> ents;
+    // order in which the entities were spawned across all lanes, only used for serialization
+    std::vector<int> spawn_ids;
+};
+
 class LeaperGame : public BasicAbstractGame {
   public:
     int bottom_road_y = 0;
@@ -91,6 +108,11 @@ class LeaperGame : public BasicAbstractGame {
     std::vector<float> water_lane_speeds;
     int goal_y = 0;
 
+    std::vector<TrafficLane> road_lanes;
+    std::vector<TrafficLane> water_lanes;
+    int next_spawn_id = 0;
+    int finish_line_spawn_id = 0;
+
     LeaperGame()
         : BasicAbstractGame(NAME) {
         maxspeed = MAX_SPEED;
@@ -232,15 +254,104 @@ class LeaperGame : public BasicAbstractGame {
 
         goal_y = bottom_water_y + num_water_lanes + 1;
 
+        init_lanes();
+
         // spawn initial entities
         for (int i = 0; i < main_width / std::min(min_car_speed, min_log_speed); i++) {
             spawn_entities();
             step_entities(entities);
+            step_lanes();
         }
 
+        finish_line_spawn_id = next_spawn_id;
         add_entity_rxy(main_width / 2.0, goal_y - .5, 0, 0, main_width / 2.0, .5, FINISH_LINE);
     }
 
+    void init_lanes() {
+        road_lanes.clear();
+        road_lanes.resize(road_lane_speeds.size());
+        for (size_t lane = 0; lane < road_lanes.size(); lane++) {
+            road_lanes[lane].speed = road_lane_speeds[lane];
+        }
+
+        water_lanes.clear();
+        water_lanes.resize(water_lane_speeds.size());
+        for (size_t lane = 0; lane < water_lanes.size(); lane++) {
+            water_lanes[lane].speed = water_lane_speeds[lane];
+        }
+
+        next_spawn_id = 0;
+    }
+
+    // returns the range of entities in the lane whose x is within dist of the given x, possibly with a few extra entities
+    std::pair<int, int> find_lane_range(const TrafficLane &lane, float x, float dist) {
+        // widened so that rounding never excludes an entity that an exact collision check would include
+        float x_min = x - dist - 1;
+        float x_max = x + dist + 1;
+        auto begin = lane.ents.begin();
+        auto end = lane.ents.end();
+
+        if (lane.speed > 0) {
+            // the oldest entities have traveled furthest to the right
+            begin = std::partition_point(begin, end, [&](const std::shared_ptr<Entity> &e) { return e->x >= x_max; });
+            end = std::partition_point(begin, end, [&](const std::shared_ptr<Entity> &e) { return e->x > x_min; });
+        } else {
+            begin = std::partition_point(begin, end, [&](const std::shared_ptr<Entity> &e) { return e->x <= x_min; });
+            end = std::partition_point(begin, end, [&](const std::shared_ptr<Entity> &e) { return e->x < x_max; });
+        }
+
+        return std::make_pair(int(begin - lane.ents.begin()), int(end - lane.ents.begin()));
+    }
+
+    // returns an entity in the lane that collides with e1, or nullptr if there is none
+    std::shared_ptr<Entity> find_lane_collision(const TrafficLane &lane, const std::shared_ptr<Entity> &e1, float margin) {
+        // cars are the widest entities in any lane
+        auto range = find_lane_range(lane, e1->x, e1->rx + 2 * MONSTER_RADIUS + fabs(margin));
+        for (int i = range.first; i < range.second; i++) {
+            if (has_collision(e1, lane.ents[i], margin)) {
+                return lane.ents[i];
+            }
+        }
+        return nullptr;
+    }
+
+    void add_to_lane(TrafficLane &lane, const std::shared_ptr<Entity> &m) {
+        lane.ents.push_back(m);
+        lane.spawn_ids.push_back(next_spawn_id);
+        next_spawn_id++;
+    }
+
+    // lanes whose entities could overlap an entity at y with vertical radius ry
+    std::pair<int, int> lanes_near(int bottom_y, int num_lanes, float y, float ry) {
+        int low = std::max(int(floor(y - ry)) - 1 - bottom_y, 0);
+        int high = std::min(int(floor(y + ry)) + 1 - bottom_y, num_lanes - 1);
+        return std::make_pair(low, high);
+    }
+
+    void step_lanes() {
+        for (auto lanes : {&road_lanes, &water_lanes}) {
+            for (auto &lane : *lanes) {
+                for (const auto &m : lane.ents) {
+                    m->step();
+                }
+            }
+        }
+    }
+
+    void erase_lanes_if_needed() {
+        for (auto lanes : {&road_lanes, &water_lanes}) {
+            for (auto &lane : *lanes) {
+                // the oldest entity is always the first to leave the screen
+                int num_erased = 0;
+                while (num_erased < int(lane.ents.size()) && is_out_of_bounds(lane.ents[num_erased])) {
+                    num_erased++;
+                }
+                lane.ents.erase(lane.ents.begin(), lane.ents.begin() + num_erased);
+                lane.spawn_ids.erase(lane.spawn_ids.begin(), lane.spawn_ids.begin() + num_erased);
+            }
+        }
+    }
+
     void spawn_entities() {
         // cars
         for (int lane = 0; lane < int(road_lane_speeds.size()); lane++) {
@@ -248,13 +359,13 @@ class LeaperGame : public BasicAbstractGame {
             float spawn_prob = fabs(speed) / 6.0;
             if (rand_gen.rand01() < spawn_prob) {
                 float x = speed > 0 ? (-1 * MONSTER_RADIUS) : (main_width + MONSTER_RADIUS);
-                auto m = std::make_shared<Entity>(x, bottom_road_y + lane + 0.5, speed, 0, 2 * MONSTER_RADIUS, MONSTER_RADIUS, CAR);
+                auto m = arena_make_shared<Entity>(arena, x, bottom_road_y + lane + 0.5, speed, 0, 2 * MONSTER_RADIUS, MONSTER_RADIUS, CAR);
                 choose_random_theme(m);
                 if (speed < 0) {
                     m->rotation = PI;
                 }
-                if (!has_any_collision(m)) {
-                    entities.push_back(m);
+                if (!has_any_collision(m) && find_lane_collision(road_lanes[lane], m, 0) == nullptr) {
+                    add_to_lane(road_lanes[lane], m);
                 }
             }
         }
@@ -265,14 +376,22 @@ class LeaperGame : public BasicAbstractGame {
             float spawn_prob = fabs(speed) / 2.0;
             if (rand_gen.rand01() < spawn_prob) {
                 float x = speed > 0 ? (-1 * LOG_RADIUS) : (main_width + LOG_RADIUS);
-                auto m = std::make_shared<Entity>(x, bottom_water_y + lane + 0.5, speed, 0, LOG_RADIUS, LOG);
-                if (!has_any_collision(m)) {
-                    entities.push_back(m);
+                auto m = arena_make_shared<Entity>(arena, x, bottom_water_y + lane + 0.5, speed, 0, LOG_RADIUS, LOG);
+                if (!has_any_collision(m) && find_lane_collision(water_lanes[lane], m, 0) == nullptr) {
+                    add_to_lane(water_lanes[lane], m);
                 }
             }
         }
     }
 
+    void draw_extra_entities(QPainter &p, int render_z) override {
+        for (auto lanes : {&road_lanes, &water_lanes}) {
+            for (const auto &lane : *lanes) {
+                draw_entities(p, lane.ents, render_z);
+            }
+        }
+    }
+
     void decay_vel(float &vel) {
         float vel_sign = sign(1.0 * vel);
         vel = (fabs(vel) - VEL_DECAY);
@@ -313,16 +432,29 @@ class LeaperGame : public BasicAbstractGame {
 
         BasicAbstractGame::game_step();
 
+        step_lanes();
+
+        auto car_lanes = lanes_near(bottom_road_y, int(road_lanes.size()), agent->y, agent->ry);
+        for (int lane = car_lanes.first; lane <= car_lanes.second; lane++) {
+            auto car = find_lane_collision(road_lanes[lane], agent, 0);
+            if (car != nullptr) {
+                handle_agent_collision(car);
+            }
+        }
+
+        erase_lanes_if_needed();
+
         spawn_entities();
 
         bool standing_on_log = false;
         float log_vx = 0.0;
         float margin = -1 * agent->rx;
-        for (auto &m : entities) {
-            if (m->type == LOG && has_collision(agent, m, margin)) {
+        auto log_lanes = lanes_near(bottom_water_y, int(water_lanes.size()), agent->y, agent->ry);
+        for (int lane = log_lanes.first; lane <= log_lanes.second; lane++) {
+            if (find_lane_collision(water_lanes[lane], agent, margin) != nullptr) {
                 // we're standing on a log, don't die
                 standing_on_log = true;
-                log_vx = m->vx;
+                log_vx = water_lanes[lane].speed;
             }
         }
 
@@ -341,8 +473,60 @@ class LeaperGame : public BasicAbstractGame {
         }
     }
 
+    // the state format predates traffic lanes, so cars and logs are saved as part of entities,
+    // in the order they would have been added to it
+    std::vector<std::shared_ptr<Entity>> entities_with_traffic() {
+        std::vector<std::pair<int, std::shared_ptr<Entity>>> traffic;
+        for (auto lanes : {&road_lanes, &water_lanes}) {
+            for (const auto &lane : *lanes) {
+                for (size_t i = 0; i < lane.ents.size(); i++) {
+                    traffic.push_back(std::make_pair(lane.spawn_ids[i], lane.ents[i]));
+                }
+            }
+        }
+        std::sort(traffic.begin(), traffic.end(), [](const std::pair<int, std::shared_ptr<Entity>> &a, const std::pair<int, std::shared_ptr<Entity>> &b) { return a.first < b.first; });
+
+        std::vector<std::shared_ptr<Entity>> result;
+        size_t next_traffic = 0;
+        for (const auto &e : entities) {
+            if (e->type == FINISH_LINE) {
+                while (next_traffic < traffic.size() && traffic[next_traffic].first < finish_line_spawn_id) {
+                    result.push_back(traffic[next_traffic++].second);
+                }
+            }
+            result.push_back(e);
+        }
+        while (next_traffic < traffic.size()) {
+            result.push_back(traffic[next_traffic++].second);
+        }
+        return result;
+    }
+
+    void move_traffic_to_lanes() {
+        init_lanes();
+
+        std::vector<std::shared_ptr<Entity>> remaining;
+        for (const auto &e : entities) {
+            if (e->type == CAR) {
+                add_to_lane(road_lanes[int(e->y) - bottom_road_y], e);
+            } else if (e->type == LOG) {
+                add_to_lane(water_lanes[int(e->y) - bottom_water_y], e);
+            } else {
+                if (e->type == FINISH_LINE) {
+                    finish_line_spawn_id = next_spawn_id;
+                }
+                remaining.push_back(e);
+            }
+        }
+        entities = remaining;
+    }
+
     void serialize(WriteBuffer *b) override {
+        std::vector<std::shared_ptr<Entity>> lane_free_entities = entities;
+        entities = entities_with_traffic();
         BasicAbstractGame::serialize(b);
+        entities = lane_free_entities;
+
         b->write_int(bottom_road_y);
         b->write_vector_float(road_lane_speeds);
         b->write_int(bottom_water_y);
@@ -357,6 +541,8 @@ class LeaperGame : public BasicAbstractGame {
         bottom_water_y = b->read_int();
         water_lane_speeds = b->read_vector_float();
         goal_y = b->read_int();
+
+        move_traffic_to_lanes();
     }
 };
 
@@ -104,6 +104,9 @@ class MazeGame : public BasicAbstractGame {
             world_dim = 31;
         }
 
+        // keep the dimension odd so the maze still fits with a wall on each side
+        world_dim = (world_dim - 1) * options.world_scale + 1;
+
         main_width = world_dim;
         main_height = world_dim;
     }
@@ -178,6 +181,25 @@ class MazeGame : public BasicAbstractGame {
         step_data.done = step_data.reward > 0;
     }
 
+    bool get_goal_cells(std::vector<int> &goal_cells) override {
+        goal_cells = get_cells_with_type(GOAL);
+        return true;
+    }
+
+    int oracle_action() override {
+        std::vector<int> &path = oracle_path;
+        find_grid_path(
+            get_agent_index(), [&](int idx) { return get_obj(idx) == GOAL; }, [&](int idx) { return get_obj(idx) != WALL_OBJ; }, path);
+
+        if (path.size() < 2) {
+            return default_action;
+        }
+
+        int x, y;
+        to_grid_xy(path[1], &x, &y);
+        return move_action_toward(x + .5f, y + .5f, .1f);
+    }
+
     void serialize(WriteBuffer *b) override {
         BasicAbstractGame::serialize(b);
         b->write_int(maze_dim);
@@ -191,6 +191,11 @@ class Ninja : public BasicAbstractGame {
         return 0;
     }
 
+    bool get_collision_target_types(int src_type, std::vector<int> &target_types) override {
+        // throwing stars don't interact with other entities
+        return true;
+    }
+
     bool use_block_asset(int type) override {
         return BasicAbstractGame::use_block_asset(type) || is_wall(type);
     }
@@ -230,7 +235,7 @@ class Ninja : public BasicAbstractGame {
         float bar_height = 3 * jump_charge;
 
         QRectF dist_rect2 = get_abs_rect(.25, visibility - .5 - bar_height, .5, bar_height);
-        p.fillRect(dist_rect2, charge_color);
+        fill_rect(p, dist_rect2, charge_color);
     }
 
     void fill_block_top(int x, int y, int dx, int dy, char fill, char top) {
@@ -267,7 +272,7 @@ class Ninja : public BasicAbstractGame {
         float bomb_prob = .25 * (difficulty - 1);
         int max_gap_inc = difficulty == 1 ? 1 : 2;
 
-        int num_sections = rand_gen.randn(difficulty) + difficulty;
+        int num_sections = (rand_gen.randn(difficulty) + difficulty) * options.world_scale;
         int start_x = 5;
         int curr_x = start_x;
         int curr_y = main_height / 2;
@@ -363,6 +368,11 @@ class Ninja : public BasicAbstractGame {
         fill_elem(curr_x + 1, 0, main_width - curr_x - 1, main_height, WALL_MID);
     }
 
+    void choose_world_dim() override {
+        main_width = 64 * options.world_scale;
+        main_height = 64;
+    }
+
     void game_reset() override {
         BasicAbstractGame::game_reset();
 
@@ -91,6 +91,7 @@ class PlunderGame : public BasicAbstractGame {
     float spawn_prob = 0.0f;
     float legend_r = 0.0f;
     float min_agent_x = 0.0f;
+    int juice_left_info;
 
     PlunderGame()
         : BasicAbstractGame(NAME) {
@@ -102,6 +103,8 @@ class PlunderGame : public BasicAbstractGame {
         mixrate = .5;
         maxspeed = 0.85f;
         has_useful_vel_info = false;
+
+        juice_left_info = add_info_field("juice_left", LIBENV_DTYPE_FLOAT32);
     }
 
     void load_background_images() override {
@@ -132,10 +135,10 @@ class PlunderGame : public BasicAbstractGame {
         QColor progress_color = QColor(245, 66, 144);
 
         QRectF dist_rect1 = get_abs_rect(.25, .25, main_width * juice_left, .5);
-        p.fillRect(dist_rect1, juice_color);
+        fill_rect(p, dist_rect1, juice_color);
 
         QRectF dist_rect2 = get_abs_rect(.25, .75, main_width * (targets_hit * 1.0 / target_quota), .5);
-        p.fillRect(dist_rect2, progress_color);
+        fill_rect(p, dist_rect2, progress_color);
     }
 
     bool is_target(int theme_num) {
@@ -146,6 +149,13 @@ class PlunderGame : public BasicAbstractGame {
         return type == SHIP;
     }
 
+    bool get_collision_target_types(int src_type, std::vector<int> &target_types) override {
+        if (src_type == PLAYER_BULLET) {
+            target_types = {SHIP, PANEL};
+        }
+        return true;
+    }
+
     void handle_collision(const std::shared_ptr<Entity> &src, const std::shared_ptr<Entity> &target) override {
         if (src->type == PLAYER_BULLET) {
             if (target->type == SHIP) {
@@ -175,6 +185,11 @@ class PlunderGame : public BasicAbstractGame {
         action_vrot = 0;
     }
 
+    void observe() override {
+        BasicAbstractGame::observe();
+        set_info(juice_left_info, juice_left);
+    }
+
     void game_reset() override {
         BasicAbstractGame::game_reset();
 
@@ -264,7 +279,7 @@ class PlunderGame : public BasicAbstractGame {
             float ent_y = (lane * .11 + .4) * (main_height / 2 - ent_r) + main_height / 2;
             float moves_right = lane_directions[lane];
             float ent_vx = lane_vels[lane] * (moves_right ? 1 : -1);
-            auto ent = std::make_shared<Entity>(0, ent_y, ent_vx, 0, ent_r, SHIP);
+            auto ent = arena_make_shared<Entity>(arena, 0, ent_y, ent_vx, 0, ent_r, SHIP);
             ent->image_type = SHIP;
             ent->image_theme = image_permutation[rand_gen.randn(num_current_ship_types)];
             match_aspect_ratio(ent);
@@ -25,8 +25,28 @@ const int SHOOTER_WIN_TIME = 500;
 const int NUM_BASIC_OBJECTS = 9;
 const int NUM_SHIP_THEMES = 7;
 
-bool spawn_cmp(const std::shared_ptr<Entity> &x, const std::shared_ptr<Entity> &y) {
-    return (x->spawn_time > y->spawn_time);
+// an enemy that has not appeared yet, it only becomes an entity at spawn_time
+struct SpawnEvent {
+    float x;
+    float y;
+    float vx;
+    float vy;
+    float rx;
+    float ry;
+    float health;
+    float rotation;
+    int type;
+    int image_theme;
+    int render_z;
+    int fire_time;
+    int spawn_time;
+};
+
+// bytes taken by each serialized SpawnEvent
+const int SPAWN_EVENT_SIZE = 8 * sizeof(float) + 5 * sizeof(int);
+
+bool spawn_cmp(const SpawnEvent &x, const SpawnEvent &y) {
+    return (x.spawn_time > y.spawn_time);
 }
 
 /**
@@ -92,7 +112,8 @@ The episode ends if any one of the following conditions is met:
 
 class StarPilotGame : public BasicAbstractGame {
   public:
-    std::vector<std::shared_ptr<Entity>> spawners;
+    // sorted by decreasing spawn_time, so the next enemy to appear is at the back
+    std::vector<SpawnEvent> spawners;
 
     float hp_vs[NUM_BASIC_OBJECTS] = {};
     float hp_healths[NUM_BASIC_OBJECTS] = {};
@@ -170,7 +191,7 @@ class StarPilotGame : public BasicAbstractGame {
 
         QColor bg_color = QColor(0, 0, 0);
 
-        p.fillRect(rect, bg_color);
+        fill_rect(p, rect, bg_color);
 
         if (options.use_backgrounds) {
             float bg_k = 3;
@@ -205,6 +226,13 @@ class StarPilotGame : public BasicAbstractGame {
         }
     }
 
+    bool get_collision_target_types(int src_type, std::vector<int> &target_types) override {
+        if (src_type == BULLET_PLAYER) {
+            target_types = {FLYER, FAST_FLYER, TURRET, METEOR};
+        }
+        return true;
+    }
+
     void init_hps() {
         float scale = 1;
 
@@ -362,22 +390,32 @@ class StarPilotGame : public BasicAbstractGame {
                     vx *= -1;
                 }
 
-                auto spawner = std::make_shared<Entity>(x_pos, y_pos, vx, vy, r, type);
-                spawner->fire_time = fire_time;
-                spawner->spawn_time = spawn_time;
-                spawner->health = health;
+                SpawnEvent spawner;
+                spawner.x = x_pos;
+                spawner.y = y_pos;
+                spawner.vx = vx;
+                spawner.vy = vy;
+                spawner.rx = r;
+                spawner.ry = r;
+                spawner.health = health;
+                spawner.rotation = 0;
+                spawner.type = type;
+                spawner.image_theme = 0;
+                spawner.render_z = 0;
+                spawner.fire_time = fire_time;
+                spawner.spawn_time = spawn_time;
 
                 if (type == CLOUD) {
-                    spawner->render_z = 1;
-                    choose_random_theme(spawner);
+                    spawner.render_z = 1;
+                    spawner.image_theme = choose_random_theme_for_type(type);
                 } else if (type == METEOR) {
-                    choose_random_theme(spawner);
+                    spawner.image_theme = choose_random_theme_for_type(type);
                 } else if (type == FLYER || type == FAST_FLYER) {
-                    spawner->image_theme = flyer_theme;
-                    spawner->rotation = ((vx > 0) ? -1 : 1) * PI / 2;
+                    spawner.image_theme = flyer_theme;
+                    spawner.rotation = ((vx > 0) ? -1 : 1) * PI / 2;
                 } else if (type == TURRET) {
-                    choose_random_theme(spawner);
-                    match_aspect_ratio(spawner);
+                    spawner.image_theme = choose_random_theme_for_type(type);
+                    spawner.ry = spawner.rx / get_asset_aspect_ratio(type, spawner.image_theme);
                 }
 
                 spawners.push_back(spawner);
@@ -404,6 +442,17 @@ class StarPilotGame : public BasicAbstractGame {
         choose_random_theme(agent);
     }
 
+    std::shared_ptr<Entity> make_spawned_entity(const SpawnEvent &spawner) {
+        auto e = arena_make_shared<Entity>(arena, spawner.x, spawner.y, spawner.vx, spawner.vy, spawner.rx, spawner.ry, spawner.type);
+        e->health = spawner.health;
+        e->rotation = spawner.rotation;
+        e->image_theme = spawner.image_theme;
+        e->render_z = spawner.render_z;
+        e->fire_time = spawner.fire_time;
+        e->spawn_time = spawner.spawn_time;
+        return e;
+    }
+
     bool is_lethal(const std::shared_ptr<Entity> &e1) {
         int type = e1->type;
 
@@ -446,7 +495,7 @@ class StarPilotGame : public BasicAbstractGame {
                 b_vx = b_vx * bv_scale;
                 b_vy = b_vy * bv_scale;
 
-                std::shared_ptr<Entity> new_bullet(new Entity(m->x, m->y, b_vx, b_vy, bullet_r, bullet_type));
+                auto new_bullet = arena_make_shared<Entity>(arena, m->x, m->y, b_vx, b_vy, bullet_r, bullet_type);
                 new_bullet->face_direction(b_vx, b_vy, -1 * PI / 2);
                 entities.push_back(new_bullet);
             }
@@ -459,8 +508,8 @@ class StarPilotGame : public BasicAbstractGame {
             }
         }
 
-        while (spawners.size() > 0 && cur_time == spawners[int(spawners.size()) - 1]->spawn_time) {
-            entities.push_back(spawners[int(spawners.size()) - 1]);
+        while (spawners.size() > 0 && cur_time == spawners.back().spawn_time) {
+            entities.push_back(make_spawned_entity(spawners.back()));
             spawners.pop_back();
         }
 
@@ -474,7 +523,7 @@ class StarPilotGame : public BasicAbstractGame {
             float vy = sin(theta) * v_scale;
             float x_off = agent->rx * cos(theta);
 
-            auto bullet = std::make_shared<Entity>(agent->x + x_off, agent->y, vx, vy, bullet_r, BULLET_PLAYER);
+            auto bullet = arena_make_shared<Entity>(arena, agent->x + x_off, agent->y, vx, vy, bullet_r, BULLET_PLAYER);
             bullet->collides_with_entities = true;
             bullet->face_direction(vx, vy);
             bullet->rotation -= PI / 2;
@@ -482,7 +531,7 @@ class StarPilotGame : public BasicAbstractGame {
         }
 
         if (cur_time == SHOOTER_WIN_TIME) {
-            auto finish = std::make_shared<Entity>(main_width, main_height / 2, -1 * hp_slow_v * V_SCALE, 0, 2, main_height / 2, FINISH_LINE);
+            auto finish = arena_make_shared<Entity>(arena, main_width, main_height / 2, -1 * hp_slow_v * V_SCALE, 0, 2, main_height / 2, FINISH_LINE);
             choose_random_theme(finish);
             match_aspect_ratio(finish, false);
             finish->x = main_width + finish->rx;
@@ -492,12 +541,44 @@ class StarPilotGame : public BasicAbstractGame {
 
     void serialize(WriteBuffer *b) override {
         BasicAbstractGame::serialize(b);
-        write_entities(b, spawners);
+        b->write_int(spawners.size());
+        for (const auto &spawner : spawners) {
+            b->write_float(spawner.x);
+            b->write_float(spawner.y);
+            b->write_float(spawner.vx);
+            b->write_float(spawner.vy);
+            b->write_float(spawner.rx);
+            b->write_float(spawner.ry);
+            b->write_float(spawner.health);
+            b->write_float(spawner.rotation);
+            b->write_int(spawner.type);
+            b->write_int(spawner.image_theme);
+            b->write_int(spawner.render_z);
+            b->write_int(spawner.fire_time);
+            b->write_int(spawner.spawn_time);
+        }
     }
 
     void deserialize(ReadBuffer *b) override {
         BasicAbstractGame::deserialize(b);
-        read_entities(b, spawners);
+        int num_spawners = b->read_int();
+        fassert(num_spawners >= 0 && (size_t)num_spawners <= (b->length - b->offset) / SPAWN_EVENT_SIZE);
+        spawners.resize(num_spawners);
+        for (auto &spawner : spawners) {
+            spawner.x = b->read_float();
+            spawner.y = b->read_float();
+            spawner.vx = b->read_float();
+            spawner.vy = b->read_float();
+            spawner.rx = b->read_float();
+            spawner.ry = b->read_float();
+            spawner.health = b->read_float();
+            spawner.rotation = b->read_float();
+            spawner.type = b->read_int();
+            spawner.image_theme = b->read_int();
+            spawner.render_z = b->read_int();
+            spawner.fire_time = b->read_int();
+            spawner.spawn_time = b->read_int();
+        }
 
         init_hps();
     }
@@ -4,29 +4,61 @@
 
 Simple utility class for managing a grid of objects
 
+Grids of up to GRID_DENSE_MAX_CELLS cells, which includes every world at world_scale=1, store
+all of their cells in one array.  Larger grids are split into square chunks that only store their
+cells once they stop being uniform, so large worlds that are mostly walls or empty space don't
+need memory for every cell.
+
+Cells are allocated from the arena set with set_arena, so that a game's grid lives in the same arena
+as the game.
+
 */
 
+#include <algorithm>
+#include <cstdint>
 #include <vector>
 #include "cpp-utils.h"
 #include "buffer.h"
+#include "arena.h"
+
+const int GRID_CHUNK_SHIFT = 4;
+const int GRID_CHUNK_DIM = 1 << GRID_CHUNK_SHIFT;
+const int GRID_CHUNK_MASK = GRID_CHUNK_DIM - 1;
+const int GRID_DENSE_MAX_CELLS = 1 << 16;
 
 template <typename T>
 class Grid {
   public:
     int w;
     int h;
-    std::vector<T> data;
 
     Grid() {
         w = 0;
         h = 0;
+        chunks_w = 0;
+        chunks_h = 0;
+    }
+
+    // cells allocated after this come from arena, or from the heap if it is null
+    void set_arena(std::shared_ptr<Arena> _arena) {
+        arena = std::move(_arena);
     }
 
     void resize(int width, int height) {
         w = width;
         h = height;
-        data.clear();
-        data.resize(width * height);
+        cells = CellVector(ArenaAllocator<T>(arena));
+        chunks.clear();
+        sparse = (int64_t)width * height > GRID_DENSE_MAX_CELLS;
+        if (sparse) {
+            chunks_w = (width + GRID_CHUNK_MASK) >> GRID_CHUNK_SHIFT;
+            chunks_h = (height + GRID_CHUNK_MASK) >> GRID_CHUNK_SHIFT;
+            chunks.resize(chunks_w * chunks_h);
+        } else {
+            chunks_w = 0;
+            chunks_h = 0;
+            cells.resize(width * height);
+        }
     }
 
     bool contains(int x, int y) const {
@@ -38,13 +70,23 @@ class Grid {
     };
 
     T get(int x, int y) const {
-        fassert(contains(x, y));
-        return data[y * w + x];
+        fassert_hot(contains(x, y));
+        if (!sparse) {
+            return cells[y * w + x];
+        }
+        const Chunk &chunk = chunks[chunk_index(x, y)];
+        if (chunk.cells.empty()) {
+            return chunk.uniform_value;
+        }
+        return chunk.cells[cell_index(x, y)];
     };
 
     T get_index(int index) const {
-        fassert(0 <= index && index < w * h);
-        return data[index];
+        fassert_hot(0 <= index && index < w * h);
+        if (!sparse) {
+            return cells[index];
+        }
+        return get(index % w, index / w);
     };
 
     int to_index(int x, int y) const {
@@ -57,24 +99,121 @@ class Grid {
     };
 
     void set(int x, int y, T v) {
-        fassert(contains(x, y));
-        data[y * w + x] = v;
+        fassert_hot(contains(x, y));
+        if (!sparse) {
+            cells[y * w + x] = v;
+            return;
+        }
+        Chunk &chunk = chunks[chunk_index(x, y)];
+        if (chunk.cells.empty()) {
+            if (chunk.uniform_value == v) {
+                return;
+            }
+            chunk.cells = CellVector(GRID_CHUNK_DIM * GRID_CHUNK_DIM, chunk.uniform_value, ArenaAllocator<T>(arena));
+        }
+        chunk.cells[cell_index(x, y)] = v;
     };
 
     void set_index(int index, T v) {
-        fassert(index < w * h);
-        data[index] = v;
+        fassert_hot(0 <= index && index < w * h);
+        if (!sparse) {
+            cells[index] = v;
+            return;
+        }
+        set(index % w, index / w, v);
     };
 
+    // cells are written chunk by chunk, with chunks whose cells all have the same value written as that value, so
+    // that large worlds that are mostly uniform have small states
+    // the format only depends on the values of the cells, not on how they are stored or the order they were set in
     void serialize(WriteBuffer *b) {
         b->write_int(w);
         b->write_int(h);
-        b->write_vector_int(data);
+        int num_chunks_x = (w + GRID_CHUNK_MASK) >> GRID_CHUNK_SHIFT;
+        int num_chunks_y = (h + GRID_CHUNK_MASK) >> GRID_CHUNK_SHIFT;
+        for (int cy = 0; cy < num_chunks_y; cy++) {
+            for (int cx = 0; cx < num_chunks_x; cx++) {
+                int x0 = cx << GRID_CHUNK_SHIFT;
+                int y0 = cy << GRID_CHUNK_SHIFT;
+                int x1 = std::min(x0 + GRID_CHUNK_DIM, w);
+                int y1 = std::min(y0 + GRID_CHUNK_DIM, h);
+
+                T first = get(x0, y0);
+                bool uniform = true;
+                for (int y = y0; y < y1 && uniform; y++) {
+                    for (int x = x0; x < x1; x++) {
+                        if (get(x, y) != first) {
+                            uniform = false;
+                            break;
+                        }
+                    }
+                }
+
+                b->write_int(uniform ? 1 : 0);
+                if (uniform) {
+                    b->write_int(first);
+                    continue;
+                }
+                for (int y = y0; y < y1; y++) {
+                    for (int x = x0; x < x1; x++) {
+                        b->write_int(get(x, y));
+                    }
+                }
+            }
+        }
     };
 
     void deserialize(ReadBuffer *b) {
-        w = b->read_int();
-        h = b->read_int();
-        data = b->read_vector_int();
+        int width = b->read_int();
+        int height = b->read_int();
+        // each chunk takes at least two ints, which bounds the size of the grid by the size of the buffer
+        fassert(width > 0 && height > 0);
+        int64_t num_chunks_x = ((int64_t)(width) + GRID_CHUNK_MASK) >> GRID_CHUNK_SHIFT;
+        int64_t num_chunks_y = ((int64_t)(height) + GRID_CHUNK_MASK) >> GRID_CHUNK_SHIFT;
+        fassert(num_chunks_x * num_chunks_y <= (int64_t)((b->length - b->offset) / (2 * sizeof(int))));
+        resize(width, height);
+        int num_chunks_w = (int)(num_chunks_x);
+        int num_chunks_h = (int)(num_chunks_y);
+        for (int cy = 0; cy < num_chunks_h; cy++) {
+            for (int cx = 0; cx < num_chunks_w; cx++) {
+                int x0 = cx << GRID_CHUNK_SHIFT;
+                int y0 = cy << GRID_CHUNK_SHIFT;
+                int x1 = std::min(x0 + GRID_CHUNK_DIM, w);
+                int y1 = std::min(y0 + GRID_CHUNK_DIM, h);
+
+                bool uniform = b->read_int() != 0;
+                T value = uniform ? b->read_int() : T();
+                for (int y = y0; y < y1; y++) {
+                    for (int x = x0; x < x1; x++) {
+                        set(x, y, uniform ? value : b->read_int());
+                    }
+                }
+            }
+        }
     };
+
+  private:
+    typedef std::vector<T, ArenaAllocator<T>> CellVector;
+
+    struct Chunk {
+        // cells is empty while every cell of the chunk has uniform_value
+        T uniform_value = T();
+        CellVector cells;
+    };
+
+    std::shared_ptr<Arena> arena;
+    bool sparse = false;
+    // every cell of a dense grid
+    CellVector cells;
+    int chunks_w;
+    int chunks_h;
+    std::vector<Chunk> chunks;
+
+    int chunk_index(int x, int y) const {
+        return (y >> GRID_CHUNK_SHIFT) * chunks_w + (x >> GRID_CHUNK_SHIFT);
+    }
+
+    int cell_index(int x, int y) const {
+        return ((y & GRID_CHUNK_MASK) << GRID_CHUNK_SHIFT) + (x & GRID_CHUNK_MASK);
+    }
 };
@@ -9,18 +9,61 @@ struct Wall {
     int y2;
 };
 
+// counts of the walls that have not been drawn yet, indexed so that the nth remaining wall can be found in log time
+class RemainingWalls {
+  public:
+    RemainingWalls(int num_walls)
+        : counts(num_walls + 1, 0) {
+        for (int i = 1; i <= num_walls; i++) {
+            counts[i] += 1;
+            int parent = i + (i & -i);
+            if (parent <= num_walls) {
+                counts[parent] += counts[i];
+            }
+        }
+        top_bit = 1;
+        while (top_bit * 2 <= num_walls) {
+            top_bit *= 2;
+        }
+    }
+
+    // remove and return the index of the nth remaining wall
+    int take(int n) {
+        int pos = 0;
+        for (int step = top_bit; step > 0; step /= 2) {
+            if (pos + step < (int)(counts.size()) && counts[pos + step] <= n) {
+                pos += step;
+                n -= counts[pos];
+            }
+        }
+        for (int i = pos + 1; i < (int)(counts.size()); i += i & -i) {
+            counts[i] -= 1;
+        }
+        return pos;
+    }
+
+  private:
+    std::vector<int> counts;
+    int top_bit;
+};
+
 MazeGen::MazeGen(RandGen *_rand_gen, int _maze_dim) {
     rand_gen = _rand_gen;
     maze_dim = _maze_dim;
     array_dim = maze_dim + 2;
-    cell_sets.resize(array_dim * array_dim);
-    cell_sets_idxs.resize(array_dim * array_dim);
+    cell_parents.resize(array_dim * array_dim);
     free_cells.resize(array_dim * array_dim);
     grid.resize(array_dim, array_dim);
 }
 
+// cells are kept in a disjoint set forest, so merging two regions is cheap even for very large mazes
 int MazeGen::lookup(int x, int y) {
-    return cell_sets_idxs[maze_dim * y + x];
+    int cell = maze_dim * y + x;
+    while (cell_parents[cell] != cell) {
+        cell_parents[cell] = cell_parents[cell_parents[cell]];
+        cell = cell_parents[cell];
+    }
+    return cell;
 }
 
 void MazeGen::set_free_cell(int x, int y) {
@@ -123,16 +166,8 @@ void MazeGen::generate_maze() {
     num_free_cells = 0;
     free_cell_set.clear();
 
-    std::set<int> *s0 = &cell_sets[0];
-    s0->clear();
-    s0->insert(0);
-    cell_sets_idxs[0] = 0;
-
-    for (int i = 1; i < maze_dim * maze_dim; i++) {
-        std::set<int> *s1 = &cell_sets[i];
-        s1->clear();
-        s1->insert(i);
-        cell_sets_idxs[i] = i;
+    for (int i = 0; i < maze_dim * maze_dim; i++) {
+        cell_parents[i] = i;
     }
 
     for (int i = 1; i < maze_dim; i += 2) {
@@ -151,18 +186,21 @@ void MazeGen::generate_maze() {
         }
     }
 
-    while (walls.size() > 0) {
-        int n = rand_gen->randn((int)(walls.size()));
-        Wall wall = walls[n];
+    // walls are drawn by their position among the remaining walls, which is
+    // found with a fenwick tree instead of erasing from the middle of the vector
+    int num_walls = (int)(walls.size());
+    RemainingWalls remaining(num_walls);
+
+    for (int num_remaining = num_walls; num_remaining > 0; num_remaining--) {
+        int n = rand_gen->randn(num_remaining);
+        int wall_idx = remaining.take(n);
+        Wall wall = walls[wall_idx];
 
         int s0_idx = lookup(wall.x1, wall.y1);
-        s0 = &cell_sets[s0_idx];
         int s1_idx = lookup(wall.x2, wall.y2);
-        std::set<int> *s1 = &cell_sets[s1_idx];
 
         int x0 = (wall.x1 + wall.x2) / 2;
         int y0 = (wall.y1 + wall.y2) / 2;
-        int center = maze_dim * y0 + x0;
 
         bool can_remove =
             (grid.get(x0 + MAZE_OFFSET, y0 + MAZE_OFFSET) == WALL_OBJ) &&
@@ -173,16 +211,8 @@ void MazeGen::generate_maze() {
             set_free_cell(x0, y0);
             set_free_cell(wall.x2, wall.y2);
 
-            s1->insert(s0->begin(), s0->end());
-            s1->insert(center);
-
-            std::set<int>::iterator it;
-            for (it = s1->begin(); it != s1->end(); ++it) {
-                cell_sets_idxs[*it] = s1_idx;
-            }
+            cell_parents[s0_idx] = s1_idx;
         }
-
-        walls.erase(walls.begin() + n);
     }
 }
 
@@ -29,8 +29,7 @@ class MazeGen {
     int array_dim;
 
     int num_free_cells;
-    std::vector<std::set<int>> cell_sets;
-    std::vector<int> cell_sets_idxs;
+    std::vector<int> cell_parents;
     std::set<int> free_cell_set;
     std::vector<int> free_cells;
 
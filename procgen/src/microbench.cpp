@@ -0,0 +1,469 @@
+/*
+
+Microbenchmarks for the simulation and rendering kernels
+
+Each kernel runs on a fixed input built from a fixed seed, so that timings can be compared between builds.
+After a warmup, the kernel is timed for a number of samples and the percentiles of the time per call
+are reported.  Kernels that are fast compared to the clock are run in batches, and kernels that change
+their input have it restored before each call, outside of the timed region.
+
+    procgen_microbench [--filter substring] [--samples n] [--csv out.csv] [--baseline baseline.csv]
+
+With --baseline, the median of each kernel is compared to the one in a csv file written by an earlier run.
+
+*/
+
+#include "libenv.h"
+#include "vecgame.h"
+#include "basic-abstract-game.h"
+#include "mazegen.h"
+#include "roomgen.h"
+#include "assetgen.h"
+#include "object-ids.h"
+#include "alloc-tracking.h"
+#include "eval-levels.h"
+#include "sprite-batch.h"
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <sstream>
+
+// how long each kernel runs before it is timed, and the shortest time a sample should take
+const double WARMUP_SECONDS = 0.2;
+const double MIN_SAMPLE_SECONDS = 0.0005;
+const int DEFAULT_SAMPLES = 50;
+const int SEED = 1234;
+
+struct Kernel {
+    std::string name;
+    // restores the input of a kernel that changes it, called before every timed call if set
+    std::function<void()> prepare;
+    std::function<void()> run;
+};
+
+struct KernelResult {
+    std::string name;
+    int calls_per_sample = 0;
+    double median_ns = 0;
+    double p10_ns = 0;
+    double p90_ns = 0;
+    double min_ns = 0;
+    double allocs_per_call = 0;
+};
+
+// a single environment stepped once, so that its level has been generated
+struct BenchEnv {
+    libenv_env *handle = nullptr;
+    std::vector<std::vector<char>> ob_data;
+    std::vector<std::vector<char>> info_data;
+    std::vector<void *> ob_ptrs;
+    std::vector<void *> info_ptrs;
+    int32_t action = 0;
+    void *action_ptr = &action;
+    float rew = 0;
+    uint8_t first = 0;
+
+    BenchEnv(const std::string &env_name) {
+        std::string resource_root = PROCGEN_RESOURCE_ROOT;
+        int32_t num_actions = 15;
+        int32_t num_levels = 1;
+        int32_t start_level = SEED;
+        int32_t num_threads = 0;
+        int32_t rand_seed = SEED;
+
+        std::vector<libenv_option> items(7);
+        memset(items.data(), 0, sizeof(libenv_option) * items.size());
+        auto set_option = [&](int i, const char *name, libenv_dtype dtype, int count, const void *data) {
+            strcpy(items[i].name, name);
+            items[i].dtype = dtype;
+            items[i].count = count;
+            items[i].data = (void *)(data);
+        };
+        set_option(0, "env_name", LIBENV_DTYPE_UINT8, (int)(env_name.size()), env_name.data());
+        set_option(1, "resource_root", LIBENV_DTYPE_UINT8, (int)(resource_root.size()), resource_root.data());
+        set_option(2, "num_actions", LIBENV_DTYPE_INT32, 1, &num_actions);
+        set_option(3, "num_levels", LIBENV_DTYPE_INT32, 1, &num_levels);
+        set_option(4, "start_level", LIBENV_DTYPE_INT32, 1, &start_level);
+        set_option(5, "num_threads", LIBENV_DTYPE_INT32, 1, &num_threads);
+        set_option(6, "rand_seed", LIBENV_DTYPE_INT32, 1, &rand_seed);
+        libenv_options options;
+        options.items = items.data();
+        options.count = (int)(items.size());
+        handle = libenv_make(1, options);
+
+        alloc_buffers(LIBENV_SPACE_OBSERVATION, ob_data, ob_ptrs);
+        alloc_buffers(LIBENV_SPACE_INFO, info_data, info_ptrs);
+        libenv_buffers bufs;
+        bufs.ob = ob_ptrs.data();
+        bufs.info = info_ptrs.data();
+        bufs.ac = &action_ptr;
+        bufs.rew = &rew;
+        bufs.first = &first;
+        libenv_set_buffers(handle, &bufs);
+
+        // the first act generates the level
+        libenv_act(handle);
+        libenv_observe(handle);
+    }
+
+    ~BenchEnv() {
+        libenv_close(handle);
+    }
+
+    BasicAbstractGame *game() {
+        return (BasicAbstractGame *)(((VecGame *)(handle))->games[0].get());
+    }
+
+  private:
+    void alloc_buffers(libenv_space_name space, std::vector<std::vector<char>> &data, std::vector<void *> &ptrs) {
+        int count = libenv_get_tensortypes(handle, space, nullptr);
+        std::vector<libenv_tensortype> types(count);
+        libenv_get_tensortypes(handle, space, types.data());
+        for (const auto &type : types) {
+            size_t size = type.dtype == LIBENV_DTYPE_UINT8 ? 1 : 4;
+            for (int d = 0; d < type.ndim; d++) {
+                size *= type.shape[d];
+            }
+            data.emplace_back(size, 0);
+        }
+        for (auto &d : data) {
+            ptrs.push_back(d.data());
+        }
+    }
+};
+
+struct MicroBench {
+    std::vector<std::unique_ptr<BenchEnv>> envs;
+    std::vector<Kernel> kernels;
+
+    BenchEnv *make_env(const std::string &env_name) {
+        envs.push_back(std::make_unique<BenchEnv>(env_name));
+        return envs.back().get();
+    }
+
+    void add_kernel(const std::string &name, std::function<void()> prepare, std::function<void()> run) {
+        kernels.push_back(Kernel{name, prepare, run});
+    }
+
+    void add_step_kernels() {
+        // coinrun has the agent standing on the ground next to walls, so steps collide with the grid
+        auto game = make_env("coinrun")->game();
+        auto agent = game->agent;
+        Entity start = *agent;
+
+        auto restore_agent = [=]() {
+            agent->x = start.x;
+            agent->y = start.y;
+            agent->vx = start.vx;
+            agent->vy = start.vy;
+        };
+
+        add_kernel("sub_step", nullptr, [=]() {
+            restore_agent();
+            game->sub_step(agent, 0.2f, -0.2f, 0);
+        });
+        add_kernel("basic_step_object", nullptr, [=]() {
+            restore_agent();
+            agent->vx = 0.3f;
+            agent->vy = -0.3f;
+            game->basic_step_object(agent);
+        });
+        add_kernel("check_grid_collisions", nullptr, [=]() {
+            game->check_grid_collisions(agent);
+        });
+    }
+
+    void add_draw_kernels() {
+        auto game = make_env("coinrun")->game();
+        auto agent = game->agent;
+        auto img = std::make_shared<QImage>(RES_W, RES_H, QImage::Format_RGB32);
+        auto painter = std::make_shared<QPainter>(img.get());
+        QImage *tile = game->lookup_asset(agent->image_type);
+
+        add_kernel("draw_image", nullptr, [=]() {
+            QRectF rect(8, 8, 24, 24);
+            game->draw_image(*painter, rect, 0.0f, false, agent->image_type, agent->image_theme, 1.0f, 0.0f);
+        });
+        add_kernel("tile_image", nullptr, [=]() {
+            game->tile_image(*painter, tile, QRectF(0, 0, RES_W, RES_H), 0.25f);
+        });
+
+        // a whole observation through QPainter and through a sprite batch holding only that frame
+        auto obs = std::make_shared<std::vector<uint8_t>>(RES_W * RES_H * 3);
+        auto batch = std::make_shared<SpriteBatch>();
+        add_kernel("render_obs", nullptr, [=]() {
+            game->render_obs(obs->data());
+        });
+        add_kernel("render_obs_batched", nullptr, [=]() {
+            game->render_batch = batch.get();
+            game->render_obs(obs->data());
+            game->render_batch = nullptr;
+            batch->flush();
+        });
+    }
+
+    void add_convert_kernels() {
+        for (int res : {RES_W, RENDER_RES}) {
+            auto src = std::make_shared<std::vector<uint32_t>>(res * res);
+            auto dst = std::make_shared<std::vector<uint8_t>>(res * res * 3);
+            RandGen rand_gen;
+            rand_gen.seed(SEED);
+            for (auto &v : *src) {
+                v = (uint32_t)(rand_gen.randint());
+            }
+            add_kernel("bgr32_to_rgb888_" + std::to_string(res), nullptr, [=]() {
+                bgr32_to_rgb888(dst->data(), src->data(), res, res);
+            });
+        }
+    }
+
+    void add_generator_kernels() {
+        auto rand_gen = std::make_shared<RandGen>();
+        rand_gen->seed(SEED);
+        auto state = std::make_shared<std::vector<char>>(1 << 16);
+        add_kernel("RandGen::serialize", nullptr, [=]() {
+            WriteBuffer b(state->data(), state->size());
+            rand_gen->serialize(&b);
+        });
+
+        auto saved = std::make_shared<std::vector<char>>(1 << 16);
+        WriteBuffer saved_b(saved->data(), saved->size());
+        rand_gen->serialize(&saved_b);
+        add_kernel("RandGen::deserialize", nullptr, [=]() {
+            ReadBuffer b(saved->data(), saved->size());
+            rand_gen->deserialize(&b);
+        });
+
+        auto maze_rand_gen = std::make_shared<RandGen>();
+        add_kernel(
+            "MazeGen::generate_maze", [=]() { maze_rand_gen->seed(SEED); },
+            [=]() {
+                MazeGen maze_gen(maze_rand_gen.get(), 25);
+                maze_gen.generate_maze();
+            });
+
+        // caveflyer generates its caves with the room generator, start from the random fill it uses
+        auto game = make_env("caveflyer")->game();
+        auto room_gen = std::make_shared<RoomGenerator>(game);
+        auto fill = std::make_shared<std::vector<int>>(game->grid_size);
+        RandGen fill_rand_gen;
+        fill_rand_gen.seed(SEED);
+        for (auto &cell : *fill) {
+            cell = fill_rand_gen.rand01() < .5 ? WALL_OBJ : SPACE;
+        }
+        add_kernel(
+            "RoomGenerator::update", [=]() {
+                for (int i = 0; i < game->grid_size; i++) {
+                    game->set_obj(i, (*fill)[i]);
+                }
+            },
+            [=]() { room_gen->update(); });
+
+        // a path from the agent to the farthest cell it can reach, on the generated level
+        auto path_game = make_env("caveflyer")->game();
+        auto path_room_gen = std::make_shared<RoomGenerator>(path_game);
+        int src = path_game->get_agent_index();
+        std::vector<int> dists;
+        path_game->compute_grid_distances({src}, [=](int idx) { return path_game->get_obj(idx) == SPACE; }, dists);
+        int dst = (int)(std::max_element(dists.begin(), dists.end()) - dists.begin());
+        auto path = std::make_shared<std::vector<int>>();
+        add_kernel("RoomGenerator::find_path", nullptr, [=]() {
+            path->clear();
+            path_room_gen->find_path(src, dst, *path);
+        });
+
+        auto asset_rand_gen = std::make_shared<RandGen>();
+        auto asset_gen = std::make_shared<AssetGen>(asset_rand_gen.get());
+        auto asset = std::make_shared<QImage>(64, 64, QImage::Format_ARGB32);
+        add_kernel(
+            "AssetGen::generate_resource", [=]() { asset_rand_gen->seed(SEED); },
+            [=]() { asset_gen->generate_resource(asset, 0, 5, true); });
+    }
+
+    // generating a level compared to copying it from a template, as environments do with eval_level_seeds
+    void add_level_kernels() {
+        for (std::string env_name : {"caveflyer", "coinrun", "maze"}) {
+            auto game = make_env(env_name)->game();
+            auto state = std::make_shared<std::vector<char>>(EVAL_LEVEL_MAX_STATE_SIZE);
+            WriteBuffer b(state->data(), state->size());
+            game->serialize(&b);
+            state->resize(b.offset);
+
+            add_kernel(env_name + "::game_reset", nullptr, [=]() {
+                game->rand_gen.seed(SEED);
+                game->game_reset();
+            });
+            add_kernel(env_name + "::load_level", nullptr, [=]() {
+                ReadBuffer b(state->data(), state->size());
+                game->load_level(&b);
+            });
+        }
+    }
+};
+
+static double now_seconds() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static double percentile(std::vector<double> sorted, double p) {
+    double pos = p * (sorted.size() - 1);
+    size_t lo = (size_t)(floor(pos));
+    size_t hi = std::min(lo + 1, sorted.size() - 1);
+    return sorted[lo] + (sorted[hi] - sorted[lo]) * (pos - lo);
+}
+
+// times calls of the kernel, calls to prepare are not included
+static double time_calls(const Kernel &kernel, int calls) {
+    if (!kernel.prepare) {
+        double start = now_seconds();
+        for (int i = 0; i < calls; i++) {
+            kernel.run();
+        }
+        return now_seconds() - start;
+    }
+
+    double total = 0;
+    for (int i = 0; i < calls; i++) {
+        kernel.prepare();
+        double start = now_seconds();
+        kernel.run();
+        total += now_seconds() - start;
+    }
+    return total;
+}
+
+static KernelResult run_kernel(const Kernel &kernel, int num_samples) {
+    KernelResult result;
+    result.name = kernel.name;
+
+    // warm up, and find how many calls make up a sample that is long enough to time reliably
+    int calls = 1;
+    double warmup_end = now_seconds() + WARMUP_SECONDS;
+    while (1) {
+        double elapsed = time_calls(kernel, calls);
+        if (elapsed < MIN_SAMPLE_SECONDS) {
+            calls *= 2;
+        } else if (now_seconds() >= warmup_end) {
+            break;
+        }
+    }
+    result.calls_per_sample = calls;
+
+    AllocStats alloc_stats;
+    std::vector<double> samples(num_samples);
+    for (int s = 0; s < num_samples; s++) {
+        AllocPhaseScope alloc_scope(&alloc_stats, ALLOC_PHASE_STEP);
+        samples[s] = time_calls(kernel, calls) * 1e9 / calls;
+    }
+    std::sort(samples.begin(), samples.end());
+
+    result.median_ns = percentile(samples, 0.5);
+    result.p10_ns = percentile(samples, 0.1);
+    result.p90_ns = percentile(samples, 0.9);
+    result.min_ns = samples[0];
+    result.allocs_per_call = (double)(alloc_stats.allocs[ALLOC_PHASE_STEP]) / ((double)(calls) * num_samples);
+    return result;
+}
+
+static std::map<std::string, double> read_baseline(const std::string &path) {
+    std::map<std::string, double> medians;
+    std::ifstream f(path);
+    if (!f) {
+        fatal("failed to open baseline %s\n", path.c_str());
+    }
+    std::string line;
+    std::getline(f, line);
+    while (std::getline(f, line)) {
+        std::stringstream ss(line);
+        std::string name, calls, median;
+        std::getline(ss, name, ',');
+        std::getline(ss, calls, ',');
+        std::getline(ss, median, ',');
+        medians[name] = std::stod(median);
+    }
+    return medians;
+}
+
+int main(int argc, char **argv) {
+    std::string filter;
+    std::string csv_path;
+    std::string baseline_path;
+    int num_samples = DEFAULT_SAMPLES;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            fatal("usage: %s [--filter substring] [--samples n] [--csv out.csv] [--baseline baseline.csv]\n", argv[0]);
+        }
+        std::string value = argv[++i];
+        if (arg == "--filter") {
+            filter = value;
+        } else if (arg == "--samples") {
+            num_samples = std::stoi(value);
+        } else if (arg == "--csv") {
+            csv_path = value;
+        } else if (arg == "--baseline") {
+            baseline_path = value;
+        } else {
+            fatal("unknown argument %s\n", arg.c_str());
+        }
+    }
+    fassert(num_samples > 0);
+
+    std::map<std::string, double> baseline;
+    if (baseline_path != "") {
+        baseline = read_baseline(baseline_path);
+    }
+
+    MicroBench bench;
+    bench.add_step_kernels();
+    bench.add_draw_kernels();
+    bench.add_convert_kernels();
+    bench.add_generator_kernels();
+    bench.add_level_kernels();
+
+    printf("build: %s\n", PROCGEN_BUILD_INFO);
+#ifdef PROCGEN_ALLOC_TRACKING
+    printf("%-28s %10s %12s %12s %12s %12s %10s", "kernel", "calls", "median ns", "p10 ns", "p90 ns", "min ns", "allocs");
+#else
+    printf("%-28s %10s %12s %12s %12s %12s", "kernel", "calls", "median ns", "p10 ns", "p90 ns", "min ns");
+#endif
+    printf(baseline.empty() ? "\n" : " %10s\n", "vs base");
+
+    std::vector<KernelResult> results;
+    for (const auto &kernel : bench.kernels) {
+        if (kernel.name.find(filter) == std::string::npos) {
+            continue;
+        }
+
+        auto r = run_kernel(kernel, num_samples);
+        results.push_back(r);
+        printf("%-28s %10d %12.1f %12.1f %12.1f %12.1f", r.name.c_str(), r.calls_per_sample, r.median_ns, r.p10_ns, r.p90_ns, r.min_ns);
+#ifdef PROCGEN_ALLOC_TRACKING
+        printf(" %10.2f", r.allocs_per_call);
+#endif
+        if (baseline.count(r.name) > 0) {
+            printf(" %+9.1f%%", (r.median_ns / baseline[r.name] - 1) * 100);
+        }
+        printf("\n");
+        fflush(stdout);
+    }
+
+    if (csv_path != "") {
+        FILE *f = fopen(csv_path.c_str(), "w");
+        if (f == nullptr) {
+            fatal("failed to open %s\n", csv_path.c_str());
+        }
+        fprintf(f, "kernel,calls,median_ns,p10_ns,p90_ns,min_ns,allocs_per_call\n");
+        for (const auto &r : results) {
+            fprintf(f, "%s,%d,%f,%f,%f,%f,%f\n", r.name.c_str(), r.calls_per_sample, r.median_ns, r.p10_ns, r.p90_ns, r.min_ns, r.allocs_per_call);
+        }
+        fclose(f);
+    }
+
+    return 0;
+}
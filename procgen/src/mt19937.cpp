@@ -0,0 +1,56 @@
+#include "mt19937.h"
+#include "cpp-utils.h"
+#include "libenv.h"
+
+const int MT_SHIFT = 397;
+const uint32_t MT_MATRIX = 0x9908b0df;
+const uint32_t MT_UPPER_MASK = 0x80000000;
+const uint32_t MT_LOWER_MASK = 0x7fffffff;
+
+void MT19937::seed(uint32_t s) {
+    x[0] = s;
+    for (int i = 1; i < STATE_SIZE; i++) {
+        x[i] = 1812433253 * (x[i - 1] ^ (x[i - 1] >> 30)) + i;
+    }
+    pos = STATE_SIZE;
+}
+
+static inline uint32_t mt_mix(uint32_t upper, uint32_t lower, uint32_t shifted) {
+    uint32_t y = (upper & MT_UPPER_MASK) | (lower & MT_LOWER_MASK);
+    return shifted ^ (y >> 1) ^ ((y & 1) ? MT_MATRIX : 0);
+}
+
+void MT19937::twist() {
+    // split where the indices wrap around, so that the loops don't need a modulo
+    int k = 0;
+    for (; k < STATE_SIZE - MT_SHIFT; k++) {
+        x[k] = mt_mix(x[k], x[k + 1], x[k + MT_SHIFT]);
+    }
+    for (; k < STATE_SIZE - 1; k++) {
+        x[k] = mt_mix(x[k], x[k + 1], x[k + MT_SHIFT - STATE_SIZE]);
+    }
+    x[STATE_SIZE - 1] = mt_mix(x[STATE_SIZE - 1], x[0], x[MT_SHIFT - 1]);
+    pos = 0;
+}
+
+void MT19937::serialize(WriteBuffer *b) const {
+    b->write_data(x, sizeof(x));
+    b->write_int(pos);
+}
+
+void MT19937::deserialize(ReadBuffer *b) {
+    b->read_data(x, sizeof(x));
+    pos = b->read_int();
+    fassert(0 <= pos && pos <= STATE_SIZE);
+}
+
+extern "C" {
+// writes the first count numbers of an MT19937 seeded with seed, so that tests can compare it with other implementations
+LIBENV_API void procgen_mt19937_generate(uint32_t seed, int count, uint32_t *out) {
+    MT19937 gen;
+    gen.seed(seed);
+    for (int i = 0; i < count; i++) {
+        out[i] = gen();
+    }
+}
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+/*
+
+The 32 bit Mersenne Twister used by RandGen
+
+It produces the same numbers as std::mt19937, so levels are unchanged, but its state is laid out the
+same way with every standard library and is saved as raw words.  Saving std::mt19937 goes through its
+iostream text format, which took about 50us per generator and made deserializing a game, and so copying
+an evaluation level template, mostly the cost of formatting and parsing numbers.
+
+*/
+
+#include "buffer.h"
+#include <cstdint>
+
+class MT19937 {
+  public:
+    typedef uint32_t result_type;
+    static const int STATE_SIZE = 624;
+
+    MT19937() {
+        seed(5489);
+    }
+    static constexpr uint32_t min() {
+        return 0;
+    }
+    static constexpr uint32_t max() {
+        return 0xffffffff;
+    }
+    void seed(uint32_t s);
+    uint32_t operator()() {
+        if (pos >= STATE_SIZE) {
+            twist();
+        }
+        uint32_t z = x[pos++];
+        z ^= z >> 11;
+        z ^= (z << 7) & 0x9d2c5680;
+        z ^= (z << 15) & 0xefc60000;
+        z ^= z >> 18;
+        return z;
+    }
+    void serialize(WriteBuffer *b) const;
+    void deserialize(ReadBuffer *b);
+
+  private:
+    uint32_t x[STATE_SIZE];
+    int pos;
+
+    void twist();
+};
@@ -0,0 +1,558 @@
+/*
+
+CPython extension module that drives the environment library directly, without going through cffi
+
+Observations, rewards, firsts, infos and actions live in buffers owned by the module and are exposed
+through the buffer protocol, so numpy.asarray() on them gives arrays that are updated in place by
+every observe() instead of new objects, and the GIL is released while the games are stepping
+
+*/
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "libenv.h"
+
+extern "C" int get_state(libenv_env *handle, int env_idx, char *data, int length);
+extern "C" void set_state(libenv_env *handle, int env_idx, char *data, int length);
+
+// same as MAX_STATE_SIZE in env.py
+const int MAX_STATE_SIZE = 1 << 20;
+
+// memory for one tensor type across all environments, with the environment as the first dimension
+struct TensorBuffer {
+    struct libenv_tensortype type;
+    std::vector<uint8_t> data;
+    int itemsize = 0;
+};
+
+// buffers are only released when the VecEnv object is deallocated, since arrays may still point into them after close()
+struct EnvBuffers {
+    libenv_env *handle = nullptr;
+    int num = 0;
+    std::vector<TensorBuffer> ob;
+    std::vector<TensorBuffer> ac;
+    std::vector<TensorBuffer> info;
+    std::vector<float> rew;
+    std::vector<uint8_t> first;
+    std::vector<char> state_buf;
+};
+
+struct VecEnvObject {
+    PyObject_HEAD
+    EnvBuffers *bufs;
+    PyObject *ob;
+    PyObject *info;
+    PyObject *ac;
+    PyObject *rew;
+    PyObject *first;
+};
+
+struct ArrayObject {
+    PyObject_HEAD
+    // keeps the memory alive
+    PyObject *owner;
+    void *data;
+    const char *format;
+    Py_ssize_t itemsize;
+    int ndim;
+    Py_ssize_t shape[LIBENV_MAX_NDIM + 1];
+    Py_ssize_t strides[LIBENV_MAX_NDIM + 1];
+    bool readonly;
+};
+
+static const char *dtype_format(enum libenv_dtype dtype) {
+    if (dtype == LIBENV_DTYPE_UINT8) {
+        return "B";
+    } else if (dtype == LIBENV_DTYPE_INT32) {
+        return "i";
+    } else if (dtype == LIBENV_DTYPE_FLOAT32) {
+        return "f";
+    }
+    return nullptr;
+}
+
+static int dtype_size(enum libenv_dtype dtype) {
+    return dtype == LIBENV_DTYPE_UINT8 ? 1 : 4;
+}
+
+static bool is_int32_format(const Py_buffer &view) {
+    if (view.itemsize != 4 || view.format == nullptr) {
+        return false;
+    }
+    // skip a byte order prefix, only native order is produced by numpy on the platforms we support
+    const char *f = view.format;
+    if (*f == '@' || *f == '=' || *f == '<') {
+        f++;
+    }
+    return strcmp(f, "i") == 0 || strcmp(f, "l") == 0;
+}
+
+// Array
+
+static int Array_getbuffer(PyObject *obj, Py_buffer *view, int flags) {
+    auto self = (ArrayObject *)obj;
+    if ((flags & PyBUF_WRITABLE) && self->readonly) {
+        PyErr_SetString(PyExc_BufferError, "array is read-only");
+        return -1;
+    }
+
+    Py_ssize_t len = self->itemsize;
+    for (int i = 0; i < self->ndim; i++) {
+        len *= self->shape[i];
+    }
+
+    view->obj = obj;
+    Py_INCREF(obj);
+    view->buf = self->data;
+    view->len = len;
+    view->readonly = self->readonly;
+    view->itemsize = self->itemsize;
+    view->format = (flags & PyBUF_FORMAT) ? (char *)self->format : nullptr;
+    view->ndim = self->ndim;
+    view->shape = (flags & PyBUF_ND) ? self->shape : nullptr;
+    view->strides = ((flags & PyBUF_STRIDES) == PyBUF_STRIDES) ? self->strides : nullptr;
+    view->suboffsets = nullptr;
+    view->internal = nullptr;
+    return 0;
+}
+
+static void Array_dealloc(PyObject *obj) {
+    auto self = (ArrayObject *)obj;
+    Py_XDECREF(self->owner);
+    Py_TYPE(obj)->tp_free(obj);
+}
+
+static PyBufferProcs Array_as_buffer = {Array_getbuffer, nullptr};
+
+static PyTypeObject ArrayType = {
+    PyVarObject_HEAD_INIT(nullptr, 0)
+};
+
+static PyObject *make_array(PyObject *owner, void *data, enum libenv_dtype dtype, int num, const int *shape, int ndim, bool readonly) {
+    auto self = PyObject_New(ArrayObject, &ArrayType);
+    if (self == nullptr) {
+        return nullptr;
+    }
+    Py_INCREF(owner);
+    self->owner = owner;
+    self->data = data;
+    self->format = dtype_format(dtype);
+    self->itemsize = dtype_size(dtype);
+    self->readonly = readonly;
+    self->ndim = ndim + 1;
+    self->shape[0] = num;
+    for (int i = 0; i < ndim; i++) {
+        self->shape[i + 1] = shape[i];
+    }
+    Py_ssize_t stride = self->itemsize;
+    for (int i = self->ndim - 1; i >= 0; i--) {
+        self->strides[i] = stride;
+        stride *= self->shape[i];
+    }
+    return (PyObject *)self;
+}
+
+// VecEnv
+
+static bool convert_options(PyObject *dict, std::vector<struct libenv_option> *items, std::vector<std::vector<uint8_t>> *storage) {
+    if (!PyDict_Check(dict)) {
+        PyErr_SetString(PyExc_TypeError, "options must be a dict");
+        return false;
+    }
+
+    PyObject *key;
+    PyObject *value;
+    Py_ssize_t pos = 0;
+    while (PyDict_Next(dict, &pos, &key, &value)) {
+        const char *name = PyUnicode_AsUTF8(key);
+        if (name == nullptr) {
+            return false;
+        }
+        if (strlen(name) >= LIBENV_MAX_NAME_LEN) {
+            PyErr_Format(PyExc_ValueError, "option name %s is too long", name);
+            return false;
+        }
+
+        struct libenv_option opt;
+        memset(&opt, 0, sizeof(opt));
+        strcpy(opt.name, name);
+        std::vector<uint8_t> data;
+
+        // bool is a subclass of int, so it has to be checked first
+        if (PyBool_Check(value)) {
+            opt.dtype = LIBENV_DTYPE_UINT8;
+            data.push_back(value == Py_True);
+        } else if (PyLong_Check(value)) {
+            long v = PyLong_AsLong(value);
+            if (v == -1 && PyErr_Occurred()) {
+                return false;
+            }
+            int32_t v32 = (int32_t)v;
+            opt.dtype = LIBENV_DTYPE_INT32;
+            data.resize(sizeof(v32));
+            memcpy(data.data(), &v32, sizeof(v32));
+        } else if (PyFloat_Check(value)) {
+            float f = (float)PyFloat_AsDouble(value);
+            opt.dtype = LIBENV_DTYPE_FLOAT32;
+            data.resize(sizeof(f));
+            memcpy(data.data(), &f, sizeof(f));
+        } else if (PyUnicode_Check(value)) {
+            Py_ssize_t size;
+            const char *s = PyUnicode_AsUTF8AndSize(value, &size);
+            if (s == nullptr) {
+                return false;
+            }
+            opt.dtype = LIBENV_DTYPE_UINT8;
+            data.assign(s, s + size);
+        } else {
+            PyErr_Format(PyExc_TypeError, "unsupported type for option %s", name);
+            return false;
+        }
+
+        opt.count = opt.dtype == LIBENV_DTYPE_UINT8 ? (int)data.size() : 1;
+        storage->push_back(std::move(data));
+        items->push_back(opt);
+    }
+
+    // pointers are taken once storage has stopped growing
+    for (size_t i = 0; i < items->size(); i++) {
+        (*items)[i].data = (*storage)[i].data();
+    }
+    return true;
+}
+
+static void alloc_tensors(libenv_env *handle, enum libenv_space_name space, int num, std::vector<TensorBuffer> *tensors, std::vector<void *> *ptrs) {
+    int count = libenv_get_tensortypes(handle, space, nullptr);
+    std::vector<struct libenv_tensortype> types(count);
+    libenv_get_tensortypes(handle, space, types.data());
+
+    tensors->resize(count);
+    for (int i = 0; i < count; i++) {
+        auto &t = (*tensors)[i];
+        t.type = types[i];
+        t.itemsize = dtype_size(t.type.dtype);
+        size_t size = t.itemsize;
+        for (int d = 0; d < t.type.ndim; d++) {
+            size *= t.type.shape[d];
+        }
+        t.data.resize(size * num);
+    }
+
+    // libenv expects one pointer per environment for each tensor type
+    ptrs->clear();
+    for (auto &t : *tensors) {
+        size_t env_size = t.data.size() / num;
+        for (int e = 0; e < num; e++) {
+            ptrs->push_back(t.data.data() + e * env_size);
+        }
+    }
+}
+
+static PyObject *make_array_dict(PyObject *owner, std::vector<TensorBuffer> &tensors, int num, bool readonly) {
+    PyObject *dict = PyDict_New();
+    if (dict == nullptr) {
+        return nullptr;
+    }
+    for (auto &t : tensors) {
+        PyObject *arr = make_array(owner, t.data.data(), t.type.dtype, num, t.type.shape, t.type.ndim, readonly);
+        if (arr == nullptr || PyDict_SetItemString(dict, t.type.name, arr) < 0) {
+            Py_XDECREF(arr);
+            Py_DECREF(dict);
+            return nullptr;
+        }
+        Py_DECREF(arr);
+    }
+    return dict;
+}
+
+static int VecEnv_init(PyObject *obj, PyObject *args, PyObject *kwds) {
+    auto self = (VecEnvObject *)obj;
+    static const char *kwlist[] = {"num", "options", nullptr};
+    int num;
+    PyObject *options;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "iO", (char **)kwlist, &num, &options)) {
+        return -1;
+    }
+    if (self->bufs != nullptr) {
+        PyErr_SetString(PyExc_RuntimeError, "VecEnv is already initialized");
+        return -1;
+    }
+    if (num <= 0) {
+        PyErr_SetString(PyExc_ValueError, "num must be positive");
+        return -1;
+    }
+
+    std::vector<struct libenv_option> items;
+    std::vector<std::vector<uint8_t>> storage;
+    if (!convert_options(options, &items, &storage)) {
+        return -1;
+    }
+
+    libenv_options lo;
+    lo.items = items.data();
+    lo.count = (int)items.size();
+
+    auto bufs = new EnvBuffers();
+    bufs->num = num;
+    // creating the games loads assets and generates levels, which can take a while
+    Py_BEGIN_ALLOW_THREADS
+    bufs->handle = libenv_make(num, lo);
+    Py_END_ALLOW_THREADS
+    self->bufs = bufs;
+
+    std::vector<void *> ob_ptrs;
+    std::vector<void *> ac_ptrs;
+    std::vector<void *> info_ptrs;
+    alloc_tensors(bufs->handle, LIBENV_SPACE_OBSERVATION, num, &bufs->ob, &ob_ptrs);
+    alloc_tensors(bufs->handle, LIBENV_SPACE_ACTION, num, &bufs->ac, &ac_ptrs);
+    alloc_tensors(bufs->handle, LIBENV_SPACE_INFO, num, &bufs->info, &info_ptrs);
+    bufs->rew.resize(num);
+    bufs->first.resize(num);
+    bufs->state_buf.resize(MAX_STATE_SIZE);
+
+    struct libenv_buffers lb;
+    lb.ob = ob_ptrs.data();
+    lb.ac = ac_ptrs.data();
+    lb.info = info_ptrs.data();
+    lb.rew = bufs->rew.data();
+    lb.first = bufs->first.data();
+    libenv_set_buffers(bufs->handle, &lb);
+
+    // there is only a single action tensor, see libenv_get_tensortypes()
+    self->ob = make_array_dict(obj, bufs->ob, num, true);
+    self->info = make_array_dict(obj, bufs->info, num, true);
+    self->ac = make_array(obj, bufs->ac[0].data.data(), bufs->ac[0].type.dtype, num, bufs->ac[0].type.shape, bufs->ac[0].type.ndim, false);
+    self->rew = make_array(obj, bufs->rew.data(), LIBENV_DTYPE_FLOAT32, num, nullptr, 0, true);
+    self->first = make_array(obj, bufs->first.data(), LIBENV_DTYPE_UINT8, num, nullptr, 0, true);
+    if (self->ob == nullptr || self->info == nullptr || self->ac == nullptr || self->rew == nullptr || self->first == nullptr) {
+        return -1;
+    }
+    return 0;
+}
+
+static bool check_open(VecEnvObject *self) {
+    if (self->bufs == nullptr || self->bufs->handle == nullptr) {
+        PyErr_SetString(PyExc_RuntimeError, "VecEnv is closed");
+        return false;
+    }
+    return true;
+}
+
+static PyObject *VecEnv_act(PyObject *obj, PyObject *args) {
+    auto self = (VecEnvObject *)obj;
+    PyObject *actions = nullptr;
+    if (!PyArg_ParseTuple(args, "|O", &actions) || !check_open(self)) {
+        return nullptr;
+    }
+
+    // actions may also be written to the ac array in place, in which case there is nothing to copy
+    if (actions != nullptr && actions != Py_None) {
+        Py_buffer view;
+        if (PyObject_GetBuffer(actions, &view, PyBUF_C_CONTIGUOUS | PyBUF_FORMAT) < 0) {
+            return nullptr;
+        }
+        auto &ac = self->bufs->ac[0];
+        bool valid = view.len == (Py_ssize_t)ac.data.size() && is_int32_format(view);
+        if (!valid) {
+            PyBuffer_Release(&view);
+            PyErr_SetString(PyExc_ValueError, "actions must be a contiguous int32 array with one entry per environment");
+            return nullptr;
+        }
+        memcpy(ac.data.data(), view.buf, ac.data.size());
+        PyBuffer_Release(&view);
+    }
+
+    libenv_env *handle = self->bufs->handle;
+    Py_BEGIN_ALLOW_THREADS
+    libenv_act(handle);
+    Py_END_ALLOW_THREADS
+    Py_RETURN_NONE;
+}
+
+static PyObject *VecEnv_observe(PyObject *obj, PyObject *args) {
+    auto self = (VecEnvObject *)obj;
+    if (!check_open(self)) {
+        return nullptr;
+    }
+
+    libenv_env *handle = self->bufs->handle;
+    Py_BEGIN_ALLOW_THREADS
+    libenv_observe(handle);
+    Py_END_ALLOW_THREADS
+    Py_RETURN_NONE;
+}
+
+static PyObject *VecEnv_get_state(PyObject *obj, PyObject *args) {
+    auto self = (VecEnvObject *)obj;
+    int env_idx;
+    if (!PyArg_ParseTuple(args, "i", &env_idx) || !check_open(self)) {
+        return nullptr;
+    }
+    if (env_idx < 0 || env_idx >= self->bufs->num) {
+        PyErr_SetString(PyExc_IndexError, "env_idx out of range");
+        return nullptr;
+    }
+
+    auto &state_buf = self->bufs->state_buf;
+    int n;
+    Py_BEGIN_ALLOW_THREADS
+    n = get_state(self->bufs->handle, env_idx, state_buf.data(), (int)state_buf.size());
+    Py_END_ALLOW_THREADS
+    return PyBytes_FromStringAndSize(state_buf.data(), n);
+}
+
+static PyObject *VecEnv_set_state(PyObject *obj, PyObject *args) {
+    auto self = (VecEnvObject *)obj;
+    int env_idx;
+    Py_buffer state;
+    if (!PyArg_ParseTuple(args, "iy*", &env_idx, &state)) {
+        return nullptr;
+    }
+    if (!check_open(self)) {
+        PyBuffer_Release(&state);
+        return nullptr;
+    }
+    if (env_idx < 0 || env_idx >= self->bufs->num) {
+        PyBuffer_Release(&state);
+        PyErr_SetString(PyExc_IndexError, "env_idx out of range");
+        return nullptr;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    set_state(self->bufs->handle, env_idx, (char *)state.buf, (int)state.len);
+    Py_END_ALLOW_THREADS
+    PyBuffer_Release(&state);
+    Py_RETURN_NONE;
+}
+
+static PyObject *VecEnv_close(PyObject *obj, PyObject *args) {
+    auto self = (VecEnvObject *)obj;
+    if (self->bufs != nullptr && self->bufs->handle != nullptr) {
+        libenv_env *handle = self->bufs->handle;
+        self->bufs->handle = nullptr;
+        Py_BEGIN_ALLOW_THREADS
+        libenv_close(handle);
+        Py_END_ALLOW_THREADS
+    }
+    Py_RETURN_NONE;
+}
+
+static void VecEnv_dealloc(PyObject *obj) {
+    auto self = (VecEnvObject *)obj;
+    // arrays hold a reference to the VecEnv, so none of them can be left at this point
+    if (self->bufs != nullptr) {
+        if (self->bufs->handle != nullptr) {
+            libenv_close(self->bufs->handle);
+        }
+        delete self->bufs;
+    }
+    Py_XDECREF(self->ob);
+    Py_XDECREF(self->info);
+    Py_XDECREF(self->ac);
+    Py_XDECREF(self->rew);
+    Py_XDECREF(self->first);
+    Py_TYPE(obj)->tp_free(obj);
+}
+
+static PyObject *VecEnv_get_attr(PyObject *value) {
+    if (value == nullptr) {
+        PyErr_SetString(PyExc_RuntimeError, "VecEnv is not initialized");
+        return nullptr;
+    }
+    Py_INCREF(value);
+    return value;
+}
+
+static PyObject *VecEnv_get_num(PyObject *obj, void *) {
+    auto self = (VecEnvObject *)obj;
+    return PyLong_FromLong(self->bufs == nullptr ? 0 : self->bufs->num);
+}
+
+static PyObject *VecEnv_get_ob(PyObject *obj, void *) {
+    return VecEnv_get_attr(((VecEnvObject *)obj)->ob);
+}
+
+static PyObject *VecEnv_get_info(PyObject *obj, void *) {
+    return VecEnv_get_attr(((VecEnvObject *)obj)->info);
+}
+
+static PyObject *VecEnv_get_ac(PyObject *obj, void *) {
+    return VecEnv_get_attr(((VecEnvObject *)obj)->ac);
+}
+
+static PyObject *VecEnv_get_rew(PyObject *obj, void *) {
+    return VecEnv_get_attr(((VecEnvObject *)obj)->rew);
+}
+
+static PyObject *VecEnv_get_first(PyObject *obj, void *) {
+    return VecEnv_get_attr(((VecEnvObject *)obj)->first);
+}
+
+static PyMethodDef VecEnv_methods[] = {
+    {"act", VecEnv_act, METH_VARARGS, "act(actions=None): step every environment, actions default to the contents of ac"},
+    {"observe", VecEnv_observe, METH_NOARGS, "observe(): wait for the step to finish and fill in ob, rew, first and info"},
+    {"get_state", VecEnv_get_state, METH_VARARGS, "get_state(env_idx): serialized state of an environment as bytes"},
+    {"set_state", VecEnv_set_state, METH_VARARGS, "set_state(env_idx, state): restore an environment from get_state()"},
+    {"close", VecEnv_close, METH_NOARGS, "close(): stop the environments, arrays stay valid but are no longer updated"},
+    {nullptr, nullptr, 0, nullptr},
+};
+
+static PyGetSetDef VecEnv_getset[] = {
+    {"num", VecEnv_get_num, nullptr, "number of environments", nullptr},
+    {"ob", VecEnv_get_ob, nullptr, "dict of observation arrays", nullptr},
+    {"info", VecEnv_get_info, nullptr, "dict of info arrays", nullptr},
+    {"ac", VecEnv_get_ac, nullptr, "writable action array", nullptr},
+    {"rew", VecEnv_get_rew, nullptr, "reward array", nullptr},
+    {"first", VecEnv_get_first, nullptr, "first array", nullptr},
+    {nullptr, nullptr, nullptr, nullptr, nullptr},
+};
+
+static PyTypeObject VecEnvType = {
+    PyVarObject_HEAD_INIT(nullptr, 0)
+};
+
+static struct PyModuleDef procgen_module = {
+    PyModuleDef_HEAD_INIT,
+    "_procgen",
+    "Native interface to the procgen environment library",
+    -1,
+    nullptr,
+};
+
+PyMODINIT_FUNC PyInit__procgen(void) {
+    ArrayType.tp_name = "_procgen.Array";
+    ArrayType.tp_basicsize = sizeof(ArrayObject);
+    ArrayType.tp_dealloc = Array_dealloc;
+    ArrayType.tp_as_buffer = &Array_as_buffer;
+    ArrayType.tp_flags = Py_TPFLAGS_DEFAULT;
+    ArrayType.tp_doc = "Memory owned by a VecEnv, use numpy.asarray() to get a view of it";
+
+    VecEnvType.tp_name = "_procgen.VecEnv";
+    VecEnvType.tp_basicsize = sizeof(VecEnvObject);
+    VecEnvType.tp_dealloc = VecEnv_dealloc;
+    VecEnvType.tp_flags = Py_TPFLAGS_DEFAULT;
+    VecEnvType.tp_doc = "VecEnv(num, options): vector of games, options use the names of the environment library";
+    VecEnvType.tp_methods = VecEnv_methods;
+    VecEnvType.tp_getset = VecEnv_getset;
+    VecEnvType.tp_init = VecEnv_init;
+    VecEnvType.tp_new = PyType_GenericNew;
+
+    if (PyType_Ready(&ArrayType) < 0 || PyType_Ready(&VecEnvType) < 0) {
+        return nullptr;
+    }
+
+    PyObject *m = PyModule_Create(&procgen_module);
+    if (m == nullptr) {
+        return nullptr;
+    }
+    Py_INCREF(&VecEnvType);
+    if (PyModule_AddObject(m, "VecEnv", (PyObject *)&VecEnvType) < 0) {
+        Py_DECREF(&VecEnvType);
+        Py_DECREF(m);
+        return nullptr;
+    }
+    return m;
+}
@@ -1,23 +1,22 @@
 #include "randgen.h"
 #include "cpp-utils.h"
 #include <set>
-#include <sstream>
 
 int RandGen::randint(int low, int high) {
-    fassert(is_seeded);
+    fassert_hot(is_seeded);
     uint32_t x = stdgen();
     uint32_t range = high - low;
     return low + (x % range);
 }
 
 int RandGen::randn(int high) {
-    fassert(is_seeded);
+    fassert_hot(is_seeded);
     uint32_t x = stdgen();
     return (x % high);
 }
 
 float RandGen::rand01() {
-    fassert(is_seeded);
+    fassert_hot(is_seeded);
     uint32_t x = stdgen();
     return (float)((double)(x) / ((double)(stdgen.max()) + 1));
 }
@@ -88,7 +87,7 @@ std::vector<int> RandGen::simple_choose(int n, int k) {
 }
 
 int RandGen::randint() {
-    fassert(is_seeded);
+    fassert_hot(is_seeded);
     return stdgen();
 }
 
@@ -99,16 +98,10 @@ void RandGen::seed(int seed) {
 
 void RandGen::serialize(WriteBuffer *b) {
     b->write_int(is_seeded);
-    std::ostringstream ostream;
-    ostream << stdgen;
-    auto str = ostream.str();
-    b->write_string(str);
+    stdgen.serialize(b);
 }
 
 void RandGen::deserialize(ReadBuffer *b) {
     is_seeded = b->read_int();
-    auto str = b->read_string();
-    std::istringstream istream;
-    istream.str(str);
-    istream >> stdgen;
+    stdgen.deserialize(b);
 }
@@ -7,11 +7,12 @@ Random number generator with consistent behavior across platforms
 */
 
 #include "buffer.h"
-#include <random>
+#include "mt19937.h"
+#include <vector>
 
 class RandGen {
   public:
-    std::mt19937 stdgen;
+    MT19937 stdgen;
     int randint(int low, int high);
     int randn(int high);
     float rand01();
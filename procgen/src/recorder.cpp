@@ -0,0 +1,191 @@
+#include "recorder.h"
+#include "cpp-utils.h"
+#include "game.h"
+
+const int RECORD_FPS = 15;
+// stepping threads wait for the io thread when this many frames are queued, which bounds the memory used by a slow disk
+const int MAX_PENDING_FRAMES = 64;
+
+FrameRecorder::FrameRecorder(std::string record_dir, bool record_hires)
+    : record_dir(record_dir), record_hires(record_hires) {
+    width = record_hires ? RENDER_RES : RES_W;
+    height = record_hires ? RENDER_RES : RES_H;
+    yuv_buf.resize(width * height * 3);
+    start_io_thread();
+}
+
+FrameRecorder::~FrameRecorder() {
+    if (io_thread.joinable()) {
+        stop_io_thread();
+    }
+
+    for (const auto &it : open_files) {
+        if (fclose(it.second) != 0 && !failed) {
+            failed = true;
+            error = "failed to close recording of environment " + std::to_string(it.first);
+        }
+    }
+    if (error != "") {
+        fprintf(stderr, "unreported recording error: %s\n", error.c_str());
+    }
+}
+
+void FrameRecorder::start_io_thread() {
+    time_to_die = false;
+    io_thread = std::thread(&FrameRecorder::io_worker, this);
+}
+
+void FrameRecorder::stop_io_thread() {
+    {
+        std::unique_lock<std::mutex> lock(queue_mutex);
+        time_to_die = true;
+    }
+    frames_added.notify_all();
+    io_thread.join();
+
+    for (const auto &it : open_files) {
+        if (fflush(it.second) != 0 && !failed) {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            failed = true;
+            error = "failed to write recording of environment " + std::to_string(it.first);
+        }
+    }
+}
+
+void FrameRecorder::wait() {
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    while (num_unwritten > 0) {
+        frames_written.wait(lock);
+    }
+}
+
+std::string FrameRecorder::take_error() {
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    std::string result = error;
+    error = "";
+    return result;
+}
+
+void FrameRecorder::record(Game *game) {
+    PendingFrame frame;
+
+    {
+        std::unique_lock<std::mutex> lock(queue_mutex);
+        if (!free_frames.empty()) {
+            frame = std::move(free_frames.front());
+            free_frames.pop_front();
+        }
+    }
+
+    frame.env_idx = game->game_n;
+    frame.is_first = game->step_data.done;
+    frame.rgb.resize(width * height * 3);
+
+    if (record_hires) {
+        uint32_t *render_hires_buf = thread_render_buf(RENDER_RES, RENDER_RES);
+        game->render_to_buf(render_hires_buf, RENDER_RES, RENDER_RES, true);
+        bgr32_to_rgb888(frame.rgb.data(), render_hires_buf, RENDER_RES, RENDER_RES);
+    } else {
+        memcpy(frame.rgb.data(), game->obs_bufs[0], frame.rgb.size());
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(queue_mutex);
+        while ((int)(pending_frames.size()) >= MAX_PENDING_FRAMES) {
+            frames_written.wait(lock);
+        }
+        pending_frames.push_back(std::move(frame));
+        num_unwritten++;
+    }
+    frames_added.notify_one();
+}
+
+void FrameRecorder::io_worker() {
+    while (1) {
+        PendingFrame frame;
+
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            while (1) {
+                if (!pending_frames.empty()) {
+                    frame = std::move(pending_frames.front());
+                    pending_frames.pop_front();
+                    break;
+                }
+                // drain the queue before exiting so that no recorded frames are lost
+                if (time_to_die) {
+                    return;
+                }
+
+                frames_added.wait(lock);
+            }
+        }
+
+        // after a failed write the recordings stop, since the disk is likely full or gone
+        std::string frame_error = failed ? "" : write_frame(frame);
+
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            if (frame_error != "") {
+                failed = true;
+                if (error == "") {
+                    error = frame_error;
+                }
+            }
+            free_frames.push_back(std::move(frame));
+            num_unwritten--;
+        }
+        frames_written.notify_all();
+    }
+}
+
+std::string FrameRecorder::write_frame(const PendingFrame &frame) {
+    FILE *f = nullptr;
+    auto it = open_files.find(frame.env_idx);
+    if (it != open_files.end()) {
+        f = it->second;
+    }
+
+    // a new episode starts on the first frame after a reset
+    if (f == nullptr || frame.is_first) {
+        if (f != nullptr) {
+            open_files.erase(frame.env_idx);
+            if (fclose(f) != 0) {
+                return "failed to close recording of environment " + std::to_string(frame.env_idx);
+            }
+        }
+
+        int episode = episode_counts[frame.env_idx]++;
+        std::string path = record_dir + "/env" + std::to_string(frame.env_idx) + "_ep" + std::to_string(episode) + ".y4m";
+        f = fopen(path.c_str(), "wb");
+        if (f == nullptr) {
+            return "failed to open recording file " + path;
+        }
+        open_files[frame.env_idx] = f;
+        if (fprintf(f, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444\n", width, height, RECORD_FPS) < 0) {
+            return "failed to write recording file " + path;
+        }
+    }
+
+    // convert to BT.601 studio swing YCbCr, stored as planar 4:4:4
+    int num_pixels = width * height;
+    uint8_t *y_plane = yuv_buf.data();
+    uint8_t *u_plane = y_plane + num_pixels;
+    uint8_t *v_plane = u_plane + num_pixels;
+    const uint8_t *src = frame.rgb.data();
+
+    for (int i = 0; i < num_pixels; i++) {
+        int r = src[0];
+        int g = src[1];
+        int b = src[2];
+        y_plane[i] = (uint8_t)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+        u_plane[i] = (uint8_t)(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+        v_plane[i] = (uint8_t)(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+        src += 3;
+    }
+
+    if (fputs("FRAME\n", f) < 0 || fwrite(yuv_buf.data(), 1, yuv_buf.size(), f) != yuv_buf.size()) {
+        return "failed to write recording of environment " + std::to_string(frame.env_idx);
+    }
+    return "";
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+/*
+
+Records observations of selected environments to per-episode Y4M video files
+
+Frames are copied on the stepping threads and handed to a background thread that does the
+color conversion and file I/O, so recording does not block stepping unless the background
+thread falls behind by more than a bounded number of frames
+
+The recorder stops at the first error writing a file and keeps the error until it is reported by
+take_error(), the io thread never exits the process.
+
+*/
+
+#include <string>
+#include <vector>
+#include <list>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+class Game;
+
+class FrameRecorder {
+  public:
+    FrameRecorder(std::string record_dir, bool record_hires);
+    ~FrameRecorder();
+
+    // called on the stepping thread that owns the game, right after the game has been observed
+    void record(Game *game);
+    // blocks until every frame recorded so far has been handed to the video files
+    void wait();
+    // returns the first error since the last call and forgets it, or an empty string if every write succeeded
+    std::string take_error();
+
+    // used around fork(), stopping writes every queued frame and flushes the open files
+    void stop_io_thread();
+    void start_io_thread();
+
+  private:
+    struct PendingFrame {
+        int env_idx = 0;
+        bool is_first = false;
+        std::vector<uint8_t> rgb;
+    };
+
+    std::string record_dir;
+    bool record_hires;
+    int width;
+    int height;
+
+    // this mutex synchronizes access to pending_frames, free_frames, num_unwritten, error and time_to_die
+    std::mutex queue_mutex;
+    std::condition_variable frames_added;
+    std::condition_variable frames_written;
+    std::list<PendingFrame> pending_frames;
+    std::list<PendingFrame> free_frames;
+    // frames that are not yet in a file, including the one the io thread is writing
+    int num_unwritten = 0;
+    std::thread io_thread;
+    bool time_to_die = false;
+    std::string error;
+
+    // only used by the io thread
+    bool failed = false;
+    std::map<int, FILE *> open_files;
+    std::map<int, int> episode_counts;
+    std::vector<uint8_t> yuv_buf;
+
+    void io_worker();
+    // returns an error message, or an empty string if the frame was written
+    std::string write_frame(const PendingFrame &frame);
+};
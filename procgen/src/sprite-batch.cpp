@@ -0,0 +1,279 @@
+#include "sprite-batch.h"
+#include "cpp-utils.h"
+#include "game.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+const int FRAME_PIXELS = RES_W * RES_H;
+
+// multiplies every channel by a / 255, rounded the same way as Qt
+static inline uint32_t byte_mul(uint32_t x, uint32_t a) {
+    uint32_t t = (x & 0xff00ff) * a;
+    t = (t + ((t >> 8) & 0xff00ff) + 0x800080) >> 8;
+    t &= 0xff00ff;
+    x = ((x >> 8) & 0xff00ff) * a;
+    x = (x + ((x >> 8) & 0xff00ff) + 0x800080);
+    x &= 0xff00ff00;
+    return x | t;
+}
+
+static inline uint32_t premultiply(uint32_t x) {
+    uint32_t a = x >> 24;
+    if (a == 255) {
+        return x;
+    }
+    return (byte_mul(x, a) & 0x00ffffff) | (a << 24);
+}
+
+// source-over of a premultiplied pixel onto an opaque one
+static inline uint32_t blend(uint32_t dst, uint32_t src) {
+    uint32_t a = src >> 24;
+    if (a == 255) {
+        return src;
+    }
+    return (src + byte_mul(dst, 255 - a)) | 0xff000000;
+}
+
+static inline uint32_t fetch(const uint32_t *row, int x, QImage::Format format) {
+    uint32_t p = row[x];
+    if (format == QImage::Format_RGB32) {
+        return p | 0xff000000;
+    } else if (format == QImage::Format_ARGB32) {
+        return premultiply(p);
+    }
+    return p;
+}
+
+// same as the span that QPainter fills for an unantialiased rect
+static inline void pixel_span(double lo, double hi, int limit, int *first, int *last) {
+    *first = std::max(0, (int)floor(lo + 0.5));
+    *last = std::min(limit, (int)floor(hi + 0.5));
+}
+
+SpriteBatch::SpriteBatch() : scratch_image(1, 1, QImage::Format_RGB32) {
+    scratch_painter = std::make_unique<QPainter>(&scratch_image);
+}
+
+QPainter &SpriteBatch::recording_painter() {
+    return *scratch_painter;
+}
+
+void SpriteBatch::begin_frame(void *dst_rgb888, const AugmentParams *augment, int cutout) {
+    fassert(frames.size() < 65535);
+
+    Frame frame;
+    frame.dst_rgb888 = dst_rgb888;
+    frame.augment = augment != nullptr;
+    if (augment != nullptr) {
+        frame.augment_params = *augment;
+    }
+    frame.cutout = cutout;
+    frames.push_back(frame);
+
+    size_t num_pixels = frames.size() * FRAME_PIXELS;
+    if (frame_pixels.size() < num_pixels) {
+        frame_pixels.resize(num_pixels);
+        frame_layers.resize(num_pixels);
+    }
+    memset(&frame_layers[num_pixels - FRAME_PIXELS], 0, FRAME_PIXELS * sizeof(uint16_t));
+    opacity = 255;
+}
+
+void SpriteBatch::set_opacity(float value) {
+    opacity = (uint32_t)(std::min(std::max(value, 0.0f), 1.0f) * 255 + 0.5f);
+}
+
+void SpriteBatch::add_image(const QImage *image, const QRectF &rect, float rotation) {
+    fassert_hot(image->format() == QImage::Format_RGB32 || image->format() == QImage::Format_ARGB32 || image->format() == QImage::Format_ARGB32_Premultiplied);
+    if (opacity == 0 || image->width() == 0 || image->height() == 0) {
+        return;
+    }
+
+    Command c;
+    c.image = image;
+    c.x = rect.x();
+    c.y = rect.y();
+    c.w = rect.width();
+    c.h = rect.height();
+    c.rotation = rotation;
+    c.alpha = opacity;
+    c.color = 0;
+
+    if (rotation == 0) {
+        pixel_span(c.x, c.x + c.w, RES_W, &c.x0, &c.x1);
+        pixel_span(c.y, c.y + c.h, RES_H, &c.y0, &c.y1);
+    } else {
+        // any pixel whose center the rotated rect can reach
+        double cx = c.x + c.w / 2;
+        double cy = c.y + c.h / 2;
+        double extent = sqrt(c.w * c.w + c.h * c.h) / 2;
+        c.x0 = std::max(0, (int)floor(cx - extent));
+        c.x1 = std::min(RES_W, (int)ceil(cx + extent));
+        c.y0 = std::max(0, (int)floor(cy - extent));
+        c.y1 = std::min(RES_H, (int)ceil(cy + extent));
+    }
+
+    add_command(c);
+}
+
+void SpriteBatch::add_fill(const QRectF &rect, const QColor &color) {
+    Command c;
+    c.image = nullptr;
+    // QPainter fills rects with a negative size too
+    QRectF r = rect.normalized();
+    c.x = r.x();
+    c.y = r.y();
+    c.w = r.width();
+    c.h = r.height();
+    c.rotation = 0;
+    c.alpha = 255;
+    c.color = premultiply(color.rgba());
+    if ((c.color >> 24) == 0) {
+        return;
+    }
+
+    pixel_span(c.x, c.x + c.w, RES_W, &c.x0, &c.x1);
+    pixel_span(c.y, c.y + c.h, RES_H, &c.y0, &c.y1);
+
+    add_command(c);
+}
+
+void SpriteBatch::add_command(Command &c) {
+    fassert_hot(!frames.empty());
+    if (c.x0 >= c.x1 || c.y0 >= c.y1) {
+        return;
+    }
+
+    c.frame = (uint16_t)(frames.size() - 1);
+    uint16_t *layers = &frame_layers[(size_t)c.frame * FRAME_PIXELS];
+
+    uint16_t below = 0;
+    for (int y = c.y0; y < c.y1; y++) {
+        for (int x = c.x0; x < c.x1; x++) {
+            below = std::max(below, layers[y * RES_W + x]);
+        }
+    }
+    fassert(below < 65535);
+    c.layer = below + 1;
+    for (int y = c.y0; y < c.y1; y++) {
+        std::fill(layers + y * RES_W + c.x0, layers + y * RES_W + c.x1, c.layer);
+    }
+
+    commands.push_back(c);
+}
+
+void SpriteBatch::blit_fill(const Command &c, uint32_t *dst) {
+    for (int y = c.y0; y < c.y1; y++) {
+        uint32_t *d = dst + y * RES_W;
+        if ((c.color >> 24) == 255) {
+            std::fill(d + c.x0, d + c.x1, c.color);
+        } else {
+            for (int x = c.x0; x < c.x1; x++) {
+                d[x] = blend(d[x], c.color);
+            }
+        }
+    }
+}
+
+void SpriteBatch::blit_image(const Command &c, uint32_t *dst) {
+    const QImage *image = c.image;
+    QImage::Format format = image->format();
+    int iw = image->width();
+    int ih = image->height();
+
+    if (c.rotation == 0) {
+        // every row samples the same source columns
+        int src_x[RES_W];
+        for (int x = c.x0; x < c.x1; x++) {
+            int sx = (int)((x + 0.5 - c.x) / c.w * iw);
+            src_x[x] = std::min(std::max(sx, 0), iw - 1);
+        }
+
+        for (int y = c.y0; y < c.y1; y++) {
+            int sy = (int)((y + 0.5 - c.y) / c.h * ih);
+            sy = std::min(std::max(sy, 0), ih - 1);
+            const uint32_t *row = (const uint32_t *)image->constScanLine(sy);
+            uint32_t *d = dst + y * RES_W;
+
+            if (format == QImage::Format_RGB32 && c.alpha == 255) {
+                for (int x = c.x0; x < c.x1; x++) {
+                    d[x] = row[src_x[x]] | 0xff000000;
+                }
+            } else {
+                for (int x = c.x0; x < c.x1; x++) {
+                    uint32_t s = fetch(row, src_x[x], format);
+                    if (c.alpha != 255) {
+                        s = byte_mul(s, c.alpha);
+                    }
+                    d[x] = blend(d[x], s);
+                }
+            }
+        }
+        return;
+    }
+
+    // a pixel is covered if its center falls inside the rect after undoing the rotation, as in label_image
+    double hw = c.w / 2;
+    double hh = c.h / 2;
+    double cx = c.x + hw;
+    double cy = c.y + hh;
+    double rot_cos = cos(c.rotation);
+    double rot_sin = sin(c.rotation);
+
+    for (int y = c.y0; y < c.y1; y++) {
+        uint32_t *d = dst + y * RES_W;
+        for (int x = c.x0; x < c.x1; x++) {
+            double dx = x + 0.5 - cx;
+            double dy = y + 0.5 - cy;
+            double lx = dx * rot_cos + dy * rot_sin;
+            double ly = dy * rot_cos - dx * rot_sin;
+            if (lx < -hw || lx >= hw || ly < -hh || ly >= hh) {
+                continue;
+            }
+
+            int sx = std::min((int)((lx + hw) / c.w * iw), iw - 1);
+            int sy = std::min((int)((ly + hh) / c.h * ih), ih - 1);
+            uint32_t s = fetch((const uint32_t *)image->constScanLine(sy), sx, format);
+            if (c.alpha != 255) {
+                s = byte_mul(s, c.alpha);
+            }
+            d[x] = blend(d[x], s);
+        }
+    }
+}
+
+void SpriteBatch::flush() {
+    // commands in the same layer of a frame never overlap, so within a layer only the sprite order matters
+    std::sort(commands.begin(), commands.end(), [](const Command &a, const Command &b) {
+        if (a.layer != b.layer) {
+            return a.layer < b.layer;
+        }
+        if (a.image != b.image) {
+            return a.image < b.image;
+        }
+        return a.frame < b.frame;
+    });
+
+    for (const auto &c : commands) {
+        uint32_t *dst = &frame_pixels[(size_t)c.frame * FRAME_PIXELS];
+        if (c.image == nullptr) {
+            blit_fill(c, dst);
+        } else {
+            blit_image(c, dst);
+        }
+    }
+
+    for (size_t i = 0; i < frames.size(); i++) {
+        const Frame &frame = frames[i];
+        uint32_t *src = &frame_pixels[i * FRAME_PIXELS];
+        if (frame.augment) {
+            bgr32_to_rgb888_augmented(frame.dst_rgb888, src, RES_W, RES_H, frame.augment_params, frame.cutout);
+        } else {
+            bgr32_to_rgb888(frame.dst_rgb888, src, RES_W, RES_H);
+        }
+    }
+
+    frames.clear();
+    commands.clear();
+}
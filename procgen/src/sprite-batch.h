@@ -0,0 +1,81 @@
+#pragma once
+
+/*
+
+Observations of several environments drawn together, grouped by sprite
+
+While a game draws an observation into the batch, its images and rectangle fills are recorded as
+commands instead of being painted.  When the batch is flushed the commands of every frame are sorted
+by sprite and blitted without QPainter, then each frame is converted into its observation buffer.
+
+Each command gets a layer one above the highest layer already recorded under its bounding box in the
+same frame, so commands that may overlap keep their order, while commands in the same layer never
+overlap and can be drawn in any order.  Sorting by layer and then sprite keeps z-order and lets every
+frame's copies of a sprite be drawn one after another.
+
+Sampling is nearest neighbor at pixel centers and blending is source-over on premultiplied colors,
+which matches the unantialiased QPainter path except for rounding at some sprite edges.
+
+*/
+
+#include <QtGui/QPainter>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "augment.h"
+
+class SpriteBatch {
+  public:
+    SpriteBatch();
+
+    // starts recording a RES_W x RES_H frame that is written to dst_rgb888 when the batch is flushed
+    // augment is copied and applied during the conversion if it is set
+    void begin_frame(void *dst_rgb888, const AugmentParams *augment, int cutout);
+    // opacity of the images added after this, like QPainter::setOpacity
+    void set_opacity(float opacity);
+    void add_image(const QImage *image, const QRectF &rect, float rotation = 0);
+    void add_fill(const QRectF &rect, const QColor &color);
+    // draws every recorded frame into its observation buffer and empties the batch
+    void flush();
+
+    // painter passed to game_draw while recording, nothing is meant to be drawn with it
+    QPainter &recording_painter();
+
+  private:
+    struct Frame {
+        void *dst_rgb888;
+        bool augment;
+        AugmentParams augment_params;
+        int cutout;
+    };
+
+    struct Command {
+        uint16_t layer;
+        uint16_t frame;
+        // null for a fill
+        const QImage *image;
+        double x, y, w, h;
+        float rotation;
+        // opacity out of 255 of an image
+        uint32_t alpha;
+        // premultiplied color of a fill
+        uint32_t color;
+        // pixels that may be covered, clipped to the frame
+        int x0, x1, y0, y1;
+    };
+
+    std::vector<Frame> frames;
+    std::vector<Command> commands;
+    // BGR32 pixels and the highest layer drawn at each pixel for every frame
+    std::vector<uint32_t> frame_pixels;
+    std::vector<uint16_t> frame_layers;
+    // opacity out of 255 of the images being added
+    uint32_t opacity = 255;
+
+    QImage scratch_image;
+    std::unique_ptr<QPainter> scratch_painter;
+
+    void add_command(Command &c);
+    void blit_image(const Command &c, uint32_t *dst);
+    void blit_fill(const Command &c, uint32_t *dst);
+};
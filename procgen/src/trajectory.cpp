@@ -0,0 +1,574 @@
+#include "trajectory.h"
+#include "cpp-utils.h"
+#include "game.h"
+#include "libenv.h"
+#include <cstdio>
+#include <cstring>
+#include <map>
+
+const int32_t INDEX_MAGIC = 0x50475452;
+const int32_t CHUNK_MAGIC = 0x50475443;
+const int DATASET_VERSION = 2;
+const int FRAME_SIZE = RES_W * RES_H * 3;
+// magic, version, num_envs, frame width, frame height and keyframe interval
+const int FILE_HEADER_SIZE = 6 * sizeof(int32_t);
+const int RECORD_HEADER_SIZE = 7 * sizeof(int32_t);
+
+// start a new chunk file once the current one grows past this size
+const int64_t CHUNK_BYTES = 64 * 1024 * 1024;
+// stepping threads wait for the io thread when this many records are queued, which bounds the memory used by a slow disk
+const int MAX_PENDING_RECORDS = 1024;
+
+static void write_varint(std::vector<uint8_t> &out, uint32_t v) {
+    while (v >= 0x80) {
+        out.push_back((uint8_t)(v | 0x80));
+        v >>= 7;
+    }
+    out.push_back((uint8_t)v);
+}
+
+static uint32_t read_varint(const uint8_t *data, int length, int *pos) {
+    uint32_t v = 0;
+    int shift = 0;
+    while (1) {
+        fassert(*pos < length && shift < 32);
+        uint8_t b = data[(*pos)++];
+        v |= (uint32_t)(b & 0x7f) << shift;
+        if ((b & 0x80) == 0) {
+            return v;
+        }
+        shift += 7;
+    }
+}
+
+template <typename T>
+static void append_value(std::vector<uint8_t> &out, T v) {
+    size_t offset = out.size();
+    out.resize(offset + sizeof(T));
+    memcpy(&out[offset], &v, sizeof(T));
+}
+
+template <typename T>
+static T parse_value(const uint8_t *data, int *pos) {
+    T v;
+    memcpy(&v, data + *pos, sizeof(T));
+    *pos += sizeof(T);
+    return v;
+}
+
+// the delta is a sequence of (zero run length, literal length, literal bytes) where the
+// literal bytes are frame XOR ref and the zero runs are bytes where the two frames agree
+void encode_frame_delta(const uint8_t *ref, const uint8_t *frame, int size, std::vector<uint8_t> &out) {
+    int pos = 0;
+
+    while (pos < size) {
+        int run_start = pos;
+        while (pos < size && frame[pos] == ref[pos]) {
+            pos++;
+        }
+        int zero_run = pos - run_start;
+
+        // end a literal only at a run of at least 4 matching bytes, shorter runs cost more to encode than to copy
+        int lit_start = pos;
+        int matching = 0;
+        while (pos < size && matching < 4) {
+            matching = frame[pos] == ref[pos] ? matching + 1 : 0;
+            pos++;
+        }
+        pos -= matching;
+        int lit_len = pos - lit_start;
+
+        write_varint(out, zero_run);
+        write_varint(out, lit_len);
+        for (int i = lit_start; i < pos; i++) {
+            out.push_back(frame[i] ^ ref[i]);
+        }
+    }
+}
+
+void decode_frame_delta(const uint8_t *data, int length, uint8_t *frame, int size) {
+    int pos = 0;
+    int frame_pos = 0;
+
+    while (pos < length) {
+        frame_pos += read_varint(data, length, &pos);
+        int lit_len = read_varint(data, length, &pos);
+        fassert(frame_pos + lit_len <= size && pos + lit_len <= length);
+        for (int i = 0; i < lit_len; i++) {
+            frame[frame_pos + i] ^= data[pos + i];
+        }
+        frame_pos += lit_len;
+        pos += lit_len;
+    }
+}
+
+static std::string chunk_path(const std::string &dataset_dir, int chunk) {
+    return dataset_dir + "/chunk_" + std::to_string(chunk) + ".bin";
+}
+
+// chunk files can be larger than 2GB, which a long offset does not cover on every platform
+static int seek_file(FILE *f, int64_t offset) {
+#ifdef _WIN32
+    return _fseeki64(f, offset, SEEK_SET);
+#else
+    return fseeko(f, (off_t)offset, SEEK_SET);
+#endif
+}
+
+static std::vector<uint8_t> read_file(FILE *f) {
+    std::vector<uint8_t> data;
+    uint8_t buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+        data.insert(data.end(), buf, buf + n);
+    }
+    return data;
+}
+
+TrajectoryWriter::TrajectoryWriter(std::string dataset_dir, int num_envs, int keyframe_interval)
+    : dataset_dir(dataset_dir), num_envs(num_envs), keyframe_interval(keyframe_interval) {
+    fassert(keyframe_interval > 0);
+    prev_frames.resize(num_envs, std::vector<uint8_t>(FRAME_SIZE, 0));
+    steps_since_keyframe.resize(num_envs, 0);
+    index.resize(num_envs);
+    start_io_thread();
+}
+
+TrajectoryWriter::~TrajectoryWriter() {
+    if (io_thread.joinable()) {
+        stop_io_thread();
+    }
+
+    if (chunk_file != nullptr && fclose(chunk_file) != 0 && !failed) {
+        failed = true;
+        error = "failed to close dataset chunk " + chunk_path(dataset_dir, chunk_idx);
+    }
+    // without an index the reader only keeps the records that made it into the chunks
+    if (!abandoned && !failed) {
+        error = write_index();
+    }
+    if (error != "") {
+        fprintf(stderr, "unreported dataset error: %s\n", error.c_str());
+    }
+}
+
+void TrajectoryWriter::start_io_thread() {
+    time_to_die = false;
+    io_thread = std::thread(&TrajectoryWriter::io_worker, this);
+}
+
+void TrajectoryWriter::stop_io_thread() {
+    {
+        std::unique_lock<std::mutex> lock(queue_mutex);
+        time_to_die = true;
+    }
+    records_added.notify_all();
+    io_thread.join();
+
+    if (chunk_file != nullptr && fflush(chunk_file) != 0 && !failed) {
+        std::unique_lock<std::mutex> lock(queue_mutex);
+        failed = true;
+        error = "failed to write dataset chunk " + chunk_path(dataset_dir, chunk_idx);
+    }
+}
+
+void TrajectoryWriter::wait() {
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    while (num_unwritten > 0) {
+        records_written.wait(lock);
+    }
+}
+
+std::string TrajectoryWriter::take_error() {
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    std::string result = error;
+    error = "";
+    return result;
+}
+
+void TrajectoryWriter::abandon() {
+    fassert(!io_thread.joinable());
+    abandoned = true;
+}
+
+void TrajectoryWriter::add_step(Game *game, int action) {
+    PendingRecord record;
+
+    {
+        std::unique_lock<std::mutex> lock(queue_mutex);
+        if (!free_records.empty()) {
+            record = std::move(free_records.front());
+            free_records.pop_front();
+        }
+    }
+
+    int env_idx = game->game_n;
+    const uint8_t *frame = (const uint8_t *)(game->obs_bufs[0]);
+    auto &prev_frame = prev_frames[env_idx];
+
+    // episodes always start with a keyframe so that they can be decoded independently
+    record.env_idx = env_idx;
+    record.is_keyframe = game->step_data.done || steps_since_keyframe[env_idx] >= keyframe_interval;
+    if (record.is_keyframe) {
+        std::fill(prev_frame.begin(), prev_frame.end(), 0);
+        steps_since_keyframe[env_idx] = 0;
+    }
+    steps_since_keyframe[env_idx]++;
+
+    record.data.clear();
+    append_value<int32_t>(record.data, action);
+    append_value<float>(record.data, game->step_data.reward);
+    append_value<int32_t>(record.data, game->step_data.done);
+    append_value<int32_t>(record.data, game->current_level_seed);
+    append_value<int32_t>(record.data, record.is_keyframe);
+    append_value<int32_t>(record.data, env_idx);
+    append_value<int32_t>(record.data, 0);
+    encode_frame_delta(prev_frame.data(), frame, FRAME_SIZE, record.data);
+
+    int32_t payload_length = (int32_t)(record.data.size() - RECORD_HEADER_SIZE);
+    memcpy(&record.data[RECORD_HEADER_SIZE - sizeof(int32_t)], &payload_length, sizeof(int32_t));
+
+    memcpy(prev_frame.data(), frame, FRAME_SIZE);
+
+    {
+        std::unique_lock<std::mutex> lock(queue_mutex);
+        while ((int)(pending_records.size()) >= MAX_PENDING_RECORDS) {
+            records_written.wait(lock);
+        }
+        pending_records.push_back(std::move(record));
+        num_unwritten++;
+    }
+    records_added.notify_one();
+}
+
+void TrajectoryWriter::io_worker() {
+    while (1) {
+        PendingRecord record;
+
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            while (1) {
+                if (!pending_records.empty()) {
+                    record = std::move(pending_records.front());
+                    pending_records.pop_front();
+                    break;
+                }
+                // drain the queue before exiting so that no steps are lost
+                if (time_to_die) {
+                    return;
+                }
+
+                records_added.wait(lock);
+            }
+        }
+
+        // once a write has failed the dataset is cut off there, since later deltas could refer to missing frames
+        std::string record_error = failed ? "" : write_record(record);
+
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            if (record_error != "") {
+                failed = true;
+                if (error == "") {
+                    error = record_error;
+                }
+            }
+            free_records.push_back(std::move(record));
+            num_unwritten--;
+        }
+        records_written.notify_all();
+    }
+}
+
+std::string TrajectoryWriter::write_record(const PendingRecord &record) {
+    if (chunk_file == nullptr || chunk_offset >= CHUNK_BYTES) {
+        if (chunk_file != nullptr) {
+            int result = fclose(chunk_file);
+            chunk_file = nullptr;
+            if (result != 0) {
+                return "failed to close dataset chunk " + chunk_path(dataset_dir, chunk_idx);
+            }
+        }
+        chunk_idx++;
+        auto path = chunk_path(dataset_dir, chunk_idx);
+        chunk_file = fopen(path.c_str(), "wb");
+        if (chunk_file == nullptr) {
+            return "failed to open dataset chunk " + path;
+        }
+
+        // every chunk describes the dataset, so that the index can be rebuilt if it was never written
+        std::vector<uint8_t> header;
+        append_file_header(header, CHUNK_MAGIC);
+        if (fwrite(header.data(), 1, header.size(), chunk_file) != header.size()) {
+            return "failed to write dataset chunk " + path;
+        }
+        chunk_offset = header.size();
+    }
+
+    if (fwrite(record.data.data(), 1, record.data.size(), chunk_file) != record.data.size()) {
+        return "failed to write dataset chunk " + chunk_path(dataset_dir, chunk_idx);
+    }
+    index[record.env_idx].push_back(IndexEntry{chunk_idx, chunk_offset, record.is_keyframe});
+    chunk_offset += record.data.size();
+    return "";
+}
+
+void TrajectoryWriter::append_file_header(std::vector<uint8_t> &out, int32_t magic) {
+    append_value<int32_t>(out, magic);
+    append_value<int32_t>(out, DATASET_VERSION);
+    append_value<int32_t>(out, num_envs);
+    append_value<int32_t>(out, RES_W);
+    append_value<int32_t>(out, RES_H);
+    append_value<int32_t>(out, keyframe_interval);
+}
+
+std::string TrajectoryWriter::write_index() {
+    auto path = dataset_dir + "/index.bin";
+    FILE *f = fopen(path.c_str(), "wb");
+    if (f == nullptr) {
+        return "failed to open dataset index " + path;
+    }
+
+    std::vector<uint8_t> out;
+    append_file_header(out, INDEX_MAGIC);
+    for (const auto &entries : index) {
+        append_value<int32_t>(out, (int32_t)(entries.size()));
+        for (const auto &entry : entries) {
+            append_value<int32_t>(out, entry.chunk);
+            append_value<int64_t>(out, entry.offset);
+            append_value<uint8_t>(out, entry.is_keyframe);
+        }
+    }
+
+    bool ok = fwrite(out.data(), 1, out.size(), f) == out.size();
+    ok &= fclose(f) == 0;
+    if (!ok) {
+        // a partial index would hide records, the reader rebuilds a missing one from the chunks instead
+        remove(path.c_str());
+        return "failed to write dataset index " + path;
+    }
+    return "";
+}
+
+TrajectoryReader::TrajectoryReader(std::string dataset_dir) : dataset_dir(dataset_dir) {
+    auto path = dataset_dir + "/index.bin";
+    FILE *f = fopen(path.c_str(), "rb");
+    if (f == nullptr) {
+        rebuild_index();
+        return;
+    }
+    std::vector<uint8_t> data = read_file(f);
+    fclose(f);
+
+    int pos = 0;
+    int length = (int)(data.size());
+    fassert(length >= FILE_HEADER_SIZE);
+    fassert(parse_file_header(data.data(), &pos) == INDEX_MAGIC);
+
+    index.resize(num_envs);
+    for (auto &entries : index) {
+        fassert(pos + (int)sizeof(int32_t) <= length);
+        entries.resize(parse_value<int32_t>(data.data(), &pos));
+        fassert(pos + entries.size() * 13 <= data.size());
+        for (auto &entry : entries) {
+            entry.chunk = parse_value<int32_t>(data.data(), &pos);
+            entry.offset = parse_value<int64_t>(data.data(), &pos);
+            entry.is_keyframe = parse_value<uint8_t>(data.data(), &pos);
+        }
+    }
+}
+
+int32_t TrajectoryReader::parse_file_header(const uint8_t *data, int *pos) {
+    int32_t magic = parse_value<int32_t>(data, pos);
+    int32_t version = parse_value<int32_t>(data, pos);
+    if (version != DATASET_VERSION) {
+        fatal("unsupported dataset version %d in %s\n", version, dataset_dir.c_str());
+    }
+    num_envs = parse_value<int32_t>(data, pos);
+    width = parse_value<int32_t>(data, pos);
+    height = parse_value<int32_t>(data, pos);
+    parse_value<int32_t>(data, pos);
+    fassert(num_envs > 0 && width > 0 && height > 0);
+    frame_size = width * height * 3;
+    return magic;
+}
+
+void TrajectoryReader::rebuild_index() {
+    // the writer did not get to close the dataset, so find the records by walking the chunks, ignoring a
+    // record cut short at the end of the last one
+    for (int chunk = 0;; chunk++) {
+        auto path = chunk_path(dataset_dir, chunk);
+        FILE *f = fopen(path.c_str(), "rb");
+        if (f == nullptr) {
+            if (chunk == 0) {
+                fatal("dataset %s has neither an index nor any chunks\n", dataset_dir.c_str());
+            }
+            return;
+        }
+        std::vector<uint8_t> data = read_file(f);
+        fclose(f);
+
+        int pos = 0;
+        int64_t length = (int64_t)(data.size());
+        if (length < FILE_HEADER_SIZE) {
+            return;
+        }
+        fassert(parse_file_header(data.data(), &pos) == CHUNK_MAGIC);
+        index.resize(num_envs);
+
+        int64_t offset = pos;
+        while (offset + RECORD_HEADER_SIZE <= length) {
+            int header_pos = 4 * sizeof(int32_t);
+            bool is_keyframe = parse_value<int32_t>(data.data() + offset, &header_pos) != 0;
+            int32_t env_idx = parse_value<int32_t>(data.data() + offset, &header_pos);
+            int32_t payload_length = parse_value<int32_t>(data.data() + offset, &header_pos);
+            fassert(env_idx >= 0 && env_idx < num_envs && payload_length >= 0);
+            if (offset + RECORD_HEADER_SIZE + payload_length > length) {
+                break;
+            }
+            index[env_idx].push_back(IndexEntry{chunk, offset, is_keyframe});
+            offset += RECORD_HEADER_SIZE + payload_length;
+        }
+    }
+}
+
+int TrajectoryReader::num_steps(int env_idx) {
+    return (int)(index.at(env_idx).size());
+}
+
+void TrajectoryReader::read_one(int env_idx, int start, int count, uint8_t *obs, int32_t *actions, float *rewards, uint8_t *firsts, int32_t *level_seeds) {
+    const auto &entries = index.at(env_idx);
+    fassert(start >= 0 && count >= 0 && start + count <= (int)(entries.size()));
+
+    if (count == 0) {
+        return;
+    }
+
+    int first_idx = start;
+    while (!entries[first_idx].is_keyframe) {
+        fassert(first_idx > 0);
+        first_idx--;
+    }
+
+    std::map<int, FILE *> chunk_files;
+    std::vector<uint8_t> frame(frame_size, 0);
+    std::vector<uint8_t> record;
+
+    for (int i = first_idx; i < start + count; i++) {
+        const auto &entry = entries[i];
+        FILE *f = chunk_files[entry.chunk];
+        if (f == nullptr) {
+            auto path = chunk_path(dataset_dir, entry.chunk);
+            f = fopen(path.c_str(), "rb");
+            if (f == nullptr) {
+                fatal("failed to open dataset chunk %s\n", path.c_str());
+            }
+            chunk_files[entry.chunk] = f;
+        }
+
+        uint8_t header[RECORD_HEADER_SIZE];
+        fassert(seek_file(f, entry.offset) == 0);
+        fassert(fread(header, 1, RECORD_HEADER_SIZE, f) == RECORD_HEADER_SIZE);
+
+        int pos = 0;
+        int32_t action = parse_value<int32_t>(header, &pos);
+        float reward = parse_value<float>(header, &pos);
+        int32_t first = parse_value<int32_t>(header, &pos);
+        int32_t level_seed = parse_value<int32_t>(header, &pos);
+        int32_t is_keyframe = parse_value<int32_t>(header, &pos);
+        parse_value<int32_t>(header, &pos);
+        int32_t payload_length = parse_value<int32_t>(header, &pos);
+
+        record.resize(payload_length);
+        fassert(fread(record.data(), 1, payload_length, f) == (size_t)payload_length);
+
+        if (is_keyframe) {
+            std::fill(frame.begin(), frame.end(), 0);
+        }
+        decode_frame_delta(record.data(), payload_length, frame.data(), frame_size);
+
+        if (i >= start) {
+            int out_idx = i - start;
+            if (obs != nullptr) {
+                memcpy(obs + (size_t)out_idx * frame_size, frame.data(), frame_size);
+            }
+            if (actions != nullptr) {
+                actions[out_idx] = action;
+            }
+            if (rewards != nullptr) {
+                rewards[out_idx] = reward;
+            }
+            if (firsts != nullptr) {
+                firsts[out_idx] = (uint8_t)first;
+            }
+            if (level_seeds != nullptr) {
+                level_seeds[out_idx] = level_seed;
+            }
+        }
+    }
+
+    for (const auto &it : chunk_files) {
+        fclose(it.second);
+    }
+}
+
+void TrajectoryReader::read(int n, const int *env_idxs, const int *starts, int count, uint8_t *obs, int32_t *actions, float *rewards, uint8_t *firsts, int32_t *level_seeds, int num_threads) {
+    auto read_request = [&](int r) {
+        size_t offset = (size_t)r * count;
+        read_one(env_idxs[r], starts[r], count,
+                 obs == nullptr ? nullptr : obs + offset * frame_size,
+                 actions == nullptr ? nullptr : actions + offset,
+                 rewards == nullptr ? nullptr : rewards + offset,
+                 firsts == nullptr ? nullptr : firsts + offset,
+                 level_seeds == nullptr ? nullptr : level_seeds + offset);
+    };
+
+    if (num_threads <= 1 || n <= 1) {
+        for (int r = 0; r < n; r++) {
+            read_request(r);
+        }
+        return;
+    }
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < num_threads && t < n; t++) {
+        threads.emplace_back([&, t]() {
+            for (int r = t; r < n; r += num_threads) {
+                read_request(r);
+            }
+        });
+    }
+    for (auto &t : threads) {
+        t.join();
+    }
+}
+
+extern "C" {
+LIBENV_API void *trajectory_reader_open(const char *dataset_dir) {
+    return new TrajectoryReader(dataset_dir);
+}
+
+LIBENV_API int trajectory_reader_num_envs(void *handle) {
+    return ((TrajectoryReader *)(handle))->num_envs;
+}
+
+LIBENV_API int trajectory_reader_width(void *handle) {
+    return ((TrajectoryReader *)(handle))->width;
+}
+
+LIBENV_API int trajectory_reader_height(void *handle) {
+    return ((TrajectoryReader *)(handle))->height;
+}
+
+LIBENV_API int trajectory_reader_num_steps(void *handle, int env_idx) {
+    return ((TrajectoryReader *)(handle))->num_steps(env_idx);
+}
+
+LIBENV_API void trajectory_reader_read(void *handle, int n, const int *env_idxs, const int *starts, int count, uint8_t *obs, int32_t *actions, float *rewards, uint8_t *firsts, int32_t *level_seeds, int num_threads) {
+    ((TrajectoryReader *)(handle))->read(n, env_idxs, starts, count, obs, actions, rewards, firsts, level_seeds, num_threads);
+}
+
+LIBENV_API void trajectory_reader_close(void *handle) {
+    delete (TrajectoryReader *)(handle);
+}
+}
@@ -0,0 +1,130 @@
+#pragma once
+
+/*
+
+Compressed trajectory datasets
+
+Observations are stored as keyframes plus deltas against the previous frame of the same
+environment. Both are XORed against a reference frame (all zeros for keyframes) and run-length
+encoded, which works well since consecutive frames usually differ in only a few pixels.
+
+A dataset directory contains chunk_<n>.bin files holding one record per step and an index.bin
+file, written when the writer is closed, that lists the location of every record.  Every file starts
+with the number of environments and the frame size, and every record names its environment, so if
+the writer was never closed the reader rebuilds the index by walking the chunks.
+
+The writer stops at the first error writing a file, leaving the records written so far without an
+index, and keeps the error until it is reported by take_error(), the io thread never exits the process.
+
+*/
+
+#include <string>
+#include <vector>
+#include <list>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+class Game;
+
+void encode_frame_delta(const uint8_t *ref, const uint8_t *frame, int size, std::vector<uint8_t> &out);
+void decode_frame_delta(const uint8_t *data, int length, uint8_t *frame, int size);
+
+class TrajectoryWriter {
+  public:
+    TrajectoryWriter(std::string dataset_dir, int num_envs, int keyframe_interval);
+    ~TrajectoryWriter();
+
+    // called on the stepping thread that owns the game, right after the game has been observed
+    // action is the action that led to this observation, or -1 for the first observation
+    void add_step(Game *game, int action);
+
+    // blocks until every step added so far has been handed to the chunk files
+    void wait();
+    // returns the first error since the last call and forgets it, or an empty string if every write succeeded
+    std::string take_error();
+
+    // used around fork(), stopping writes every queued record and flushes the chunk file
+    void stop_io_thread();
+    void start_io_thread();
+    // closes the files without writing the index, for the copy of the writer in a forked child
+    void abandon();
+
+  private:
+    struct PendingRecord {
+        int env_idx = 0;
+        bool is_keyframe = false;
+        std::vector<uint8_t> data;
+    };
+
+    struct IndexEntry {
+        int chunk;
+        int64_t offset;
+        bool is_keyframe;
+    };
+
+    std::string dataset_dir;
+    int num_envs;
+    int keyframe_interval;
+
+    // only accessed by the stepping thread that currently owns the matching game
+    std::vector<std::vector<uint8_t>> prev_frames;
+    std::vector<int> steps_since_keyframe;
+
+    // this mutex synchronizes access to pending_records, free_records, num_unwritten, error and time_to_die
+    std::mutex queue_mutex;
+    std::condition_variable records_added;
+    std::condition_variable records_written;
+    std::list<PendingRecord> pending_records;
+    std::list<PendingRecord> free_records;
+    // records that are not yet in a chunk file, including the one the io thread is writing
+    int num_unwritten = 0;
+    std::thread io_thread;
+    bool time_to_die = false;
+    bool abandoned = false;
+    std::string error;
+
+    // only used by the io thread
+    bool failed = false;
+    FILE *chunk_file = nullptr;
+    int chunk_idx = -1;
+    int64_t chunk_offset = 0;
+    std::vector<std::vector<IndexEntry>> index;
+
+    void io_worker();
+    // returns an error message, or an empty string if the record was written
+    std::string write_record(const PendingRecord &record);
+    void append_file_header(std::vector<uint8_t> &out, int32_t magic);
+    std::string write_index();
+};
+
+class TrajectoryReader {
+  public:
+    int num_envs = 0;
+    int width = 0;
+    int height = 0;
+    int frame_size = 0;
+
+    TrajectoryReader(std::string dataset_dir);
+
+    int num_steps(int env_idx);
+
+    // decode count consecutive steps for each of the n (env_idx, start) pairs, spread over num_threads threads
+    // output arrays are indexed by [request][step], any of them may be null
+    void read(int n, const int *env_idxs, const int *starts, int count, uint8_t *obs, int32_t *actions, float *rewards, uint8_t *firsts, int32_t *level_seeds, int num_threads);
+
+  private:
+    struct IndexEntry {
+        int chunk;
+        int64_t offset;
+        bool is_keyframe;
+    };
+
+    std::string dataset_dir;
+    std::vector<std::vector<IndexEntry>> index;
+
+    // reads the header shared by the index and chunk files, returning its magic number
+    int32_t parse_file_header(const uint8_t *data, int *pos);
+    void rebuild_index();
+    void read_one(int env_idx, int start, int count, uint8_t *obs, int32_t *actions, float *rewards, uint8_t *firsts, int32_t *level_seeds);
+};
@@ -2,9 +2,26 @@
 #include "cpp-utils.h"
 #include "vecoptions.h"
 #include "game.h"
+#include "recorder.h"
+#include "trajectory.h"
+#include "checkpoint.h"
+#include "eval-levels.h"
+#include "sprite-batch.h"
+#include <set>
+#include <chrono>
+#include <cerrno>
+#include <cmath>
 
 const int32_t END_OF_BUFFER = 0xCAFECAFE;
 
+// in caller runs mode, batches expected to step faster than this are stepped by the calling thread alone,
+// since waking the stepping threads would take longer than the steps themselves
+const double INLINE_BATCH_SECONDS = 100e-6;
+// number of games the calling thread times before it trusts mean_step_seconds enough to skip the stepping threads
+const int MIN_STEP_SAMPLES = 8;
+// how long stepping threads spin in caller runs mode before sleeping, so that they pick up the next batch quickly
+const double HELPER_SPIN_SECONDS = 50e-6;
+
 extern void coinrun_old_init(int rand_seed);
 
 static std::once_flag global_init_flag;
@@ -24,6 +41,21 @@ std::vector<std::string> split(std::string s, std::string delimiter) {
     return env_names;
 }
 
+// parses a comma separated list of ints from the named option, failing with a message on anything else
+static std::vector<int> parse_int_list(const std::string &s, const char *option_name) {
+    std::vector<int> values;
+    for (const auto &value_str : split(s, ",")) {
+        char *end = nullptr;
+        errno = 0;
+        long value = strtol(value_str.c_str(), &end, 10);
+        if (value_str.empty() || *end != '\0' || errno == ERANGE || value < INT32_MIN || value > INT32_MAX) {
+            fatal("invalid value \"%s\" in %s\n", value_str.c_str(), option_name);
+        }
+        values.push_back((int)(value));
+    }
+    return values;
+}
+
 // libenv api
 
 // convert_bufs reorganizes buffers so that they are indexed by the environment
@@ -100,12 +132,189 @@ void libenv_close(libenv_env *handle) {
 
 // end libenv api
 
+static void record_step(Game *game, int action) {
+    if (game->recorder != nullptr) {
+        game->recorder->record(game);
+    }
+
+    if (game->trajectory_writer != nullptr) {
+        game->trajectory_writer->add_step(game, action);
+    }
+}
+
+static void choose_policy_action(Game *game) {
+    const StepPolicy *policy = game->policy;
+    game->action = policy->fn(policy->user_data, game->game_n, (const uint8_t *)(game->obs_bufs[0]), game->info_bufs.data(), *game->reward_ptr, *game->first_ptr);
+}
+
+// policy that follows each game's oracle, falling back to the default action for games without one
+static int32_t oracle_policy(void *user_data, int env_idx, const uint8_t *obs, void *const *info, float reward, uint8_t first) {
+    auto venv = (VecGame *)(user_data);
+    const auto &game = venv->games[env_idx];
+    int action = game->oracle_action();
+    return action < 0 ? game->default_action : action;
+}
+
+static void log_policy_step(Game *game, int step, int action) {
+    const StepPolicy *policy = game->policy;
+    int idx = game->game_n * policy->steps_per_act + step;
+
+    if (policy->log_actions != nullptr) {
+        policy->log_actions[idx] = action;
+    }
+    if (policy->log_rewards != nullptr) {
+        policy->log_rewards[idx] = *game->reward_ptr;
+    }
+    if (policy->log_firsts != nullptr) {
+        policy->log_firsts[idx] = *game->first_ptr;
+    }
+    if (policy->log_obs != nullptr) {
+        memcpy(policy->log_obs + (size_t)(idx)*RES_W * RES_H * 3, game->obs_bufs[0], RES_W * RES_H * 3);
+    }
+}
+
+static void add_to_checkpoint(Game *game) {
+    if (game->checkpoint_arena >= 0) {
+        game->checkpointer->add_game(game, game->checkpoint_arena);
+        game->checkpoint_arena = -1;
+    }
+}
+
+// the first time the game is stepped is before any action, just to initialize
+// the environment and produce the initial observation
+static int num_steps_to_take(Game *game) {
+    if (!game->initial_reset_complete || game->policy == nullptr) {
+        return 1;
+    }
+    return game->policy->steps_per_act;
+}
+
+// runs one step of the game up to its observation, returns the action taken or -1 for the initial reset
+static int advance_game(Game *game) {
+    if (!game->initial_reset_complete) {
+        game->reset();
+        game->observe();
+        game->initial_reset_complete = true;
+        return -1;
+    }
+
+    // the action is reset to the default when an episode ends, so save the one we were given
+    int action = game->action;
+    game->step();
+    return action;
+}
+
+// everything that reads the observation of a step, step is -1 for the initial reset
+static void finish_game_step(Game *game, int step, int action) {
+    record_step(game, action);
+
+    if (game->policy != nullptr) {
+        if (step >= 0) {
+            log_policy_step(game, step, action);
+        }
+        choose_policy_action(game);
+    }
+}
+
+static void step_game(const std::shared_ptr<Game> &game) {
+    int num_steps = num_steps_to_take(game.get());
+    for (int i = 0; i < num_steps; i++) {
+        int step = game->initial_reset_complete ? i : -1;
+        int action = advance_game(game.get());
+        finish_game_step(game.get(), step, action);
+    }
+    add_to_checkpoint(game.get());
+}
+
+static SpriteBatch *thread_sprite_batch() {
+    // like the render buffer, each stepping thread keeps its own batch so that its buffers stay allocated
+    static thread_local std::unique_ptr<SpriteBatch> batch;
+    if (batch == nullptr) {
+        batch = std::make_unique<SpriteBatch>();
+    }
+    return batch.get();
+}
+
+// steps a chunk of games, in lockstep when batch_render is set so that the observations of each step are drawn as one sprite batch
+// batch_render must not depend on the size of the chunk, which depends on timing, so that every frame is drawn the same way
+static void step_games(const std::vector<std::shared_ptr<Game>> &chunk, bool batch_render) {
+    if (!batch_render) {
+        for (const auto &game : chunk) {
+            step_game(game);
+        }
+        return;
+    }
+
+    struct ChunkStep {
+        int num_steps;
+        int step;
+        int action;
+    };
+    static thread_local std::vector<ChunkStep> steps;
+    steps.resize(chunk.size());
+
+    SpriteBatch *batch = thread_sprite_batch();
+    int max_steps = 0;
+    for (size_t k = 0; k < chunk.size(); k++) {
+        steps[k].num_steps = num_steps_to_take(chunk[k].get());
+        max_steps = std::max(max_steps, steps[k].num_steps);
+    }
+
+    for (int i = 0; i < max_steps; i++) {
+        for (size_t k = 0; k < chunk.size(); k++) {
+            Game *game = chunk[k].get();
+            if (i < steps[k].num_steps) {
+                steps[k].step = game->initial_reset_complete ? i : -1;
+                game->render_batch = batch;
+                steps[k].action = advance_game(game);
+                game->render_batch = nullptr;
+            }
+        }
+
+        batch->flush();
+
+        for (size_t k = 0; k < chunk.size(); k++) {
+            if (i < steps[k].num_steps) {
+                finish_game_step(chunk[k].get(), steps[k].step, steps[k].action);
+            }
+        }
+    }
+
+    for (const auto &game : chunk) {
+        add_to_checkpoint(game.get());
+    }
+}
+
+// moves up to max_games games from the front of pending_games into chunk, called with the stepping thread mutex held
+// takes no more than an even share of the pending games, so that one thread doesn't take a whole batch while the others are idle
+static void take_pending_games(std::list<std::shared_ptr<Game>> &pending_games, std::atomic<int> &num_pending_games, int max_games, int num_workers, std::vector<std::shared_ptr<Game>> &chunk) {
+    int share = ((int)(pending_games.size()) + num_workers - 1) / num_workers;
+    max_games = std::max(1, std::min(max_games, share));
+    while (!pending_games.empty() && (int)(chunk.size()) < max_games) {
+        chunk.push_back(pending_games.front());
+        pending_games.pop_front();
+        num_pending_games--;
+    }
+}
+
 static void stepping_worker(std::mutex &stepping_thread_mutex,
                             std::list<std::shared_ptr<Game>> &pending_games,
                             std::condition_variable &pending_games_added,
-                            std::condition_variable &pending_game_complete, bool &time_to_die) {
+                            std::condition_variable &pending_game_complete, bool &time_to_die,
+                            int &num_initializing_threads, std::atomic<int> &num_pending_games,
+                            std::atomic<int64_t> &num_spin_pickups, bool spin_before_waiting, int render_batch_size, int num_workers, std::function<void()> init_fn) {
+    init_fn();
+
+    {
+        std::unique_lock<std::mutex> lock(stepping_thread_mutex);
+        num_initializing_threads--;
+        pending_game_complete.notify_all();
+    }
+
+    std::vector<std::shared_ptr<Game>> chunk;
+
     while (1) {
-        std::shared_ptr<Game> game;
+        chunk.clear();
 
         {
             std::unique_lock<std::mutex> lock(stepping_thread_mutex);
@@ -114,28 +323,37 @@ static void stepping_worker(std::mutex &stepping_thread_mutex,
                     return;
                 }
                 if (!pending_games.empty()) {
-                    game = pending_games.front();
-                    pending_games.pop_front();
+                    take_pending_games(pending_games, num_pending_games, render_batch_size, num_workers, chunk);
                     break;
                 }
 
+                if (spin_before_waiting) {
+                    lock.unlock();
+                    auto spin_end = std::chrono::steady_clock::now() + std::chrono::duration<double>(HELPER_SPIN_SECONDS);
+                    while (num_pending_games.load() == 0 && std::chrono::steady_clock::now() < spin_end) {
+                        std::this_thread::yield();
+                    }
+                    lock.lock();
+                    if (!pending_games.empty()) {
+                        num_spin_pickups++;
+                        continue;
+                    }
+                    if (time_to_die) {
+                        return;
+                    }
+                }
+
                 pending_games_added.wait(lock);
             }
         }
 
-        // the first time the threads are activated is before any step, just to initialize
-        // the environment and produce the initial observation
-        if (!game->initial_reset_complete) {
-            game->reset();
-            game->observe();
-            game->initial_reset_complete = true;
-        } else{
-            game->step();
-        }
+        step_games(chunk, render_batch_size > 1);
 
         {
             std::unique_lock<std::mutex> lock(stepping_thread_mutex);
-            game->is_waiting_for_step = false;
+            for (const auto &game : chunk) {
+                game->is_waiting_for_step = false;
+            }
             pending_game_complete.notify_all();
         }
     }
@@ -179,6 +397,20 @@ VecGame::VecGame(int _nenvs, VecOptions opts) {
     int rand_seed = 0;
     int num_threads = 4;
     std::string resource_root;
+    std::string record_dir;
+    std::string record_envs;
+    std::string eval_level_seeds;
+    bool record_hires = false;
+    bool oracle_info = false;
+    bool goal_distance_info = false;
+    bool agent_pos_info = false;
+    bool terminal_obs = false;
+    bool segmentation_obs = false;
+    bool game_arena = false;
+    bool game_arena_hugepages = false;
+    int game_arena_block_size = (int)(ARENA_DEFAULT_BLOCK_SIZE);
+    std::string dataset_dir;
+    int dataset_keyframe_interval = 32;
 
     opts.consume_string("env_name", &env_name);
     opts.consume_int("num_levels", &num_levels);
@@ -188,26 +420,35 @@ VecGame::VecGame(int _nenvs, VecOptions opts) {
     opts.consume_int("num_threads", &num_threads);
     opts.consume_string("resource_root", &resource_root);
     opts.consume_bool("render_human", &render_human);
+    opts.consume_string("record_dir", &record_dir);
+    opts.consume_string("record_envs", &record_envs);
+    opts.consume_string("eval_level_seeds", &eval_level_seeds);
+    opts.consume_bool("record_hires", &record_hires);
+    opts.consume_bool("oracle_info", &oracle_info);
+    opts.consume_bool("goal_distance_info", &goal_distance_info);
+    opts.consume_bool("agent_pos_info", &agent_pos_info);
+    opts.consume_bool("terminal_obs", &terminal_obs);
+    opts.consume_bool("segmentation_obs", &segmentation_obs);
+    opts.consume_bool("game_arena", &game_arena);
+    opts.consume_bool("game_arena_hugepages", &game_arena_hugepages);
+    opts.consume_int("game_arena_block_size", &game_arena_block_size);
+    opts.consume_string("dataset_dir", &dataset_dir);
+    opts.consume_int("dataset_keyframe_interval", &dataset_keyframe_interval);
+    opts.consume_bool("caller_runs", &caller_runs);
+    opts.consume_int("render_batch_size", &render_batch_size);
 
     std::call_once(global_init_flag, global_init, rand_seed,
                    resource_root);
 
-    fassert(num_threads >= 0);
-    threads.resize(num_threads);
-    for (int t = 0; t < num_threads; t++) {
-        threads[t] = std::thread(
-            stepping_worker,
-            std::ref(stepping_thread_mutex),
-            std::ref(pending_games),
-            std::ref(pending_games_added),
-            std::ref(pending_game_complete),
-            std::ref(time_to_die));
-    }
+    GameOptions game_options;
+    int game_type = 0;
+    parse_game_options(opts, &game_options, &game_type);
 
     fassert(env_name != "");
     fassert(num_actions > 0);
     fassert(num_levels >= 0);
     fassert(start_level >= 0);
+    fassert(game_arena_block_size >= (int)(ARENA_MAX_ALLOC_SIZE));
 
     {
         struct libenv_tensortype s;
@@ -223,6 +464,19 @@ VecGame::VecGame(int _nenvs, VecOptions opts) {
         observation_types.push_back(s);
     }
 
+    if (segmentation_obs) {
+        struct libenv_tensortype s;
+        strcpy(s.name, "seg");
+        s.scalar_type = LIBENV_SCALAR_TYPE_DISCRETE;
+        s.dtype = LIBENV_DTYPE_UINT8;
+        s.shape[0] = RES_W;
+        s.shape[1] = RES_H;
+        s.ndim = 2;
+        s.low.uint8 = 0;
+        s.high.uint8 = 255;
+        observation_types.push_back(s);
+    }
+
     {
         struct libenv_tensortype s;
         strcpy(s.name, "action");
@@ -267,6 +521,72 @@ VecGame::VecGame(int _nenvs, VecOptions opts) {
         info_types.push_back(s);
     }
     
+    if (oracle_info) {
+        struct libenv_tensortype s;
+        strcpy(s.name, "oracle_action");
+        s.scalar_type = LIBENV_SCALAR_TYPE_DISCRETE;
+        s.dtype = LIBENV_DTYPE_INT32;
+        s.ndim = 0,
+        s.low.int32 = -1;
+        s.high.int32 = num_actions - 1;
+        info_types.push_back(s);
+    }
+
+    if (goal_distance_info) {
+        struct libenv_tensortype s;
+        strcpy(s.name, "goal_distance");
+        s.scalar_type = LIBENV_SCALAR_TYPE_DISCRETE;
+        s.dtype = LIBENV_DTYPE_INT32;
+        s.ndim = 0,
+        s.low.int32 = -1;
+        s.high.int32 = INT32_MAX;
+        info_types.push_back(s);
+    }
+
+    if (agent_pos_info) {
+        for (const char *name : {"agent_x", "agent_y"}) {
+            struct libenv_tensortype s;
+            strcpy(s.name, name);
+            s.scalar_type = LIBENV_SCALAR_TYPE_REAL;
+            s.dtype = LIBENV_DTYPE_FLOAT32;
+            s.ndim = 0,
+            s.low.float32 = -INFINITY;
+            s.high.float32 = INFINITY;
+            info_types.push_back(s);
+        }
+    }
+
+    if (terminal_obs) {
+        struct libenv_tensortype s;
+        strcpy(s.name, "terminal_rgb");
+        s.scalar_type = LIBENV_SCALAR_TYPE_DISCRETE;
+        s.dtype = LIBENV_DTYPE_UINT8;
+        s.shape[0] = RES_H;
+        s.shape[1] = RES_W;
+        s.shape[2] = 3;
+        s.ndim = 3,
+        s.low.uint8 = 0;
+        s.high.uint8 = 255;
+        info_types.push_back(s);
+
+        strcpy(s.name, "truncated");
+        s.ndim = 0,
+        s.high.uint8 = 1;
+        info_types.push_back(s);
+    }
+
+    if (game_options.augment.enabled()) {
+        struct libenv_tensortype s;
+        strcpy(s.name, "augment");
+        s.scalar_type = LIBENV_SCALAR_TYPE_REAL;
+        s.dtype = LIBENV_DTYPE_FLOAT32;
+        s.shape[0] = AUGMENT_NUM_PARAMS;
+        s.ndim = 1,
+        s.low.float32 = -INFINITY;
+        s.high.float32 = INFINITY;
+        info_types.push_back(s);
+    }
+
     if (render_human) {
         struct libenv_tensortype s;
         strcpy(s.name, "rgb");
@@ -301,33 +621,173 @@ VecGame::VecGame(int _nenvs, VecOptions opts) {
     RandGen game_level_seed_gen;
     game_level_seed_gen.seed(rand_seed);
 
+    if (eval_level_seeds != "") {
+        // levels are shared between environments as serialized states, which can't hold generated assets
+        fassert(!game_options.use_generated_assets);
+        std::vector<std::string> game_names;
+        for (int n = 0; n < num_envs; n++) {
+            game_names.push_back(env_names[n % num_joint_games]);
+        }
+        eval_levels = std::make_unique<EvalLevels>(parse_int_list(eval_level_seeds, "eval_level_seeds"), game_names);
+    }
+
+    for (const auto &name : env_names) {
+        if (globalGameRegistry->count(name) == 0) {
+            fatal("unknown env_name %s\n", name.c_str());
+        }
+        check_game_options(name, game_options);
+    }
+
+    // games declare their own info values in their constructors, joint games share values with the same name
+    std::set<std::string> game_info_names;
+    for (const auto &name : env_names) {
+        auto prototype = globalGameRegistry->at(name)(nullptr);
+        for (const auto &field : prototype->info_fields) {
+            if (game_info_names.count(field.name) > 0) {
+                for (const auto &t : info_types) {
+                    if (field.name == t.name) {
+                        fassert(field.dtype == t.dtype);
+                    }
+                }
+                continue;
+            }
+            game_info_names.insert(field.name);
+
+            struct libenv_tensortype s;
+            fassert(field.name.size() < LIBENV_MAX_NAME_LEN);
+            strcpy(s.name, field.name.c_str());
+            s.dtype = field.dtype;
+            s.ndim = 0;
+            if (field.dtype == LIBENV_DTYPE_INT32) {
+                s.scalar_type = LIBENV_SCALAR_TYPE_DISCRETE;
+                s.low.int32 = INT32_MIN;
+                s.high.int32 = INT32_MAX;
+            } else {
+                s.scalar_type = LIBENV_SCALAR_TYPE_REAL;
+                s.low.float32 = -INFINITY;
+                s.high.float32 = INFINITY;
+            }
+            info_types.push_back(s);
+        }
+    }
+
     std::map<std::string, int> info_name_to_offset;
     for (size_t i = 0; i < info_types.size(); i++) {
+        fassert(info_name_to_offset.count(info_types[i].name) == 0);
         info_name_to_offset[info_types[i].name] = i;
     }
 
+    // resolved once here so that games never look up info values by name
+    auto find_info_slot = [&](const std::string &name) {
+        auto it = info_name_to_offset.find(name);
+        return it == info_name_to_offset.end() ? -1 : it->second;
+    };
+    InfoSlots info_slots;
+    info_slots.prev_level_seed = find_info_slot("prev_level_seed");
+    info_slots.prev_level_complete = find_info_slot("prev_level_complete");
+    info_slots.level_seed = find_info_slot("level_seed");
+    info_slots.oracle_action = find_info_slot("oracle_action");
+    info_slots.goal_distance = find_info_slot("goal_distance");
+    info_slots.agent_x = find_info_slot("agent_x");
+    info_slots.agent_y = find_info_slot("agent_y");
+    info_slots.terminal_rgb = find_info_slot("terminal_rgb");
+    info_slots.truncated = find_info_slot("truncated");
+    info_slots.augment = find_info_slot("augment");
+    info_slots.rgb = find_info_slot("rgb");
+
+    // level seed generators are seeded in env order so that they don't depend on which thread creates the game
+    std::vector<int> level_seed_gen_seeds(num_envs);
     for (int n = 0; n < num_envs; n++) {
-        auto name = env_names[n % num_joint_games];
+        level_seed_gen_seeds[n] = game_level_seed_gen.randint();
+    }
+    // drawn after the level seeds so that enabling augmentation leaves the levels unchanged
+    std::vector<int> augment_seeds(num_envs);
+    if (game_options.augment.enabled()) {
+        for (int n = 0; n < num_envs; n++) {
+            augment_seeds[n] = game_level_seed_gen.randint();
+        }
+    }
+
+    std::atomic<int> next_game_to_init(0);
+    auto init_games = [&]() {
+        while (1) {
+            int n = next_game_to_init++;
+            if (n >= num_envs) {
+                return;
+            }
+
+            auto name = env_names[n % num_joint_games];
+
+            // games are created by the stepping threads, so an arena is first touched by a thread that steps it
+            std::shared_ptr<Arena> arena;
+            if (game_arena || game_arena_hugepages) {
+                arena = std::make_shared<Arena>(game_arena_hugepages, (size_t)(game_arena_block_size));
+            }
+            auto game = globalGameRegistry->at(name)(arena);
+            fassert(game->game_name == name);
+            game->level_seed_rand_gen.seed(level_seed_gen_seeds[n]);
+            if (game_options.augment.enabled()) {
+                game->augment_rand_gen.seed(augment_seeds[n]);
+            }
+            game->level_seed_high = level_seed_high;
+            game->level_seed_low = level_seed_low;
+            game->game_n = n;
+            game->eval_levels = eval_levels.get();
+            game->is_waiting_for_step = false;
+            // games may change their own options, so each gets a copy
+            game->options = game_options;
+            game->game_type = game_type;
+            game->info_slots = info_slots;
+            game->seg_obs_slot = segmentation_obs ? 1 : -1;
+            for (size_t i = 0; i < game->info_fields.size(); i++) {
+                game->info_field_slots[i] = info_name_to_offset.at(game->info_fields[i].name);
+            }
+
+            // Auto-selected a fixed_asset_seed if one wasn't specified on
+            // construction
+            if (game->fixed_asset_seed == 0) {
+                auto hashed = hash_str_uint32(name);
+                game->fixed_asset_seed = int(hashed);
+            }
 
-        games[n] = globalGameRegistry->at(name)();
-        fassert(games[n]->game_name == name);
-        games[n]->level_seed_rand_gen.seed(game_level_seed_gen.randint());
-        games[n]->level_seed_high = level_seed_high;
-        games[n]->level_seed_low = level_seed_low;
-        games[n]->game_n = n;
-        games[n]->is_waiting_for_step = false;
-        games[n]->parse_options(name, opts);
-        games[n]->info_name_to_offset = info_name_to_offset;
+            game->game_init();
+            games[n] = game;
+        }
+    };
+
+    // create and initialize the games on the stepping threads, each thread runs init_games once before it starts stepping
+    fassert(num_threads >= 0);
+    fassert(render_batch_size >= 1);
+    threads.resize(num_threads);
+    if (num_threads == 0) {
+        init_games();
+    } else {
+        start_stepping_threads(init_games);
+    }
 
-        // Auto-selected a fixed_asset_seed if one wasn't specified on
-        // construction
-        if (games[n]->fixed_asset_seed == 0) {
-            auto hashed = hash_str_uint32(name);
-            games[n]->fixed_asset_seed = int(hashed);
+    if (record_dir != "") {
+        recorder = std::make_unique<FrameRecorder>(record_dir, record_hires);
+
+        if (record_envs == "") {
+            for (int n = 0; n < num_envs; n++) {
+                games[n]->recorder = recorder.get();
+            }
+        } else {
+            for (int env_idx : parse_int_list(record_envs, "record_envs")) {
+                fassert(env_idx >= 0 && env_idx < num_envs);
+                games[env_idx]->recorder = recorder.get();
+            }
         }
+    }
+
+    if (dataset_dir != "") {
+        trajectory_writer = std::make_unique<TrajectoryWriter>(dataset_dir, num_envs, dataset_keyframe_interval);
 
-        games[n]->game_init();
+        for (int n = 0; n < num_envs; n++) {
+            games[n]->trajectory_writer = trajectory_writer.get();
+        }
     }
+
 }
 
 void VecGame::set_buffers(const std::vector<std::vector<void *>> &ac, const std::vector<std::vector<void *>> &ob, const std::vector<std::vector<void *>> &info, float *rew, uint8_t *first) {
@@ -346,17 +806,19 @@ void VecGame::set_buffers(const std::vector<std::vector<void *>> &ac, const std:
             // render the initial state so we don't see a black screen on the first frame
             fassert(!game->is_waiting_for_step);
             fassert(!game->initial_reset_complete);
-            if (threads.size() == 0) {
-                // special case for no threads
-                game->reset();
-                game->observe();
-                game->initial_reset_complete = true;
-            } else {
+            if (threads.size() > 0) {
                 game->is_waiting_for_step = true;
                 pending_games.push_back(game);
+                num_pending_games++;
             }
         }
     }
+
+    if (threads.size() == 0) {
+        // special case for no threads
+        step_games_inline();
+        return;
+    }
     pending_games_added.notify_all();
 }
 
@@ -365,12 +827,12 @@ void VecGame::observe() {
     // at this point all games belong to the python thread
 
     if (render_human) {
-        uint8_t render_hires_buf[RENDER_RES * RENDER_RES * 4];
+        uint32_t *render_hires_buf = thread_render_buf(RENDER_RES, RENDER_RES);
 
         for (int e = 0; e < num_envs; e++) {
             const auto &game = games[e];
             game->render_to_buf(render_hires_buf, RENDER_RES, RENDER_RES, true);
-            bgr32_to_rgb888(game->info_bufs[game->info_name_to_offset.at("rgb")], render_hires_buf, RENDER_RES, RENDER_RES);
+            bgr32_to_rgb888(game->info_bufs[game->info_slots.rgb], render_hires_buf, RENDER_RES, RENDER_RES);
         }
     }
 }
@@ -378,6 +840,9 @@ void VecGame::observe() {
 void VecGame::act() {
     wait_for_stepping_threads();
 
+    bool step_times_known = num_step_samples >= MIN_STEP_SAMPLES;
+    bool step_inline = threads.size() == 0 || (caller_runs && step_times_known && num_envs * mean_step_seconds < INLINE_BATCH_SECONDS);
+
     {
         std::unique_lock<std::mutex> lock(stepping_thread_mutex);
 
@@ -385,22 +850,118 @@ void VecGame::act() {
             const auto &game = games[e];
             fassert(!game->is_waiting_for_step);
             // save the action since it's only valid for the duration of this call
-            game->action = *game->action_ptr;
-            if (threads.size() == 0) {
-                // special case for no threads
-                game->step();
-            } else {
+            if (game->policy == nullptr) {
+                game->action = *game->action_ptr;
+            }
+            game->checkpoint_arena = requested_checkpoint_arena;
+            if (!step_inline) {
                 game->is_waiting_for_step = true;
                 pending_games.push_back(game);
+                num_pending_games++;
             }
         }
     }
+    requested_checkpoint_arena = -1;
+
+    if (step_inline) {
+        step_games_inline();
+        return;
+    }
     // at this point all games belong to the stepping threads
 
     pending_games_added.notify_all();
+
+    if (caller_runs) {
+        step_pending_games();
+    }
+}
+
+void VecGame::step_games_inline() {
+    for (int e = 0; e < num_envs; e += render_batch_size) {
+        caller_chunk.assign(games.begin() + e, games.begin() + std::min(num_envs, e + render_batch_size));
+        timed_step_games(caller_chunk);
+    }
+}
+
+int VecGame::num_stepping_workers() const {
+    return (int)(threads.size()) + (caller_runs ? 1 : 0);
+}
+
+void VecGame::timed_step_games(const std::vector<std::shared_ptr<Game>> &chunk) {
+    if (!caller_runs) {
+        step_games(chunk, render_batch_size > 1);
+        return;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    step_games(chunk, render_batch_size > 1);
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (num_step_samples == 0) {
+        mean_step_seconds = elapsed / chunk.size();
+    } else {
+        mean_step_seconds = 0.9 * mean_step_seconds + 0.1 * elapsed / chunk.size();
+    }
+    num_step_samples = std::min(num_step_samples + (int)(chunk.size()), MIN_STEP_SAMPLES);
+}
+
+void VecGame::step_pending_games() {
+    // the calling thread takes games from the same queue as the stepping threads until it is empty
+    while (1) {
+        caller_chunk.clear();
+
+        {
+            std::unique_lock<std::mutex> lock(stepping_thread_mutex);
+            if (pending_games.empty()) {
+                return;
+            }
+            take_pending_games(pending_games, num_pending_games, render_batch_size, num_stepping_workers(), caller_chunk);
+        }
+
+        timed_step_games(caller_chunk);
+
+        {
+            std::unique_lock<std::mutex> lock(stepping_thread_mutex);
+            for (const auto &game : caller_chunk) {
+                game->is_waiting_for_step = false;
+            }
+        }
+    }
 }
 
 VecGame::~VecGame() {
+    stop_stepping_threads();
+}
+
+void VecGame::start_stepping_threads(std::function<void()> init_fn) {
+    if (threads.size() == 0) {
+        return;
+    }
+
+    num_initializing_threads = (int)(threads.size());
+    for (auto &t : threads) {
+        t = std::thread(
+            stepping_worker,
+            std::ref(stepping_thread_mutex),
+            std::ref(pending_games),
+            std::ref(pending_games_added),
+            std::ref(pending_game_complete),
+            std::ref(time_to_die),
+            std::ref(num_initializing_threads),
+            std::ref(num_pending_games),
+            std::ref(num_spin_pickups),
+            caller_runs,
+            render_batch_size,
+            num_stepping_workers(),
+            init_fn);
+    }
+
+    std::unique_lock<std::mutex> lock(stepping_thread_mutex);
+    while (num_initializing_threads > 0) {
+        pending_game_complete.wait(lock);
+    }
+}
+
+void VecGame::stop_stepping_threads() {
     wait_for_stepping_threads();
     {
         std::unique_lock<std::mutex> lock(stepping_thread_mutex);
@@ -411,6 +972,192 @@ VecGame::~VecGame() {
     for (auto &t : threads) {
         t.join();
     }
+
+    time_to_die = false;
+}
+
+void VecGame::prepare_fork() {
+    // fork() only copies the calling thread, so no other thread may be holding a lock or a game when it
+    // happens, and nothing may be left in the stdio buffers that both processes would write out
+    if (checkpointer != nullptr) {
+        finish_checkpoints();
+    }
+    stop_stepping_threads();
+    if (recorder != nullptr) {
+        recorder->stop_io_thread();
+    }
+    if (trajectory_writer != nullptr) {
+        trajectory_writer->stop_io_thread();
+    }
+    if (checkpointer != nullptr) {
+        checkpointer->stop_io_thread();
+    }
+}
+
+void VecGame::finish_fork(bool is_child) {
+    if (is_child) {
+        // the parent keeps writing the recordings and datasets, the child closes its copies of the files
+        if (trajectory_writer != nullptr) {
+            trajectory_writer->abandon();
+        }
+        // errors of earlier checkpoints are reported by the parent
+        if (checkpointer != nullptr) {
+            checkpointer->take_error();
+        }
+        recorder.reset();
+        trajectory_writer.reset();
+        checkpointer.reset();
+        for (const auto &game : games) {
+            game->recorder = nullptr;
+            game->trajectory_writer = nullptr;
+            game->checkpointer = nullptr;
+        }
+    } else {
+        if (recorder != nullptr) {
+            recorder->start_io_thread();
+        }
+        if (trajectory_writer != nullptr) {
+            trajectory_writer->start_io_thread();
+        }
+        if (checkpointer != nullptr) {
+            checkpointer->start_io_thread();
+        }
+    }
+    start_stepping_threads([]() {});
+}
+
+void VecGame::checkpoint(const std::string &path) {
+    if (checkpointer == nullptr) {
+        wait_for_stepping_threads();
+        checkpointer = std::make_unique<Checkpointer>(num_envs);
+        for (const auto &game : games) {
+            game->checkpointer = checkpointer.get();
+        }
+    }
+
+    // a second request before act() replaces the states the first one would have captured
+    add_requested_checkpoint_now();
+    requested_checkpoint_arena = checkpointer->begin(path);
+}
+
+void VecGame::add_requested_checkpoint_now() {
+    if (requested_checkpoint_arena < 0) {
+        return;
+    }
+
+    wait_for_stepping_threads();
+    // at this point all games belong to the calling thread
+    for (const auto &game : games) {
+        checkpointer->add_game(game.get(), requested_checkpoint_arena);
+    }
+    requested_checkpoint_arena = -1;
+}
+
+std::string VecGame::wait_for_checkpoints() {
+    if (checkpointer == nullptr) {
+        return "";
+    }
+
+    finish_checkpoints();
+    return checkpointer->take_error();
+}
+
+std::string VecGame::wait_for_recordings() {
+    if (recorder == nullptr) {
+        return "";
+    }
+
+    // the frames of the last act() are only recorded once every game has been stepped
+    wait_for_stepping_threads();
+    recorder->wait();
+    return recorder->take_error();
+}
+
+std::string VecGame::wait_for_dataset() {
+    if (trajectory_writer == nullptr) {
+        return "";
+    }
+
+    // the steps of the last act() are only added once every game has been stepped
+    wait_for_stepping_threads();
+    trajectory_writer->wait();
+    return trajectory_writer->take_error();
+}
+
+void VecGame::finish_checkpoints() {
+    add_requested_checkpoint_now();
+    // the checkpoint started by the last act() is only complete once every game has been stepped
+    wait_for_stepping_threads();
+    checkpointer->wait();
+}
+
+std::string VecGame::restore_checkpoint(const std::string &path, int num_threads) {
+    std::vector<std::vector<char>> states;
+    std::string error = read_checkpoint(path, &states);
+    if (error != "") {
+        return error;
+    }
+    if ((int)(states.size()) != num_envs) {
+        return "checkpoint file " + path + " has " + std::to_string(states.size()) + " environments, expected " + std::to_string(num_envs);
+    }
+    for (int e = 0; e < num_envs; e++) {
+        error = games[e]->check_serialized_header(states[e].data(), states[e].size());
+        if (error != "") {
+            return "can't restore environment " + std::to_string(e) + " from checkpoint file " + path + ": " + error;
+        }
+    }
+
+    wait_for_stepping_threads();
+    // at this point all games belong to the calling thread, which lends them to the restoring threads
+
+    auto restore_game = [&](int e) {
+        const auto &game = games[e];
+        auto b = ReadBuffer(states[e].data(), states[e].size());
+        {
+            AllocPhaseScope alloc_scope(&game->alloc_stats, ALLOC_PHASE_SERIALIZE);
+            game->deserialize(&b);
+        }
+        fassert(b.offset == b.length);
+        game->observe();
+        if (game->policy != nullptr) {
+            choose_policy_action(game.get());
+        }
+    };
+
+    if (num_threads <= 1 || num_envs <= 1) {
+        for (int e = 0; e < num_envs; e++) {
+            restore_game(e);
+        }
+        return "";
+    }
+
+    std::vector<std::thread> restoring_threads;
+    for (int t = 0; t < num_threads && t < num_envs; t++) {
+        restoring_threads.emplace_back([&, t]() {
+            for (int e = t; e < num_envs; e += num_threads) {
+                restore_game(e);
+            }
+        });
+    }
+    for (auto &t : restoring_threads) {
+        t.join();
+    }
+    return "";
+}
+
+void VecGame::set_policy(const StepPolicy &new_policy) {
+    fassert(new_policy.steps_per_act >= 1);
+    wait_for_stepping_threads();
+    // at this point all games belong to the calling thread
+
+    policy = new_policy;
+    for (const auto &game : games) {
+        game->policy = policy.fn == nullptr ? nullptr : &policy;
+        // games that have already been observed need an action for their next step
+        if (game->policy != nullptr && game->initial_reset_complete) {
+            choose_policy_action(game.get());
+        }
+    }
 }
 
 void VecGame::wait_for_stepping_threads() {
@@ -439,7 +1186,9 @@ extern "C" {
         auto venv = (VecGame *)(handle);
         venv->wait_for_stepping_threads();
         auto b = WriteBuffer(data, length);
-        venv->games.at(env_idx)->serialize(&b);
+        const auto &game = venv->games.at(env_idx);
+        AllocPhaseScope alloc_scope(&game->alloc_stats, ALLOC_PHASE_SERIALIZE);
+        game->serialize(&b);
         b.write_int(END_OF_BUFFER);
         return b.offset;
     }
@@ -448,10 +1197,148 @@ extern "C" {
         auto venv = (VecGame *)(handle);
         venv->wait_for_stepping_threads();
         auto b = ReadBuffer(data, length);
-        venv->games.at(env_idx)->deserialize(&b);
+        {
+            const auto &game = venv->games.at(env_idx);
+            AllocPhaseScope alloc_scope(&game->alloc_stats, ALLOC_PHASE_SERIALIZE);
+            game->deserialize(&b);
+        }
         fassert(b.read_int() == END_OF_BUFFER);
         // after deserializing, we need to update the observation and info buffers so that the
         // next time VecGame::observe() is called, the correct data will be in the buffers
         venv->games.at(env_idx)->observe();
+        if (venv->games.at(env_idx)->policy != nullptr) {
+            choose_policy_action(venv->games.at(env_idx).get());
+        }
+    }
+
+    LIBENV_API void procgen_set_policy(libenv_env *handle, procgen_policy_fn fn, void *user_data, int steps_per_act, int32_t *log_actions, float *log_rewards, uint8_t *log_firsts, uint8_t *log_obs) {
+        auto venv = (VecGame *)(handle);
+        StepPolicy policy;
+        policy.fn = fn;
+        policy.user_data = user_data;
+        policy.steps_per_act = steps_per_act;
+        policy.log_actions = log_actions;
+        policy.log_rewards = log_rewards;
+        policy.log_firsts = log_firsts;
+        policy.log_obs = log_obs;
+        venv->set_policy(policy);
+    }
+
+    LIBENV_API void procgen_set_oracle_policy(libenv_env *handle, int steps_per_act, int32_t *log_actions, float *log_rewards, uint8_t *log_firsts, uint8_t *log_obs) {
+        procgen_set_policy(handle, oracle_policy, handle, steps_per_act, log_actions, log_rewards, log_firsts, log_obs);
+    }
+
+    // requests a checkpoint of every environment at the end of its step in the next act(), see VecGame::checkpoint()
+    LIBENV_API void procgen_checkpoint(libenv_env *handle, const char *path) {
+        auto venv = (VecGame *)(handle);
+        venv->checkpoint(path);
+    }
+
+    // blocks until every requested checkpoint has been written, returns 0 if they all were, otherwise
+    // returns 1 and copies the first error message into error, truncated to length bytes including the terminator
+    LIBENV_API int procgen_wait_for_checkpoints(libenv_env *handle, char *error, int length) {
+        auto venv = (VecGame *)(handle);
+        std::string message = venv->wait_for_checkpoints();
+        if (message == "") {
+            return 0;
+        }
+        if (length > 0) {
+            snprintf(error, length, "%s", message.c_str());
+        }
+        return 1;
+    }
+
+    // blocks until every frame so far has been handed to the recordings, returns 0 if they all were written,
+    // otherwise returns 1 and copies the first error message into error like procgen_wait_for_checkpoints()
+    LIBENV_API int procgen_wait_for_recordings(libenv_env *handle, char *error, int length) {
+        auto venv = (VecGame *)(handle);
+        std::string message = venv->wait_for_recordings();
+        if (message == "") {
+            return 0;
+        }
+        if (length > 0) {
+            snprintf(error, length, "%s", message.c_str());
+        }
+        return 1;
+    }
+
+    // blocks until every step so far has been handed to the dataset files, returns 0 if they all were written,
+    // otherwise returns 1 and copies the first error message into error like procgen_wait_for_checkpoints()
+    LIBENV_API int procgen_wait_for_dataset(libenv_env *handle, char *error, int length) {
+        auto venv = (VecGame *)(handle);
+        std::string message = venv->wait_for_dataset();
+        if (message == "") {
+            return 0;
+        }
+        if (length > 0) {
+            snprintf(error, length, "%s", message.c_str());
+        }
+        return 1;
+    }
+
+    // restores every environment from a checkpoint file, returns 0 on success, otherwise leaves the environments
+    // unchanged and returns 1 with the error message in error like procgen_wait_for_checkpoints()
+    LIBENV_API int procgen_restore_checkpoint(libenv_env *handle, const char *path, int num_threads, char *error, int length) {
+        auto venv = (VecGame *)(handle);
+        std::string message = venv->restore_checkpoint(path, num_threads);
+        if (message == "") {
+            return 0;
+        }
+        if (length > 0) {
+            snprintf(error, length, "%s", message.c_str());
+        }
+        return 1;
+    }
+
+    // copies the allocation counts of every environment, each array holds num_envs * ALLOC_NUM_PHASES values indexed
+    // by env_idx * ALLOC_NUM_PHASES + phase, returns 0 without touching them if the library was built without PROCGEN_ALLOC_TRACKING
+    LIBENV_API int procgen_get_alloc_stats(libenv_env *handle, int64_t *calls, int64_t *allocs, int64_t *bytes) {
+#ifdef PROCGEN_ALLOC_TRACKING
+        auto venv = (VecGame *)(handle);
+        venv->wait_for_stepping_threads();
+        for (int e = 0; e < venv->num_envs; e++) {
+            const auto &stats = venv->games[e]->alloc_stats;
+            for (int phase = 0; phase < ALLOC_NUM_PHASES; phase++) {
+                int idx = e * ALLOC_NUM_PHASES + phase;
+                calls[idx] = stats.calls[phase];
+                allocs[idx] = stats.allocs[phase];
+                bytes[idx] = stats.bytes[phase];
+            }
+        }
+        return 1;
+#else
+        return 0;
+#endif
+    }
+
+    LIBENV_API int64_t procgen_get_spin_pickups(libenv_env *handle) {
+        auto venv = (VecGame *)(handle);
+        return venv->spin_pickups();
+    }
+
+    // writes the oracle action of every environment, -1 for games without an oracle
+    LIBENV_API void get_oracle_actions(libenv_env *handle, int32_t *actions) {
+        auto venv = (VecGame *)(handle);
+        venv->wait_for_stepping_threads();
+        for (int e = 0; e < venv->num_envs; e++) {
+            actions[e] = venv->games[e]->oracle_action();
+        }
+    }
+
+    // call before fork() on every environment that the process will keep using, and procgen_finish_fork()
+    // on each of them in both processes after it, see VecGame::prepare_fork()
+    LIBENV_API void procgen_prepare_fork(libenv_env *handle) {
+        auto venv = (VecGame *)(handle);
+        venv->prepare_fork();
+    }
+
+    LIBENV_API void procgen_finish_fork(libenv_env *handle, int is_child) {
+        auto venv = (VecGame *)(handle);
+        venv->finish_fork(is_child != 0);
+    }
+
+    LIBENV_API void procgen_prewarm(int rand_seed, const char *resource_root) {
+        // load assets before forking so that children share them instead of loading their own
+        std::call_once(global_init_flag, global_init, rand_seed, std::string(resource_root));
     }
 }
\ No newline at end of file
@@ -6,6 +6,7 @@ This implements the libenv interface and manages a vector of Game instances
 
 */
 
+#include <cstdint>
 #include <memory>
 #include <vector>
 #include <mutex>
@@ -13,9 +14,44 @@ This implements the libenv interface and manages a vector of Game instances
 #include <condition_variable>
 #include <thread>
 #include <list>
+#include <atomic>
+#include <functional>
+#include "libenv.h"
 
 class VecOptions;
 class Game;
+class FrameRecorder;
+class TrajectoryWriter;
+class Checkpointer;
+class EvalLevels;
+
+// called on a stepping thread right after env_idx is observed, returns the action for its next step
+// calls for different environments may happen concurrently
+typedef int32_t (*procgen_policy_fn)(void *user_data, int env_idx, const uint8_t *obs, void *const *info, float reward, uint8_t first);
+
+// a policy that picks actions inside the stepping threads, so each act() can run several steps
+// per environment without a round trip through the caller
+struct StepPolicy {
+    procgen_policy_fn fn = nullptr;
+    void *user_data = nullptr;
+    int steps_per_act = 1;
+    // optional buffers that receive every step taken by an act(), indexed by env_idx * steps_per_act + step
+    int32_t *log_actions = nullptr;
+    float *log_rewards = nullptr;
+    uint8_t *log_firsts = nullptr;
+    uint8_t *log_obs = nullptr;
+};
+
+extern "C" {
+// sets the policy of every environment, it picks the action for the next step of an environment right after the
+// environment is observed, including the observation that is current when it is set
+// each act() then runs steps_per_act steps of every environment, and the log buffers, which may be null,
+// must hold num_envs * steps_per_act entries, with num_envs * steps_per_act * 64 * 64 * 3 bytes for log_obs
+// pass a null fn to go back to reading actions from the action buffer
+LIBENV_API void procgen_set_policy(libenv_env *handle, procgen_policy_fn fn, void *user_data, int steps_per_act, int32_t *log_actions, float *log_rewards, uint8_t *log_firsts, uint8_t *log_obs);
+// same as procgen_set_policy, with every environment following its game's oracle
+LIBENV_API void procgen_set_oracle_policy(libenv_env *handle, int steps_per_act, int32_t *log_actions, float *log_rewards, uint8_t *log_firsts, uint8_t *log_obs);
+}
 
 class VecGame {
   public:
@@ -37,6 +73,39 @@ class VecGame {
     void observe();
     void act();
     void wait_for_stepping_threads();
+    // while a policy is set the action buffer is ignored, pass a policy without fn to remove it
+    void set_policy(const StepPolicy &new_policy);
+
+    // init_fn is run once by each new thread before it starts stepping
+    void start_stepping_threads(std::function<void()> init_fn);
+    void stop_stepping_threads();
+    // prepare_fork() stops every thread of the environment and writes out pending checkpoints, recordings
+    // and dataset records, finish_fork() starts the threads again and must be called in both processes
+    // the child stops recording and writing datasets, and any checkpoints it requests start a new file
+    void prepare_fork();
+    void finish_fork(bool is_child);
+
+    // every environment is added to the checkpoint at the end of its step during the next act(), or
+    // right away by wait_for_checkpoints() if act() is not called first, and the file is written in the background
+    void checkpoint(const std::string &path);
+    // returns the first error writing a checkpoint since the last call, or an empty string
+    std::string wait_for_checkpoints();
+    // restores every environment from a checkpoint file, deserializing them on num_threads threads
+    // returns an error message, without changing any environment, if the file can't be read or holds
+    // different games, otherwise an empty string
+    std::string restore_checkpoint(const std::string &path, int num_threads);
+
+    // blocks until every frame so far has been handed to the recordings, and returns the first error
+    // writing them since the last call, or an empty string
+    std::string wait_for_recordings();
+    // blocks until every step so far has been handed to the dataset files, and returns the first error
+    // writing them since the last call, or an empty string
+    std::string wait_for_dataset();
+
+    // number of times a stepping thread found games to step while spinning in caller runs mode, rather than sleeping
+    int64_t spin_pickups() const {
+        return num_spin_pickups.load();
+    }
 
   private:
     // this mutex synchronizes access to pending_games and game->is_waiting_for_step
@@ -49,4 +118,43 @@ class VecGame {
     std::condition_variable pending_game_complete;
     std::vector<std::thread> threads;
     bool time_to_die = false;
+    int num_initializing_threads = 0;
+    // mirrors pending_games.size() so that spinning threads can check it without the mutex
+    std::atomic<int> num_pending_games{0};
+    // counts the times a stepping thread found games while spinning, instead of waiting on pending_games_added
+    std::atomic<int64_t> num_spin_pickups{0};
+
+    // in caller runs mode the thread that calls act() steps games too, and small batches skip the stepping threads
+    bool caller_runs = false;
+    // running average of how long a game takes to step, measured by the calling thread, only used once
+    // num_step_samples reaches MIN_STEP_SAMPLES
+    double mean_step_seconds = 0.0;
+    int num_step_samples = 0;
+
+    // number of games a thread steps together, drawing their observations as one sprite batch, 1 to draw each on its own
+    int render_batch_size = 1;
+    // games being stepped by the calling thread
+    std::vector<std::shared_ptr<Game>> caller_chunk;
+
+    // stepping threads plus the calling thread in caller runs mode
+    int num_stepping_workers() const;
+    void timed_step_games(const std::vector<std::shared_ptr<Game>> &chunk);
+    // steps every game on the calling thread
+    void step_games_inline();
+    // waits until every requested checkpoint is on disk without taking its errors
+    void finish_checkpoints();
+    void step_pending_games();
+
+    StepPolicy policy;
+
+    std::unique_ptr<FrameRecorder> recorder;
+    std::unique_ptr<TrajectoryWriter> trajectory_writer;
+    // set if the environments play a fixed list of level seeds
+    std::unique_ptr<EvalLevels> eval_levels;
+
+    // created by the first checkpoint() call
+    std::unique_ptr<Checkpointer> checkpointer;
+    // arena reserved by checkpoint() that games are assigned to by the next act(), -1 if there is none
+    int requested_checkpoint_arena = -1;
+    void add_requested_checkpoint_now();
 };
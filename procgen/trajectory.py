@@ -0,0 +1,82 @@
+import os
+
+import numpy as np
+from cffi import FFI
+
+from .env import get_lib_path
+
+
+class TrajectoryReader:
+    """
+    Random access reader for datasets written with the `dataset_dir` environment option
+    """
+
+    def __init__(self, dataset_dir, num_threads=4, debug=False):
+        lib_path = get_lib_path(debug=debug)
+
+        self._ffi = FFI()
+        self._ffi.cdef(
+            """
+            void *trajectory_reader_open(const char *dataset_dir);
+            int trajectory_reader_num_envs(void *handle);
+            int trajectory_reader_width(void *handle);
+            int trajectory_reader_height(void *handle);
+            int trajectory_reader_num_steps(void *handle, int env_idx);
+            void trajectory_reader_read(void *handle, int n, const int *env_idxs, const int *starts, int count, uint8_t *obs, int32_t *actions, float *rewards, uint8_t *firsts, int32_t *level_seeds, int num_threads);
+            void trajectory_reader_close(void *handle);
+            """
+        )
+        self._lib = self._ffi.dlopen(lib_path)
+        # if the environment was not closed there is no index yet and the reader rebuilds it from the chunks
+        self._handle = self._lib.trajectory_reader_open(os.fsencode(dataset_dir))
+        self.num_threads = num_threads
+        self.num_envs = self._lib.trajectory_reader_num_envs(self._handle)
+        self.width = self._lib.trajectory_reader_width(self._handle)
+        self.height = self._lib.trajectory_reader_height(self._handle)
+
+    def num_steps(self, env_idx):
+        return self._lib.trajectory_reader_num_steps(self._handle, env_idx)
+
+    def read(self, env_idxs, starts, count):
+        """
+        Decode `count` consecutive steps starting at each (env_idx, start) pair
+
+        `action` is the action that led to each observation, -1 for the initial observation of an environment
+        """
+        env_idxs = np.ascontiguousarray(env_idxs, dtype=np.int32)
+        starts = np.ascontiguousarray(starts, dtype=np.int32)
+        assert env_idxs.shape == starts.shape and env_idxs.ndim == 1
+        n = len(env_idxs)
+        result = dict(
+            rgb=np.zeros((n, count, self.height, self.width, 3), dtype=np.uint8),
+            action=np.zeros((n, count), dtype=np.int32),
+            reward=np.zeros((n, count), dtype=np.float32),
+            first=np.zeros((n, count), dtype=np.uint8),
+            level_seed=np.zeros((n, count), dtype=np.int32),
+        )
+
+        def ptr(arr, ctype):
+            return self._ffi.cast(ctype, arr.ctypes.data)
+
+        self._lib.trajectory_reader_read(
+            self._handle,
+            n,
+            ptr(env_idxs, "int *"),
+            ptr(starts, "int *"),
+            count,
+            ptr(result["rgb"], "uint8_t *"),
+            ptr(result["action"], "int32_t *"),
+            ptr(result["reward"], "float *"),
+            ptr(result["first"], "uint8_t *"),
+            ptr(result["level_seed"], "int32_t *"),
+            self.num_threads,
+        )
+        return result
+
+    def close(self):
+        if self._handle is not None:
+            self._lib.trajectory_reader_close(self._handle)
+            self._handle = None
+
+    def __del__(self):
+        self.close()